@@ -0,0 +1,171 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncBudget.h"
+#include "SyncGlobal.h"
+
+#include <QMetaObject>
+#include <QMutexLocker>
+
+// Every grant also costs this much, so many small requests count too
+#define _OCS_BUDGET_REQUEST_COST 65536
+
+SyncBudget::SyncBudget(QObject *parent)
+    : QObject(parent), mMutex(QMutex::Recursive)
+{
+    mLimit[CONNECTION] = 4;
+    mLimit[DISK] = 1;
+    for( int i = 0; i < RESOURCES; i++ ) {
+        mInUse[i] = 0;
+    }
+}
+
+void SyncBudget::setLimit(Resource resource, int slots)
+{
+    QMutexLocker locker(&mMutex);
+    mLimit[resource] = qMax(1,slots);
+    grant(resource);
+}
+
+int SyncBudget::limit(Resource resource) const
+{
+    QMutexLocker locker(&mMutex);
+    return mLimit[resource];
+}
+
+int SyncBudget::inUse(Resource resource) const
+{
+    QMutexLocker locker(&mMutex);
+    return mInUse[resource];
+}
+
+int SyncBudget::waiting(Resource resource) const
+{
+    QMutexLocker locker(&mMutex);
+    return mWaiting[resource].size();
+}
+
+void SyncBudget::setWeight(QObject *account, double weight)
+{
+    QMutexLocker locker(&mMutex);
+    mWeights.insert(account,weight > 0 ? weight : 1.0);
+}
+
+double SyncBudget::charged(QObject *account) const
+{
+    return mCharged.value(account,0.0);
+}
+
+double SyncBudget::virtualTime() const
+{
+    // The least charged of everyone waiting
+    double time = -1;
+    for( int r = 0; r < RESOURCES; r++ ) {
+        for( int i = 0; i < mWaiting[r].size(); i++ ) {
+            double c = charged(mWaiting[r][i].account);
+            if( time < 0 || c < time ) {
+                time = c;
+            }
+        }
+    }
+    return time < 0 ? 0 : time;
+}
+
+bool SyncBudget::acquire(QObject *account, Resource resource,
+                         const char *member)
+{
+    // Coming back from idle does not earn credit for the time away
+    QMutexLocker locker(&mMutex);
+    double now = virtualTime();
+    if( charged(account) < now ) {
+        mCharged.insert(account,now);
+    }
+
+    if( mInUse[resource] < mLimit[resource] && mWaiting[resource].isEmpty() ) {
+        mInUse[resource]++;
+        charge(account,_OCS_BUDGET_REQUEST_COST);
+        return true;
+    }
+
+    // SLOT() prefixes the signature with a code, invokeMethod wants the name
+    Waiter waiter;
+    waiter.account = account;
+    waiter.method = QByteArray(member+1);
+    waiter.method = waiter.method.left(waiter.method.indexOf('('));
+    mWaiting[resource].append(waiter);
+    return false;
+}
+
+void SyncBudget::release(QObject *account, Resource resource)
+{
+    Q_UNUSED(account);
+    QMutexLocker locker(&mMutex);
+    if( mInUse[resource] > 0 ) {
+        mInUse[resource]--;
+    }
+    grant(resource);
+}
+
+void SyncBudget::charge(QObject *account, qint64 bytes)
+{
+    QMutexLocker locker(&mMutex);
+    mCharged[account] += double(bytes)/mWeights.value(account,1.0);
+}
+
+void SyncBudget::forget(QObject *account)
+{
+    QMutexLocker locker(&mMutex);
+    for( int r = 0; r < RESOURCES; r++ ) {
+        for( int i = mWaiting[r].size()-1; i >= 0; i-- ) {
+            if( mWaiting[r][i].account == account ||
+                    !mWaiting[r][i].account ) {
+                mWaiting[r].removeAt(i);
+            }
+        }
+    }
+    mWeights.remove(account);
+    mCharged.remove(account);
+}
+
+void SyncBudget::grant(Resource resource)
+{
+    while( mInUse[resource] < mLimit[resource] &&
+           !mWaiting[resource].isEmpty() ) {
+        // Lowest charge first, the oldest request wins a tie
+        int best = -1;
+        for( int i = 0; i < mWaiting[resource].size(); i++ ) {
+            if( !mWaiting[resource][i].account ) {
+                continue;
+            }
+            if( best < 0 || charged(mWaiting[resource][i].account) <
+                    charged(mWaiting[resource][best].account) ) {
+                best = i;
+            }
+        }
+        if( best < 0 ) {
+            mWaiting[resource].clear(); // Only accounts that are gone
+            return;
+        }
+        Waiter waiter = mWaiting[resource].takeAt(best);
+        mInUse[resource]++;
+        charge(waiter.account,_OCS_BUDGET_REQUEST_COST);
+        // Queued, so the account never runs inside someone else's release
+        QMetaObject::invokeMethod(waiter.account,waiter.method.constData(),
+                                  Qt::QueuedConnection);
+    }
+}
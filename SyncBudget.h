@@ -0,0 +1,78 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCBUDGET_H
+#define SYNCBUDGET_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QPointer>
+#include <QByteArray>
+#include <QMutex>
+
+/*! \brief Shares connections and disk time fairly between accounts.
+  * An account asks for a slot before each request (or local scan) and
+  * gives it back when done. When slots run out the waiting accounts are
+  * served in weighted fair order: each one is charged for the bytes it
+  * moves, divided by its weight, and the one charged least goes next.
+  * A heavy transfer therefore only ever holds one slot, and the other
+  * accounts keep getting their turns next to it. Accounts on different
+  * threads may call in at the same time, grants arrive on their own thread.
+  */
+class SyncBudget : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SyncBudget(QObject *parent = 0);
+
+    enum Resource {
+        CONNECTION,
+        DISK,
+        RESOURCES
+    };
+
+    void setLimit(Resource resource, int slots);
+    int limit(Resource resource) const;
+    int inUse(Resource resource) const;
+    int waiting(Resource resource) const;
+    void setWeight(QObject *account, double weight);
+
+    bool acquire(QObject *account, Resource resource, const char *member);
+    void release(QObject *account, Resource resource);
+    void charge(QObject *account, qint64 bytes);
+    void forget(QObject *account);
+
+private:
+    struct Waiter {
+        QPointer<QObject> account;
+        QByteArray method;
+    };
+    mutable QMutex mMutex;
+    int mLimit[RESOURCES];
+    int mInUse[RESOURCES];
+    QList<Waiter> mWaiting[RESOURCES];
+    QHash<QObject*,double> mWeights;
+    QHash<QObject*,double> mCharged; // Bytes divided by weight
+
+    double charged(QObject *account) const;
+    double virtualTime() const;
+    void grant(Resource resource);
+};
+
+#endif // SYNCBUDGET_H
@@ -0,0 +1,285 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncDirWatcher.h"
+#include "SyncGlobal.h"
+
+#include <QSocketNotifier>
+#include <QFileSystemWatcher>
+#include <QFile>
+#include <QTimer>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define _OCS_WATCH_MASK (IN_CREATE|IN_MODIFY|IN_CLOSE_WRITE|IN_MOVED_FROM|\
+                         IN_MOVED_TO|IN_DELETE|IN_DELETE_SELF|IN_ONLYDIR)
+#endif
+
+// How long a move out may wait for its move in before it counts as deleted
+#define _OCS_MOVE_TIMEOUT 100
+
+SyncDirWatcher::SyncDirWatcher(QObject *parent)
+    : QObject(parent), mFd(-1), mNotifier(0), mFallback(0)
+{
+    mMoveTimer = new QTimer(this);
+    mMoveTimer->setSingleShot(true);
+    connect(mMoveTimer,SIGNAL(timeout()),this,SLOT(expireMoves()));
+#ifdef Q_OS_LINUX
+    mFd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if( mFd >= 0 ) {
+        mNotifier = new QSocketNotifier(mFd,QSocketNotifier::Read,this);
+        connect(mNotifier,SIGNAL(activated(int)),this,SLOT(readEvents()));
+        return;
+    }
+    syncDebug() << "Could not initialize inotify, falling back";
+#endif
+    mFallback = new QFileSystemWatcher(this);
+    connect(mFallback,SIGNAL(fileChanged(QString)),
+            this,SIGNAL(fileChanged(QString)));
+    connect(mFallback,SIGNAL(directoryChanged(QString)),
+            this,SIGNAL(directoryChanged(QString)));
+}
+
+SyncDirWatcher::~SyncDirWatcher()
+{
+#ifdef Q_OS_LINUX
+    if( mFd >= 0 ) {
+        delete mNotifier;
+        ::close(mFd);
+    }
+#endif
+}
+
+int SyncDirWatcher::count() const
+{
+    if( mFallback ) {
+        return mFallback->directories().size() + mFallback->files().size();
+    }
+    return mWatches.size();
+}
+
+bool SyncDirWatcher::coversFiles() const
+{
+    // Does a directory watch also report changes to the files inside it?
+    return mFallback == 0;
+}
+
+void SyncDirWatcher::addDirectory(QString path)
+{
+    while( path.size() > 1 && path.endsWith("/") )
+        path.chop(1);
+    if( mFallback ) {
+        mFallback->addPath(path);
+        return;
+    }
+#ifdef Q_OS_LINUX
+    if( mWatches.contains(path) ) {
+        return;
+    }
+    int wd = inotify_add_watch(mFd,QFile::encodeName(path).constData(),
+                               _OCS_WATCH_MASK);
+    if( wd < 0 ) {
+        if( errno == ENOSPC ) {
+            syncDebug() << "Out of inotify watches, raise "
+                           "fs.inotify.max_user_watches. Not watching: "
+                        << path;
+        }
+        return;
+    }
+    // The same directory may come back under a new name after a rename
+    // we did not see. Keep only the newest name.
+    if( mPaths.contains(wd) ) {
+        mWatches.remove(mPaths.value(wd));
+    }
+    mPaths.insert(wd,path);
+    mWatches.insert(path,wd);
+#endif
+}
+
+void SyncDirWatcher::addFile(QString path)
+{
+    // With inotify the directory watch already covers its files
+    if( mFallback ) {
+        mFallback->addPath(path);
+    }
+}
+
+void SyncDirWatcher::removeDirectory(QString path)
+{
+    while( path.size() > 1 && path.endsWith("/") )
+        path.chop(1);
+    if( mFallback ) {
+        mFallback->removePath(path);
+        return;
+    }
+#ifdef Q_OS_LINUX
+    QString prefix = path + "/";
+    QList<int> wds;
+    QHash<QString,int>::const_iterator it;
+    for( it = mWatches.constBegin(); it != mWatches.constEnd(); ++it ) {
+        if( it.key() == path || it.key().startsWith(prefix) )
+            wds.append(it.value());
+    }
+    for( int i = 0; i < wds.size(); i++ ) {
+        inotify_rm_watch(mFd,wds[i]);
+        forgetWatch(wds[i]);
+    }
+#endif
+}
+
+void SyncDirWatcher::forgetWatch(int wd)
+{
+    mWatches.remove(mPaths.value(wd));
+    mPaths.remove(wd);
+}
+
+void SyncDirWatcher::ignore(QString path)
+{
+    // Our own changes to this path should not come back as events
+    mIgnored.insert(path);
+    if( mFallback ) {
+        mFallback->removePath(path);
+    }
+}
+
+void SyncDirWatcher::resume(QString path)
+{
+    if( mFallback ) {
+        mIgnored.remove(path);
+        mFallback->addPath(path);
+        return;
+    }
+    // The kernel queued the events of whatever we just did, so drain them
+    // while the path is still ignored.
+    readEvents();
+    mIgnored.remove(path);
+}
+
+void SyncDirWatcher::renameWatches(const QString &from, const QString &to)
+{
+    QString prefix = from + "/";
+    QList<int> wds;
+    QHash<int,QString>::const_iterator it;
+    for( it = mPaths.constBegin(); it != mPaths.constEnd(); ++it ) {
+        if( it.value() == from || it.value().startsWith(prefix) )
+            wds.append(it.key());
+    }
+    for( int i = 0; i < wds.size(); i++ ) {
+        QString path = mPaths.value(wds[i]);
+        mWatches.remove(path);
+        path = to + path.mid(from.size());
+        mPaths.insert(wds[i],path);
+        mWatches.insert(path,wds[i]);
+    }
+}
+
+void SyncDirWatcher::readEvents()
+{
+#ifdef Q_OS_LINUX
+    if( mFd < 0 ) {
+        return;
+    }
+    char buffer[64*1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for(;;) {
+        ssize_t length = ::read(mFd,buffer,sizeof(buffer));
+        if( length <= 0 ) {
+            break; // EAGAIN, nothing left for now
+        }
+        for( char *ptr = buffer; ptr < buffer+length;
+             ptr += sizeof(struct inotify_event) +
+             ((struct inotify_event*)ptr)->len ) {
+            const struct inotify_event *event = (struct inotify_event*)ptr;
+            if( event->mask & IN_Q_OVERFLOW ) {
+                // Events were lost, nothing short of a rescan can tell what
+                syncDebug() << "Watcher queue overflowed";
+                emit overflow();
+                continue;
+            }
+            if( !mPaths.contains(event->wd) ) {
+                continue;
+            }
+            QString dir = mPaths.value(event->wd);
+            if( event->mask & (IN_IGNORED|IN_DELETE_SELF) ) {
+                if( event->mask & IN_IGNORED )
+                    forgetWatch(event->wd);
+                continue;
+            }
+            if( event->len == 0 ) {
+                continue;
+            }
+            QString path = dir + "/" + QFile::decodeName(event->name);
+            if( mIgnored.contains(path) ) {
+                continue;
+            }
+            bool isDir = event->mask & IN_ISDIR;
+
+            if( event->mask & IN_MOVED_FROM ) {
+                mMoves.insert(event->cookie,PendingMove(path,isDir));
+                mMoveTimer->start(_OCS_MOVE_TIMEOUT);
+            } else if ( event->mask & IN_MOVED_TO ) {
+                if( mMoves.contains(event->cookie) ) {
+                    PendingMove move = mMoves.take(event->cookie);
+                    if( move.isDir ) {
+                        renameWatches(move.path,path);
+                    }
+                    emit renamed(move.path,path,isDir);
+                } else if ( isDir ) { // Moved in from outside the tree
+                    emit directoryChanged(dir);
+                } else {
+                    emit fileChanged(path);
+                }
+            } else if ( event->mask & IN_CREATE ) {
+                // New directories need to be scanned and watched. Files
+                // written in place report in again on IN_CLOSE_WRITE, which
+                // the coalescer folds together with this one, but links and
+                // device nodes never do.
+                if( isDir ) {
+                    emit directoryChanged(dir);
+                } else {
+                    emit fileChanged(path);
+                }
+            } else if ( event->mask & (IN_MODIFY|IN_CLOSE_WRITE) ) {
+                if( !isDir )
+                    emit fileChanged(path);
+            } else if ( event->mask & IN_DELETE ) {
+                if( isDir ) {
+                    removeDirectory(path);
+                }
+                emit removed(path,isDir);
+            }
+        }
+    }
+#endif
+}
+
+void SyncDirWatcher::expireMoves()
+{
+    // Whatever got moved out and never came back has left the tree
+    QHash<quint32,PendingMove> moves = mMoves;
+    mMoves.clear();
+    QHash<quint32,PendingMove>::const_iterator it;
+    for( it = moves.constBegin(); it != moves.constEnd(); ++it ) {
+        if( it.value().isDir ) {
+            removeDirectory(it.value().path);
+        }
+        emit removed(it.value().path,it.value().isDir);
+    }
+}
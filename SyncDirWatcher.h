@@ -0,0 +1,85 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCDIRWATCHER_H
+#define SYNCDIRWATCHER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+
+class QSocketNotifier;
+class QFileSystemWatcher;
+class QTimer;
+
+/*! \brief Watches a local tree with one watch per directory.
+  * On Linux this talks to inotify directly and decodes the events itself,
+  * pairing IN_MOVED_FROM/IN_MOVED_TO into renamed(). Elsewhere it falls
+  * back to a QFileSystemWatcher, which also needs to watch every file.
+  * All paths are absolute, without a trailing slash.
+  */
+class SyncDirWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SyncDirWatcher(QObject *parent = 0);
+    ~SyncDirWatcher();
+
+    void addDirectory(QString path);
+    void addFile(QString path);
+    void removeDirectory(QString path);
+    void ignore(QString path);
+    void resume(QString path);
+    int count() const;
+    bool coversFiles() const;
+
+private:
+    int mFd;
+    QSocketNotifier *mNotifier;
+    QFileSystemWatcher *mFallback;
+    QHash<int,QString> mPaths;
+    QHash<QString,int> mWatches;
+    QSet<QString> mIgnored;
+    // A move out of a watched directory whose other half has not shown up
+    struct PendingMove {
+        QString path;
+        bool isDir;
+        PendingMove() : isDir(false) {}
+        PendingMove(QString name, bool dir) : path(name), isDir(dir) {}
+    };
+    QHash<quint32,PendingMove> mMoves;
+    QTimer *mMoveTimer;
+
+    void forgetWatch(int wd);
+    void renameWatches(const QString &from, const QString &to);
+
+signals:
+    void fileChanged(QString path);
+    void directoryChanged(QString path);
+    void removed(QString path, bool isDir);
+    void renamed(QString from, QString to, bool isDir);
+    void overflow();
+
+private slots:
+    void readEvents();
+    void expireMoves();
+};
+
+#endif // SYNCDIRWATCHER_H
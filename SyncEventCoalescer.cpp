@@ -0,0 +1,144 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncEventCoalescer.h"
+
+#include <QTimer>
+#include <QDateTime>
+
+// A path that never goes quiet is still passed on after this many windows
+#define _OCS_COALESCE_MAX_WINDOWS 10
+
+SyncEventCoalescer::SyncEventCoalescer(QObject *parent)
+    : QObject(parent), mWindow(1000)
+{
+    mTimer = new QTimer(this);
+    mTimer->setSingleShot(true);
+    connect(mTimer,SIGNAL(timeout()),this,SLOT(timeout()));
+}
+
+void SyncEventCoalescer::slotFileChanged(QString path)
+{
+    add(path,FILECHANGED,false);
+}
+
+void SyncEventCoalescer::slotDirectoryChanged(QString path)
+{
+    add(path,DIRECTORYCHANGED,true);
+}
+
+void SyncEventCoalescer::slotRemoved(QString path, bool isDir)
+{
+    add(path,REMOVED,isDir);
+}
+
+void SyncEventCoalescer::slotRenamed(QString from, QString to, bool isDir)
+{
+    // What happened before the rename has to reach the engine first
+    flush();
+    emit renamed(from,to,isDir);
+}
+
+void SyncEventCoalescer::add(QString path, EventType type, bool isDir)
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QHash<QString,PendingEvent>::iterator it = mPending.find(path);
+    if( it == mPending.end() ) {
+        PendingEvent event;
+        event.type = type;
+        event.isDir = isDir;
+        event.first = now;
+        event.last = now;
+        mPending.insert(path,event);
+        mOrder.append(path);
+    } else {
+        // A directory listing change never hides a change to the path
+        // itself, everything else simply overrides what came before.
+        if( !(type == DIRECTORYCHANGED && it.value().type != DIRECTORYCHANGED) ) {
+            it.value().type = type;
+            it.value().isDir = isDir;
+        }
+        it.value().last = now;
+    }
+    schedule();
+}
+
+void SyncEventCoalescer::schedule()
+{
+    if( !mTimer->isActive() ) {
+        mTimer->start(mWindow);
+    }
+}
+
+void SyncEventCoalescer::emitEvent(const QString &path,
+                                   const PendingEvent &event)
+{
+    switch(event.type) {
+    case FILECHANGED:
+        emit fileChanged(path);
+        break;
+    case DIRECTORYCHANGED:
+        emit directoryChanged(path);
+        break;
+    case REMOVED:
+        emit removed(path,event.isDir);
+        break;
+    }
+}
+
+void SyncEventCoalescer::timeout()
+{
+    // Pass on whatever has settled, keep the rest for the next round
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 next = -1;
+    QList<QString> order = mOrder;
+    mOrder.clear();
+    for( int i = 0; i < order.size(); i++ ) {
+        QHash<QString,PendingEvent>::iterator it = mPending.find(order[i]);
+        if( it == mPending.end() ) {
+            continue;
+        }
+        qint64 due = qMin(it.value().last + mWindow,
+                          it.value().first +
+                          mWindow*_OCS_COALESCE_MAX_WINDOWS);
+        if( due <= now ) {
+            PendingEvent event = it.value();
+            mPending.erase(it);
+            emitEvent(order[i],event);
+        } else {
+            mOrder.append(order[i]);
+            if( next < 0 || due < next )
+                next = due;
+        }
+    }
+    if( next >= 0 ) {
+        mTimer->start(qMax(qint64(1),next-now));
+    }
+}
+
+void SyncEventCoalescer::flush()
+{
+    QList<QString> order = mOrder;
+    mOrder.clear();
+    mTimer->stop();
+    for( int i = 0; i < order.size(); i++ ) {
+        if( mPending.contains(order[i]) ) {
+            emitEvent(order[i],mPending.take(order[i]));
+        }
+    }
+}
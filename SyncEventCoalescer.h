@@ -0,0 +1,84 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCEVENTCOALESCER_H
+#define SYNCEVENTCOALESCER_H
+
+#include <QObject>
+#include <QString>
+#include <QHash>
+#include <QList>
+
+class QTimer;
+
+/*! \brief Collapses bursts of watcher events into one net change per path.
+  * A path is passed on once it has been quiet for the debounce window (or
+  * has been busy for ten windows in a row). Changes followed by a removal
+  * come out as a removal, a removal followed by a change comes out as a
+  * change. Renames are passed on right away, after everything that came
+  * before them, so their order is kept.
+  */
+class SyncEventCoalescer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SyncEventCoalescer(QObject *parent = 0);
+
+    void setWindow(int msecs) { mWindow = msecs; }
+    int pending() const { return mPending.size(); }
+
+    enum EventType {
+        FILECHANGED,
+        DIRECTORYCHANGED,
+        REMOVED
+    };
+
+private:
+    struct PendingEvent {
+        EventType type;
+        bool isDir;
+        qint64 first;
+        qint64 last;
+    };
+    QHash<QString,PendingEvent> mPending;
+    QList<QString> mOrder;
+    QTimer *mTimer;
+    int mWindow;
+
+    void add(QString path, EventType type, bool isDir);
+    void emitEvent(const QString &path, const PendingEvent &event);
+    void schedule();
+
+signals:
+    void fileChanged(QString path);
+    void directoryChanged(QString path);
+    void removed(QString path, bool isDir);
+    void renamed(QString from, QString to, bool isDir);
+
+public slots:
+    void slotFileChanged(QString path);
+    void slotDirectoryChanged(QString path);
+    void slotRemoved(QString path, bool isDir);
+    void slotRenamed(QString from, QString to, bool isDir);
+    void flush();
+
+private slots:
+    void timeout();
+};
+
+#endif // SYNCEVENTCOALESCER_H
@@ -0,0 +1,111 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncFilterMatcher.h"
+
+SyncFilterMatcher::SyncFilterMatcher()
+{
+    mSize = 0;
+}
+
+QString SyncFilterMatcher::literalFor(const QString &filter)
+{
+    // A filter without stars is matched as a plain substring. So is a glob
+    // whose only stars are at either end, as long as what is left has no
+    // other meaning as a regular expression.
+    if( !filter.contains("*") ) {
+        return filter;
+    }
+    int start = 0;
+    int end = filter.size();
+    while( start < end && filter.at(start) == '*' )
+        start++;
+    while( end > start && filter.at(end-1) == '*' )
+        end--;
+    QString core = filter.mid(start,end-start);
+    if( core.isEmpty() ) {
+        return QString(); // Just stars, leave it to the expression
+    }
+    for( int i = 0; i < core.size(); i++ ) {
+        if( QString("*\\^$|()[]{}+").contains(core.at(i)) ) {
+            return QString();
+        }
+    }
+    return core;
+}
+
+QString SyncFilterMatcher::patternFor(const QString &filter)
+{
+    // Same translation the filters have always had
+    QString pattern(filter);
+    pattern.replace("?","\\\?");
+    pattern.replace(".","\\\.");
+    pattern.replace("*",".*");
+    return pattern;
+}
+
+void SyncFilterMatcher::setFilters(const QStringList &filters)
+{
+    mLiterals.clear();
+    mSeparate.clear();
+    mCombined = QRegExp();
+    mSize = filters.size();
+
+    QStringList patterns;
+    for( int i = 0; i < filters.size(); i++ ) {
+        if( filters[i].isEmpty() ) {
+            continue;
+        }
+        QString literal = literalFor(filters[i]);
+        if( !literal.isEmpty() ) {
+            mLiterals.append(QStringMatcher(literal));
+        } else {
+            patterns.append(patternFor(filters[i]));
+        }
+    }
+    if( patterns.isEmpty() ) {
+        return;
+    }
+
+    mCombined = QRegExp("(?:"+patterns.join(")|(?:")+")");
+    if( !mCombined.isValid() ) {
+        // One bad filter should not disable the others
+        mCombined = QRegExp();
+        for( int i = 0; i < patterns.size(); i++ ) {
+            QRegExp reg(patterns[i]);
+            if( reg.isValid() )
+                mSeparate.append(reg);
+        }
+    }
+}
+
+bool SyncFilterMatcher::matches(const QString &name) const
+{
+    for( int i = 0; i < mLiterals.size(); i++ ) {
+        if( mLiterals[i].indexIn(name) != -1 )
+            return true;
+    }
+    if( !mCombined.isEmpty() && mCombined.indexIn(name) != -1 ) {
+        return true;
+    }
+    for( int i = 0; i < mSeparate.size(); i++ ) {
+        if( mSeparate[i].indexIn(name) != -1 )
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,55 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCFILTERMATCHER_H
+#define SYNCFILTERMATCHER_H
+
+#include <QString>
+#include <QStringList>
+#include <QStringMatcher>
+#include <QRegExp>
+#include <QList>
+
+/*! \brief All the file filters of an account, compiled once.
+  * Plain filters, and globs that only have leading or trailing stars, are
+  * matched as literal substrings. Every other glob is folded into a single
+  * regular expression, so a name is checked with one pass per kind instead
+  * of building a new QRegExp per filter and per file.
+  * Matching is const, but QRegExp is not thread safe: give each thread its
+  * own copy.
+  */
+class SyncFilterMatcher
+{
+public:
+    SyncFilterMatcher();
+
+    void setFilters(const QStringList &filters);
+    bool matches(const QString &name) const;
+    int size() const { return mSize; }
+
+private:
+    int mSize;
+    QList<QStringMatcher> mLiterals;
+    QRegExp mCombined;
+    QList<QRegExp> mSeparate;
+
+    static QString literalFor(const QString &filter);
+    static QString patternFor(const QString &filter);
+};
+
+#endif // SYNCFILTERMATCHER_H
@@ -21,9 +21,10 @@
 
 #include <QIODevice>
 #include <QDebug>
+#include <QMutex>
 
 #define _OCS_VERSION "0.5.3"
-#define _OCS_DB_VERSION 2
+#define _OCS_DB_VERSION 7
 #define _OCS_APP_NAME "SyncQt::ownCloud"
 
 /*! \brief An internal OwnCloud Sync Qt debugging class.
@@ -43,11 +44,16 @@ public:
     }
 
     qint64 writeData(const char* data, qint64 length){
+        // Every account thread logs through here
+        QMutexLocker locker(&mLock);
         qDebug() << data;
         emit debugMessage(QString(data));
         return 0;
     }
 
+private:
+    QMutex mLock;
+
 signals:
     void debugMessage(const QString);
 
@@ -55,6 +61,26 @@ public slots:
 
 };
 
+/*! \brief Quotes a string for the JSON files written next to the database.
+  */
+inline QString syncJsonString(const QString &string)
+{
+    QString out("\"");
+    for( int i = 0; i < string.size(); i++ ) {
+        QChar c = string[i];
+        if( c == '"' || c == '\\' ) {
+            out.append('\\').append(c);
+        } else if( c == '\n' ) {
+            out.append("\\n");
+        } else if( c.unicode() < 0x20 ) {
+            out.append(QString("\\u%1").arg(c.unicode(),4,16,QChar('0')));
+        } else {
+            out.append(c);
+        }
+    }
+    return out.append('"');
+}
+
 #if !defined(QT_NO_DEBUG_STREAM)
 Q_GLOBAL_STATIC( SyncDebug, getSyncDebug)
 Q_CORE_EXPORT_INLINE QDebug syncDebug() { return QDebug(getSyncDebug()); }
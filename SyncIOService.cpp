@@ -0,0 +1,295 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncIOService.h"
+#include "SyncGlobal.h"
+#include "SyncTrace.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QMutexLocker>
+
+#ifdef Q_OS_UNIX
+#include <stdio.h>
+#endif
+
+// Requests queued on one lane, and bytes waiting to be written in total,
+// before the caller is asked to hold back
+#define _OCS_IO_LANE_DEPTH 16
+#define _OCS_IO_MAX_BYTES (32*1024*1024)
+
+// Data is written in pieces of this size
+#define _OCS_IO_CHUNK (256*1024)
+
+SyncIOWorker::SyncIOWorker(SyncIOService *service)
+    : mService(service), mStopping(false)
+{
+    setObjectName("io");
+}
+
+void SyncIOWorker::push(const SyncIORequest &request)
+{
+    QMutexLocker lock(&mMutex);
+    mQueue.enqueue(request);
+    mWake.wakeOne();
+}
+
+void SyncIOWorker::stop()
+{
+    // Whatever is queued still gets done, nobody should lose a download
+    QMutexLocker lock(&mMutex);
+    mStopping = true;
+    mWake.wakeOne();
+}
+
+int SyncIOWorker::queued()
+{
+    QMutexLocker lock(&mMutex);
+    return mQueue.size();
+}
+
+void SyncIOWorker::run()
+{
+    forever {
+        SyncIORequest request;
+        {
+            QMutexLocker lock(&mMutex);
+            while( mQueue.isEmpty() && !mStopping ) {
+                mWake.wait(&mMutex);
+            }
+            if( mQueue.isEmpty() ) {
+                return;
+            }
+            // Only peek, so queued() still counts what is being worked on
+            request = mQueue.head();
+        }
+        SyncIOResult result = perform(request);
+        {
+            QMutexLocker lock(&mMutex);
+            mQueue.dequeue();
+        }
+        mService->complete(result,request.data.size());
+    }
+}
+
+SyncIOResult SyncIOWorker::perform(const SyncIORequest &request)
+{
+    SYNC_TRACE_SCOPE("SyncIOWorker::perform");
+    SyncIOResult result;
+    result.id = request.id;
+    result.type = request.type;
+    result.path = request.path;
+    QDir dir;
+    switch(request.type) {
+    case SyncIORequest::WRITE:
+        result.ok = write(request,&result.error);
+        break;
+    case SyncIORequest::RENAME:
+        result.ok = replace(request.path,request.target);
+        break;
+    case SyncIORequest::REMOVE:
+        result.ok = QFile::remove(request.path);
+        break;
+    case SyncIORequest::MKDIR:
+        result.ok = dir.mkdir(request.path);
+        break;
+    case SyncIORequest::REMOVETREE:
+        // Anything that is not listed stays and makes the last rmdir fail
+        for( int i = 0; i < request.children.size(); i++ ) {
+            if( request.children[i].endsWith("/") ) {
+                dir.rmdir(request.children[i]);
+            } else {
+                QFile::remove(request.children[i]);
+            }
+        }
+        result.ok = dir.rmdir(request.path);
+        break;
+    }
+    if( !result.ok && result.error.isEmpty() ) {
+        result.error = tr("Operation failed");
+    }
+    return result;
+}
+
+bool SyncIOWorker::write(const SyncIORequest &request, QString *error)
+{
+    // Write next to the target and move it into place once complete, so a
+    // half written file is never seen under its real name
+    QFileInfo info(request.path);
+    QDir dir(info.absolutePath());
+    if( !dir.exists() && !dir.mkpath(info.absolutePath()) ) {
+        *error = tr("Could not create %1").arg(info.absolutePath());
+        return false;
+    }
+    QString temp = info.absolutePath()+"/_ocs_downloading."+info.fileName();
+    QFile file(temp);
+    if( !file.open(QIODevice::WriteOnly) ) {
+        *error = file.errorString();
+        return false;
+    }
+    const char *data = request.data.constData();
+    qint64 left = request.data.size();
+    while( left > 0 ) {
+        qint64 written = file.write(data,qMin(left,qint64(_OCS_IO_CHUNK)));
+        if( written <= 0 ) {
+            *error = file.errorString();
+            file.close();
+            QFile::remove(temp);
+            return false;
+        }
+        data += written;
+        left -= written;
+    }
+    file.flush();
+    file.close();
+    if( !replace(temp,request.path) ) {
+        *error = tr("Could not move %1 into place").arg(temp);
+        QFile::remove(temp);
+        return false;
+    }
+    return true;
+}
+
+bool SyncIOWorker::replace(const QString &from, const QString &to)
+{
+#ifdef Q_OS_UNIX
+    // Replaces the target in one step
+    return ::rename(QFile::encodeName(from).constData(),
+                    QFile::encodeName(to).constData()) == 0;
+#else
+    QFile::remove(to);
+    return QFile::rename(from,to);
+#endif
+}
+
+SyncIOService::SyncIOService(int lanes, QObject *parent)
+    : QObject(parent), mNextId(1), mPending(0), mPendingBytes(0)
+{
+    qRegisterMetaType<SyncIOResult>("SyncIOResult");
+    for( int i = 0; i < qMax(1,lanes); i++ ) {
+        SyncIOWorker *worker = new SyncIOWorker(this);
+        mWorkers.append(worker);
+        worker->start();
+    }
+}
+
+SyncIOService::~SyncIOService()
+{
+    for( int i = 0; i < mWorkers.size(); i++ ) {
+        mWorkers[i]->stop();
+    }
+    for( int i = 0; i < mWorkers.size(); i++ ) {
+        mWorkers[i]->wait();
+        delete mWorkers[i];
+    }
+}
+
+qint64 SyncIOService::submit(SyncIORequest request)
+{
+    // The parent directory picks the lane, so one directory stays in order
+    int lane = int(qHash(QFileInfo(request.path).path())%
+                   uint(mWorkers.size()));
+    {
+        QMutexLocker lock(&mMutex);
+        request.id = mNextId++;
+        mPending++;
+        mPendingBytes += request.data.size();
+    }
+    mWorkers[lane]->push(request);
+    return request.id;
+}
+
+void SyncIOService::complete(const SyncIOResult &result, qint64 bytes)
+{
+    {
+        QMutexLocker lock(&mMutex);
+        mPending--;
+        mPendingBytes -= bytes;
+    }
+    // Sent from the worker, so it reaches the receiver through its loop
+    emit finished(result);
+}
+
+qint64 SyncIOService::write(QString path, QByteArray data)
+{
+    SyncIORequest request;
+    request.type = SyncIORequest::WRITE;
+    request.path = path;
+    request.data = data;
+    return submit(request);
+}
+
+qint64 SyncIOService::rename(QString from, QString to)
+{
+    SyncIORequest request;
+    request.type = SyncIORequest::RENAME;
+    request.path = from;
+    request.target = to;
+    return submit(request);
+}
+
+qint64 SyncIOService::remove(QString path)
+{
+    SyncIORequest request;
+    request.type = SyncIORequest::REMOVE;
+    request.path = path;
+    return submit(request);
+}
+
+qint64 SyncIOService::mkdir(QString path)
+{
+    SyncIORequest request;
+    request.type = SyncIORequest::MKDIR;
+    request.path = path;
+    return submit(request);
+}
+
+qint64 SyncIOService::removeTree(QString path, QStringList children)
+{
+    SyncIORequest request;
+    request.type = SyncIORequest::REMOVETREE;
+    request.path = path;
+    request.children = children;
+    return submit(request);
+}
+
+int SyncIOService::pending() const
+{
+    QMutexLocker lock(&mMutex);
+    return mPending;
+}
+
+qint64 SyncIOService::pendingBytes() const
+{
+    QMutexLocker lock(&mMutex);
+    return mPendingBytes;
+}
+
+bool SyncIOService::isSaturated() const
+{
+    if( pendingBytes() > _OCS_IO_MAX_BYTES ) {
+        return true;
+    }
+    for( int i = 0; i < mWorkers.size(); i++ ) {
+        if( mWorkers[i]->queued() >= _OCS_IO_LANE_DEPTH ) {
+            return true;
+        }
+    }
+    return false;
+}
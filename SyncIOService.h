@@ -0,0 +1,137 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCIOSERVICE_H
+#define SYNCIOSERVICE_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QMetaType>
+
+/*! \brief One filesystem operation for the I/O service.
+  * For WRITE, data goes to a temporary file next to path, which is then
+  * renamed over it. REMOVETREE removes the entries listed in children, in
+  * that order, and then the directory at path.
+  */
+struct SyncIORequest {
+    enum Type {
+        WRITE,
+        RENAME,
+        REMOVE,
+        MKDIR,
+        REMOVETREE
+    };
+    qint64 id;
+    Type type;
+    QString path;
+    QString target;     // Where RENAME moves path to
+    QByteArray data;
+    QStringList children;
+    SyncIORequest() : id(0), type(WRITE) {}
+};
+
+/*! \brief What came of one request, handed back through finished().
+  */
+struct SyncIOResult {
+    qint64 id;
+    int type;
+    QString path;
+    bool ok;
+    QString error;
+    SyncIOResult() : id(0), type(0), ok(false) {}
+};
+Q_DECLARE_METATYPE(SyncIOResult)
+
+class SyncIOService;
+
+/*! \brief One lane of the I/O service.
+  * Runs its queue strictly in order on a thread of its own.
+  */
+class SyncIOWorker : public QThread
+{
+    Q_OBJECT
+public:
+    explicit SyncIOWorker(SyncIOService *service);
+
+    void push(const SyncIORequest &request);
+    void stop();
+    int queued();
+
+protected:
+    void run();
+
+private:
+    SyncIOService *mService;
+    QMutex mMutex;
+    QWaitCondition mWake;
+    QQueue<SyncIORequest> mQueue;
+    bool mStopping;
+
+    SyncIOResult perform(const SyncIORequest &request);
+    bool write(const SyncIORequest &request, QString *error);
+    bool replace(const QString &from, const QString &to);
+};
+
+/*! \brief Does the engine's file writes, renames and deletes off its thread.
+  * Requests are spread over a few lanes by their parent directory, so
+  * everything inside one directory happens in the order it was asked for.
+  * The calls return right away with an id, and finished() reports back
+  * through the caller's event loop. Queues are bounded softly: nothing
+  * is ever refused, but isSaturated() tells the caller to hold back new
+  * downloads until the disk has caught up.
+  */
+class SyncIOService : public QObject
+{
+    Q_OBJECT
+    friend class SyncIOWorker;
+public:
+    explicit SyncIOService(int lanes = 2, QObject *parent = 0);
+    ~SyncIOService();
+
+    qint64 write(QString path, QByteArray data);
+    qint64 rename(QString from, QString to);
+    qint64 remove(QString path);
+    qint64 mkdir(QString path);
+    qint64 removeTree(QString path, QStringList children);
+
+    int pending() const;
+    qint64 pendingBytes() const;
+    bool isSaturated() const;
+
+private:
+    QList<SyncIOWorker*> mWorkers;
+    mutable QMutex mMutex;
+    qint64 mNextId;
+    int mPending;
+    qint64 mPendingBytes;
+
+    qint64 submit(SyncIORequest request);
+    void complete(const SyncIOResult &result, qint64 bytes);
+
+signals:
+    void finished(SyncIOResult result);
+};
+
+#endif // SYNCIOSERVICE_H
@@ -0,0 +1,451 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncLocalScanner.h"
+#include "SyncGlobal.h"
+#include "SyncTrace.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+#ifdef OCS_USE_IO_URING
+#include <liburing.h>
+#include <errno.h>
+// Stat requests in flight per submission
+#define _OCS_URING_DEPTH 256
+#endif
+
+// Entries per batch handed back to the database writer
+#define _OCS_SCAN_BATCH 512
+
+SyncLocalScanWorker::SyncLocalScanWorker(SyncLocalScanner *scanner, int index)
+    : mScanner(scanner), mIndex(index), mRing(0)
+{
+    setObjectName(QString("scan %1").arg(index));
+}
+
+void SyncLocalScanWorker::push(const QString &dir)
+{
+    {
+        QMutexLocker lock(&mMutex);
+        mQueue.append(dir);
+    }
+    mScanner->wakeIdle(false);
+}
+
+bool SyncLocalScanWorker::hasWork()
+{
+    QMutexLocker lock(&mMutex);
+    return !mQueue.isEmpty();
+}
+
+bool SyncLocalScanWorker::popBack(QString *dir)
+{
+    QMutexLocker lock(&mMutex);
+    if( mQueue.isEmpty() )
+        return false;
+    *dir = mQueue.takeLast();
+    return true;
+}
+
+bool SyncLocalScanWorker::popFront(QString *dir)
+{
+    QMutexLocker lock(&mMutex);
+    if( mQueue.isEmpty() )
+        return false;
+    *dir = mQueue.takeFirst();
+    return true;
+}
+
+void SyncLocalScanWorker::run()
+{
+#ifdef OCS_USE_IO_URING
+    // One ring per thread. Without one we simply stat entry by entry.
+    mRing = new struct io_uring;
+    if( io_uring_queue_init(_OCS_URING_DEPTH,mRing,0) < 0 ) {
+        delete mRing;
+        mRing = 0;
+    }
+#endif
+    QString dir;
+    while( !mScanner->mCancelled ) {
+        if( mScanner->takeWork(mIndex,&dir) ) {
+            scanDirectory(dir);
+            // Only now is this directory done. Its subdirectories were
+            // counted before, so the total can't drop to zero too early.
+            if( !mScanner->mPending.deref() ) {
+                mScanner->wakeIdle(true); // That was the last one
+            }
+        } else if ( mScanner->mPending == 0 ) {
+            break;
+        } else {
+            // Others still reading, there may be more to steal
+            mScanner->waitForWork();
+        }
+    }
+    flush();
+#ifdef OCS_USE_IO_URING
+    if( mRing ) {
+        io_uring_queue_exit(mRing);
+        delete mRing;
+        mRing = 0;
+    }
+#endif
+}
+
+void SyncLocalScanWorker::flush()
+{
+    if( !mDirs.isEmpty() ) {
+        emit mScanner->directoriesReady(mDirs);
+        mDirs = QVector<SyncLocalDir>();
+        mDirs.reserve(_OCS_SCAN_BATCH);
+    }
+    if( mBatch.isEmpty() )
+        return;
+    mScanner->mEntries.fetchAndAddRelaxed(mBatch.size());
+    emit mScanner->entriesReady(mBatch);
+    // The receiver still shares the old batch, start a fresh one of full
+    // size instead of growing it again entry by entry
+    mBatch = QVector<SyncLocalEntry>();
+    mBatch.reserve(_OCS_SCAN_BATCH);
+}
+
+void SyncLocalScanWorker::scanDirectory(const QString &dir)
+{
+    SYNC_TRACE_SCOPE("SyncLocalScanWorker::scanDirectory");
+#ifdef Q_OS_UNIX
+    // Read the directory through its descriptor, and stat relative to it,
+    // so the kernel does not walk the whole path again for every entry.
+    int fd = ::open(QFile::encodeName(dir).constData(),
+                    O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if( fd < 0 ) {
+        return;
+    }
+
+    // Nothing was added, removed or renamed in here since the last scan?
+    // Then only its subdirectories (which we already know) need a look.
+    struct stat self;
+    if( fstat(fd,&self) == 0 ) {
+        SyncDirStamp stamp(qint64(self.st_mtim.tv_sec)*1000000000LL +
+                           self.st_mtim.tv_nsec,
+                           qint64(self.st_ctim.tv_sec)*1000000000LL +
+                           self.st_ctim.tv_nsec,
+                           qint64(self.st_ino));
+        const SyncScanCache &cache = mScanner->mCache;
+        bool unchanged = cache.stamps.contains(dir) &&
+                cache.stamps.value(dir) == stamp;
+        mDirs.append(SyncLocalDir(dir,stamp,unchanged));
+        if( unchanged ) {
+            ::close(fd);
+            QStringList children = cache.children.value(dir);
+            for( int i = 0; i < children.size(); i++ ) {
+                mScanner->mPending.ref();
+                push(children[i]);
+            }
+            mScanner->mSkipped.ref();
+            if( mDirs.size() >= _OCS_SCAN_BATCH )
+                flush();
+            return;
+        }
+    }
+
+    DIR *handle = fdopendir(fd);
+    if( !handle ) {
+        ::close(fd);
+        return;
+    }
+
+    // First collect the names, then resolve them all at once
+    QList<QByteArray> names;
+    struct dirent *entry;
+    while( (entry = readdir(handle)) != 0 ) {
+        // Only regular files, directories and what links may point to them
+        // (like QDir::Files|QDir::Dirs without QDir::System)
+        if( entry->d_type != DT_REG && entry->d_type != DT_DIR &&
+                entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN ) {
+            continue;
+        }
+        if( !strcmp(entry->d_name,".") || !strcmp(entry->d_name,"..") ) {
+            continue;
+        }
+        if( mFilters.matches(QFile::decodeName(entry->d_name)) ) {
+            continue;
+        }
+        names.append(QByteArray(entry->d_name));
+    }
+
+    QVector<StatResult> stats(names.size());
+    if( !mScanner->mCancelled ) {
+        statEntries(fd,names,&stats);
+    }
+    closedir(handle);
+
+    for( int i = 0; i < names.size() && !mScanner->mCancelled; i++ ) {
+        const StatResult &info = stats[i];
+        if( !info.valid || (!info.isDir && !info.isFile) ) {
+            continue; // Vanished, a dangling link, or something special
+        }
+        QString path = dir + "/" + QFile::decodeName(names[i]);
+        if( info.isDir ) {
+            mBatch.append(SyncLocalEntry(path+"/",info.size,info.lastModified,
+                                         true));
+            mScanner->mPending.ref();
+            push(path);
+        } else {
+            mBatch.append(SyncLocalEntry(path,info.size,info.lastModified,
+                                         false));
+        }
+        if( mBatch.size() >= _OCS_SCAN_BATCH )
+            flush();
+    }
+#else
+    QDir directory(dir);
+    directory.setFilter(QDir::Files|QDir::NoDot|QDir::NoDotDot|
+                        QDir::AllEntries|QDir::Hidden);
+    QFileInfoList list = directory.entryInfoList();
+    for( int i = 0; i < list.size(); i++ ) {
+        if( mScanner->mCancelled )
+            break;
+        QString name = list[i].fileName();
+        if( mFilters.matches(name) ) {
+            continue;
+        }
+        QString path = dir + "/" + name;
+        qint64 last = list[i].lastModified().toUTC().toMSecsSinceEpoch();
+        if( list[i].isDir() ) {
+            mBatch.append(SyncLocalEntry(path+"/",list[i].size(),last,true));
+            mScanner->mPending.ref();
+            push(path);
+        } else {
+            mBatch.append(SyncLocalEntry(path,list[i].size(),last,false));
+        }
+        if( mBatch.size() >= _OCS_SCAN_BATCH )
+            flush();
+    }
+#endif
+}
+
+#ifdef Q_OS_UNIX
+void SyncLocalScanWorker::statEntries(int fd, const QList<QByteArray> &names,
+                                      QVector<StatResult> *stats)
+{
+    int done = 0;
+#ifdef OCS_USE_IO_URING
+    if( mRing ) {
+        done = statEntriesUring(fd,names,stats);
+    }
+#endif
+    // Whatever the ring did not resolve goes through plain fstatat
+    for( int i = done; i < names.size(); i++ ) {
+        struct stat info;
+        StatResult &result = (*stats)[i];
+        if( fstatat(fd,names[i].constData(),&info,0) != 0 ) {
+            continue;
+        }
+        result.valid = true;
+        result.isDir = S_ISDIR(info.st_mode);
+        result.isFile = S_ISREG(info.st_mode);
+        result.size = info.st_size;
+        // Whole seconds, which is what QFileInfo has always given us
+        result.lastModified = qint64(info.st_mtime)*1000;
+    }
+}
+#endif
+
+#ifdef OCS_USE_IO_URING
+int SyncLocalScanWorker::statEntriesUring(int fd, const QList<QByteArray> &names,
+                                          QVector<StatResult> *stats)
+{
+    // Submit up to a full ring of statx requests per system call, and
+    // collect their completions before submitting the next round.
+    QVector<struct statx> buffers(qMin(names.size(),_OCS_URING_DEPTH));
+    int done = 0;
+    while( done < names.size() ) {
+        int count = qMin(names.size()-done,_OCS_URING_DEPTH);
+        for( int i = 0; i < count; i++ ) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(mRing);
+            io_uring_prep_statx(sqe,fd,names[done+i].constData(),0,
+                                STATX_TYPE|STATX_MODE|STATX_SIZE|STATX_MTIME,
+                                &buffers[i]);
+            io_uring_sqe_set_data(sqe,(void*)(quintptr)i);
+        }
+        int submitted = io_uring_submit_and_wait(mRing,count);
+        if( submitted != count ) {
+            // Not supported by this kernel (or out of resources). Reap
+            // what was queued and let fstatat handle the rest from now on.
+            struct io_uring_cqe *cqe;
+            for( int i = 0; i < submitted; i++ ) {
+                if( io_uring_wait_cqe(mRing,&cqe) == 0 )
+                    io_uring_cqe_seen(mRing,cqe);
+            }
+            io_uring_queue_exit(mRing);
+            delete mRing;
+            mRing = 0;
+            return done;
+        }
+        bool unsupported = false;
+        for( int i = 0; i < count; i++ ) {
+            struct io_uring_cqe *cqe;
+            if( io_uring_wait_cqe(mRing,&cqe) != 0 ) {
+                unsupported = true;
+                break;
+            }
+            int index = (int)(quintptr)io_uring_cqe_get_data(cqe);
+            if( cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP ) {
+                unsupported = true; // Kernel without IORING_OP_STATX
+            } else if( cqe->res == 0 ) {
+                const struct statx &info = buffers[index];
+                StatResult &result = (*stats)[done+index];
+                result.valid = true;
+                result.isDir = S_ISDIR(info.stx_mode);
+                result.isFile = S_ISREG(info.stx_mode);
+                result.size = info.stx_size;
+                result.lastModified = qint64(info.stx_mtime.tv_sec)*1000;
+            }
+            io_uring_cqe_seen(mRing,cqe);
+        }
+        if( unsupported ) {
+            io_uring_queue_exit(mRing);
+            delete mRing;
+            mRing = 0;
+            return done; // Redo this round with fstatat
+        }
+        done += count;
+    }
+    return done;
+}
+#endif
+
+SyncLocalScanner::SyncLocalScanner(QObject *parent)
+    : QObject(parent), mPending(0), mCancelled(0), mEntries(0), mSkipped(0),
+      mRunning(0), mStarted(0)
+{
+    qRegisterMetaType<QVector<SyncLocalEntry> >("QVector<SyncLocalEntry>");
+    qRegisterMetaType<QVector<SyncLocalDir> >("QVector<SyncLocalDir>");
+    int threads = qBound(2,QThread::idealThreadCount(),8);
+    for( int i = 0; i < threads; i++ ) {
+        SyncLocalScanWorker *worker = new SyncLocalScanWorker(this,i);
+        connect(worker,SIGNAL(finished()),this,SLOT(workerFinished()));
+        mWorkers.append(worker);
+    }
+}
+
+SyncLocalScanner::~SyncLocalScanner()
+{
+    cancel();
+    for( int i = 0; i < mWorkers.size(); i++ ) {
+        mWorkers[i]->wait();
+        delete mWorkers[i];
+    }
+}
+
+void SyncLocalScanner::start(QString root, const SyncFilterMatcher &filters,
+                             const SyncScanCache &cache)
+{
+    if( isRunning() ) {
+        return;
+    }
+    mCache = cache; // Only read by the workers from here on
+    mCancelled = 0;
+    mEntries = 0;
+    mSkipped = 0;
+    mPending = 1;
+    mStarted = QDateTime::currentMSecsSinceEpoch();
+    mWorkers[0]->push(root);
+    mRunning = mWorkers.size();
+    for( int i = 0; i < mWorkers.size(); i++ ) {
+        // Every worker gets its own copy, QRegExp is not thread safe
+        mWorkers[i]->setFilters(filters);
+        mWorkers[i]->start();
+    }
+}
+
+void SyncLocalScanner::cancel()
+{
+    mCancelled = 1;
+    wakeIdle(true);
+}
+
+void SyncLocalScanner::waitForWork()
+{
+    // Checked again under the lock that push() and the end of the scan
+    // signal under, so no wake up can slip in between
+    QMutexLocker lock(&mIdleMutex);
+    if( mCancelled || mPending == 0 ) {
+        return;
+    }
+    for( int i = 0; i < mWorkers.size(); i++ ) {
+        if( mWorkers[i]->hasWork() ) {
+            return;
+        }
+    }
+    mWorkAvailable.wait(&mIdleMutex);
+}
+
+void SyncLocalScanner::wakeIdle(bool all)
+{
+    QMutexLocker lock(&mIdleMutex);
+    if( all ) {
+        mWorkAvailable.wakeAll();
+    } else {
+        mWorkAvailable.wakeOne();
+    }
+}
+
+bool SyncLocalScanner::takeWork(int index, QString *dir)
+{
+    if( mWorkers[index]->popBack(dir) ) {
+        return true;
+    }
+    // Steal the oldest (and usually biggest) directory from someone else
+    for( int i = 1; i < mWorkers.size(); i++ ) {
+        if( mWorkers[(index+i)%mWorkers.size()]->popFront(dir) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SyncLocalScanner::workerFinished()
+{
+    if( --mRunning > 0 ) {
+        return;
+    }
+    // Drop whatever a cancelled scan left behind
+    for( int i = 0; i < mWorkers.size(); i++ ) {
+        QString dir;
+        while( mWorkers[i]->popFront(&dir) ) {}
+    }
+    syncDebug() << "Scanned" << int(mEntries) << "local entries in"
+                << QDateTime::currentMSecsSinceEpoch()-mStarted << "ms,"
+                << int(mSkipped) << "unchanged directories skipped";
+    mCache = SyncScanCache();
+    if( !mCancelled )
+        emit finished();
+}
@@ -0,0 +1,192 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCLOCALSCANNER_H
+#define SYNCLOCALSCANNER_H
+
+#include "SyncFilterMatcher.h"
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QByteArray>
+#include <QHash>
+#include <QStringList>
+#include <QMetaType>
+
+struct io_uring;
+
+/*! \brief What the scanner knows about one local file or directory.
+  * Directories carry a trailing slash, like everywhere else.
+  */
+struct SyncLocalEntry {
+    QString path;
+    qint64 size;
+    qint64 lastModified; // UTC, milliseconds since epoch
+    bool isDir;
+    SyncLocalEntry() : size(0), lastModified(0), isDir(false) {}
+    SyncLocalEntry(QString name, qint64 fileSize, qint64 last, bool dir)
+        : path(name), size(fileSize), lastModified(last), isDir(dir) {}
+};
+Q_DECLARE_TYPEINFO(SyncLocalEntry, Q_MOVABLE_TYPE);
+Q_DECLARE_METATYPE(QVector<SyncLocalEntry>)
+
+/*! \brief Identifies one state of a directory's entry list.
+  * Adding, removing or renaming an entry changes the mtime, and replacing
+  * the directory changes the inode.
+  */
+struct SyncDirStamp {
+    qint64 mtime; // Nanoseconds
+    qint64 ctime; // Nanoseconds
+    qint64 inode;
+    SyncDirStamp() : mtime(0), ctime(0), inode(0) {}
+    SyncDirStamp(qint64 m, qint64 c, qint64 i) : mtime(m), ctime(c), inode(i) {}
+    bool operator==(const SyncDirStamp &other) const {
+        return mtime == other.mtime && ctime == other.ctime &&
+                inode == other.inode;
+    }
+};
+
+/*! \brief A directory the scanner opened.
+  * When unchanged is set its entries were not read again: the caller
+  * should reuse what it already knows about them.
+  */
+struct SyncLocalDir {
+    QString path;
+    SyncDirStamp stamp;
+    bool unchanged;
+    SyncLocalDir() : unchanged(false) {}
+    SyncLocalDir(QString name, SyncDirStamp dirStamp, bool same)
+        : path(name), stamp(dirStamp), unchanged(same) {}
+};
+Q_DECLARE_TYPEINFO(SyncLocalDir, Q_MOVABLE_TYPE);
+Q_DECLARE_METATYPE(QVector<SyncLocalDir>)
+
+/*! \brief What the last scan saw, so unchanged directories can be skipped.
+  * Keys are directory paths without a trailing slash. children holds the
+  * known subdirectories of each directory, to keep descending through the
+  * ones that are skipped.
+  */
+struct SyncScanCache {
+    QHash<QString,SyncDirStamp> stamps;
+    QHash<QString,QStringList> children;
+};
+
+class SyncLocalScanner;
+
+/*! \brief One scanning thread.
+  * Works off its own deque from the back, and steals from the front of the
+  * other workers' deques once it runs dry. When built with
+  * OCS_USE_IO_URING, the entries of a directory are resolved with batched
+  * statx requests through io_uring, falling back to fstatat when the
+  * kernel can't do that.
+  */
+class SyncLocalScanWorker : public QThread
+{
+    Q_OBJECT
+public:
+    SyncLocalScanWorker(SyncLocalScanner *scanner, int index);
+
+    void push(const QString &dir);
+    bool popBack(QString *dir);
+    bool popFront(QString *dir);
+    bool hasWork();
+    void setFilters(const SyncFilterMatcher &filters) { mFilters = filters; }
+
+protected:
+    void run();
+
+private:
+    SyncLocalScanner *mScanner;
+    int mIndex;
+    QMutex mMutex;
+    QList<QString> mQueue;
+    SyncFilterMatcher mFilters;
+    QVector<SyncLocalEntry> mBatch;
+    QVector<SyncLocalDir> mDirs;
+    struct io_uring *mRing;
+
+    struct StatResult {
+        bool valid;
+        bool isDir;
+        bool isFile;
+        qint64 size;
+        qint64 lastModified;
+        StatResult() : valid(false), isDir(false), isFile(false), size(0),
+            lastModified(0) {}
+    };
+
+    void scanDirectory(const QString &dir);
+    void statEntries(int fd, const QList<QByteArray> &names,
+                     QVector<StatResult> *stats);
+    int statEntriesUring(int fd, const QList<QByteArray> &names,
+                         QVector<StatResult> *stats);
+    void flush();
+};
+
+/*! \brief Walks a local tree on a pool of threads.
+  * Found entries are handed back in batches through entriesReady(), which
+  * reaches the receiver through its event loop, and every directory opened
+  * is reported through directoriesReady(). Directories whose stamp matches
+  * the cache passed to start() are not read at all. finished() follows
+  * once the last batch has been sent.
+  */
+class SyncLocalScanner : public QObject
+{
+    Q_OBJECT
+    friend class SyncLocalScanWorker;
+public:
+    explicit SyncLocalScanner(QObject *parent = 0);
+    ~SyncLocalScanner();
+
+    void start(QString root, const SyncFilterMatcher &filters,
+               const SyncScanCache &cache = SyncScanCache());
+    void cancel();
+    bool isRunning() const { return mRunning > 0; }
+
+private:
+    QList<SyncLocalScanWorker*> mWorkers;
+    SyncScanCache mCache;
+    QAtomicInt mPending;   // Directories queued or being read
+    QAtomicInt mCancelled;
+    QAtomicInt mEntries;
+    QAtomicInt mSkipped;
+    int mRunning;
+    qint64 mStarted;
+    QMutex mIdleMutex;
+    QWaitCondition mWorkAvailable; // Idle workers wait here for more
+
+    bool takeWork(int index, QString *dir);
+    void waitForWork();
+    void wakeIdle(bool all);
+
+signals:
+    void entriesReady(QVector<SyncLocalEntry> entries);
+    void directoriesReady(QVector<SyncLocalDir> directories);
+    void finished();
+
+private slots:
+    void workerFinished();
+};
+
+#endif // SYNCLOCALSCANNER_H
@@ -0,0 +1,98 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncLoopMonitor.h"
+#include "SyncGlobal.h"
+
+#include <QTimer>
+
+// How often the loop is probed while the monitor runs
+#define _OCS_LOOP_PROBE 20
+
+SyncLoopMonitor::SyncLoopMonitor(QObject *parent)
+    : QObject(parent)
+{
+    mTimer = new QTimer(this);
+    mTimer->setInterval(_OCS_LOOP_PROBE);
+    connect(mTimer,SIGNAL(timeout()),this,SLOT(probe()));
+    reset();
+}
+
+void SyncLoopMonitor::reset()
+{
+    mSamples = 0;
+    mMaxLag = 0;
+    mTotalLag = 0;
+    for( int i = 0; i < BUCKETS; i++ ) {
+        mCounts[i] = 0;
+    }
+}
+
+void SyncLoopMonitor::start()
+{
+    if( mTimer->isActive() ) {
+        return;
+    }
+    mClock.start();
+    mTimer->start();
+}
+
+void SyncLoopMonitor::stop()
+{
+    mTimer->stop();
+}
+
+bool SyncLoopMonitor::isRunning() const
+{
+    return mTimer->isActive();
+}
+
+void SyncLoopMonitor::probe()
+{
+    // Whatever is past the interval is time the loop could not get to us
+    qint64 lag = qMax(qint64(0),mClock.restart()-_OCS_LOOP_PROBE);
+    mSamples++;
+    mTotalLag += lag;
+    mMaxLag = qMax(mMaxLag,lag);
+    if( lag < 2 ) {
+        mCounts[UNDER2MS]++;
+    } else if( lag < 5 ) {
+        mCounts[UNDER5MS]++;
+    } else if( lag < 20 ) {
+        mCounts[UNDER20MS]++;
+    } else if( lag < 100 ) {
+        mCounts[UNDER100MS]++;
+    } else {
+        mCounts[OVER100MS]++;
+    }
+}
+
+QString SyncLoopMonitor::summary() const
+{
+    if( mSamples == 0 ) {
+        return tr("no samples");
+    }
+    return tr("max %1 ms, mean %2 ms over %3 probes "
+              "(<2ms %4, <5ms %5, <20ms %6, <100ms %7, more %8)")
+            .arg(mMaxLag)
+            .arg(double(mTotalLag)/double(mSamples),0,'f',2)
+            .arg(mSamples)
+            .arg(mCounts[UNDER2MS]).arg(mCounts[UNDER5MS])
+            .arg(mCounts[UNDER20MS]).arg(mCounts[UNDER100MS])
+            .arg(mCounts[OVER100MS]);
+}
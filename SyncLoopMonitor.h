@@ -0,0 +1,71 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCLOOPMONITOR_H
+#define SYNCLOOPMONITOR_H
+
+#include <QObject>
+#include <QString>
+#include <QElapsedTimer>
+
+class QTimer;
+
+/*! \brief Measures how long the event loop of its thread gets held up.
+  * While running it probes the loop at a fixed interval and records how
+  * late each probe fired. A late probe means something ran for that long
+  * without going back to the loop. Only runs while asked to, so an idle
+  * thread is not woken up for it.
+  */
+class SyncLoopMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SyncLoopMonitor(QObject *parent = 0);
+
+    enum Bucket {
+        UNDER2MS,
+        UNDER5MS,
+        UNDER20MS,
+        UNDER100MS,
+        OVER100MS,
+        BUCKETS
+    };
+
+    void start();
+    void stop();
+    void reset();
+    bool isRunning() const;
+    qint64 samples() const { return mSamples; }
+    qint64 maxLag() const { return mMaxLag; }
+    qint64 stalls() const { return mCounts[UNDER20MS] + mCounts[UNDER100MS]
+                + mCounts[OVER100MS]; }
+    QString summary() const;
+
+private:
+    QTimer *mTimer;
+    QElapsedTimer mClock;
+    qint64 mSamples;
+    qint64 mMaxLag;
+    qint64 mTotalLag;
+    qint64 mCounts[BUCKETS];
+
+private slots:
+    void probe();
+};
+
+#endif // SYNCLOOPMONITOR_H
@@ -0,0 +1,288 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncMetrics.h"
+#include "SyncGlobal.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+
+SyncMetrics::Counters::Counters()
+    : listingEntries(0), statements(0), filesScanned(0), retries(0),
+      aborts(0), passes(0)
+{
+    for( int i = 0; i < PHASES; i++ ) {
+        phaseMSecs[i] = 0;
+    }
+    for( int i = 0; i < QWebDAV::DAVTYPES; i++ ) {
+        requests[i] = bytesSent[i] = bytesReceived[i] = 0;
+    }
+}
+
+SyncMetrics::Counters SyncMetrics::Counters::operator-(
+        const Counters &other) const
+{
+    Counters diff;
+    for( int i = 0; i < PHASES; i++ ) {
+        diff.phaseMSecs[i] = phaseMSecs[i] - other.phaseMSecs[i];
+    }
+    for( int i = 0; i < QWebDAV::DAVTYPES; i++ ) {
+        diff.requests[i] = requests[i] - other.requests[i];
+        diff.bytesSent[i] = bytesSent[i] - other.bytesSent[i];
+        diff.bytesReceived[i] = bytesReceived[i] - other.bytesReceived[i];
+    }
+    diff.listingEntries = listingEntries - other.listingEntries;
+    diff.statements = statements - other.statements;
+    diff.filesScanned = filesScanned - other.filesScanned;
+    diff.retries = retries - other.retries;
+    diff.aborts = aborts - other.aborts;
+    diff.passes = passes - other.passes;
+    return diff;
+}
+
+SyncMetrics::SyncMetrics(QString account)
+    : mAccount(account), mInPass(false), mPhase(IDLE), mLastPassEnded(0)
+{
+    mPhaseTimer.start();
+}
+
+const char *SyncMetrics::phaseName(int phase)
+{
+    switch(phase) {
+    case CHECKSETTINGS: return "check_settings";
+    case LISTREMOTE: return "list_remote";
+    case LISTLOCAL: return "list_local";
+    case TRANSFER: return "transfer";
+    default: return "idle";
+    }
+}
+
+void SyncMetrics::closePhase()
+{
+    mTotal.phaseMSecs[mPhase] += mPhaseTimer.restart();
+}
+
+void SyncMetrics::enterPhase(int phase)
+{
+    if( phase < 0 || phase >= PHASES || phase == mPhase ) {
+        return;
+    }
+    closePhase();
+    mPhase = phase;
+}
+
+void SyncMetrics::beginPass()
+{
+    closePhase();
+    mPassStart = mTotal;
+    mInPass = true;
+}
+
+void SyncMetrics::endPass(bool aborted)
+{
+    if( !mInPass ) {
+        return;
+    }
+    enterPhase(IDLE);
+    closePhase();
+    mTotal.passes++;
+    if( aborted ) {
+        mTotal.aborts++;
+    }
+    mLastPass = mTotal - mPassStart;
+    mLastPassEnded = QDateTime::currentMSecsSinceEpoch();
+    mInPass = false;
+}
+
+void SyncMetrics::setDav(const QWebDAV::Stats &stats)
+{
+    for( int i = 0; i < QWebDAV::DAVTYPES; i++ ) {
+        mTotal.requests[i] = stats.requests[i];
+        mTotal.bytesSent[i] = stats.bytesSent[i];
+        mTotal.bytesReceived[i] = stats.bytesReceived[i];
+    }
+    mTotal.listingEntries = stats.listingEntries;
+}
+
+QString SyncMetrics::summary() const
+{
+    qint64 requests = 0;
+    qint64 bytes = 0;
+    for( int i = 1; i < QWebDAV::DAVTYPES; i++ ) {
+        requests += mLastPass.requests[i];
+        bytes += mLastPass.bytesSent[i] + mLastPass.bytesReceived[i];
+    }
+    QString phases;
+    for( int i = CHECKSETTINGS; i < PHASES; i++ ) {
+        phases += QString(" %1=%2ms").arg(phaseName(i))
+                .arg(mLastPass.phaseMSecs[i]);
+    }
+    return QString("Pass metrics:%1, %2 requests, %3 bytes, %4 entries listed,"
+                   " %5 files scanned, %6 statements")
+            .arg(phases).arg(requests).arg(bytes)
+            .arg(mLastPass.listingEntries).arg(mLastPass.filesScanned)
+            .arg(mLastPass.statements);
+}
+
+static QString jsonCounters(const SyncMetrics::Counters &c,
+                            const char *(*phase)(int))
+{
+    QStringList phases;
+    for( int i = 0; i < SyncMetrics::PHASES; i++ ) {
+        phases.append(QString("\"%1\": %2").arg(phase(i))
+                      .arg(c.phaseMSecs[i]));
+    }
+    QStringList verbs;
+    for( int i = 1; i < QWebDAV::DAVTYPES; i++ ) {
+        verbs.append(QString("\"%1\": {\"requests\": %2, \"bytes_sent\": %3,"
+                             " \"bytes_received\": %4}")
+                     .arg(QWebDAV::verbName(i)).arg(c.requests[i])
+                     .arg(c.bytesSent[i]).arg(c.bytesReceived[i]));
+    }
+    QString json("{\n");
+    json += QString("    \"passes\": %1,\n").arg(c.passes);
+    json += QString("    \"phase_msecs\": {%1},\n").arg(phases.join(", "));
+    json += QString("    \"dav\": {%1},\n").arg(verbs.join(", "));
+    json += QString("    \"listing_entries\": %1,\n").arg(c.listingEntries);
+    json += QString("    \"db_statements\": %1,\n").arg(c.statements);
+    json += QString("    \"files_scanned\": %1,\n").arg(c.filesScanned);
+    json += QString("    \"retries\": %1,\n").arg(c.retries);
+    json += QString("    \"aborts\": %1\n").arg(c.aborts);
+    return json + "  }";
+}
+
+QByteArray SyncMetrics::toJson() const
+{
+    QString json("{\n");
+    json += QString("  \"account\": %1,\n").arg(syncJsonString(mAccount));
+    json += QString("  \"last_pass_ended\": %1,\n").arg(mLastPassEnded);
+    json += QString("  \"total\": %1,\n")
+            .arg(jsonCounters(mTotal,phaseName));
+    json += QString("  \"last_pass\": %1\n")
+            .arg(jsonCounters(mLastPass,phaseName));
+    json += "}\n";
+    return json.toUtf8();
+}
+
+QByteArray SyncMetrics::toPrometheus() const
+{
+    // Label values escape the same way JSON strings do
+    QString account = syncJsonString(mAccount);
+    QString out;
+    out += "# TYPE owncloud_sync_passes_total counter\n";
+    out += QString("owncloud_sync_passes_total{account=%1} %2\n")
+            .arg(account).arg(mTotal.passes);
+    out += "# TYPE owncloud_sync_aborts_total counter\n";
+    out += QString("owncloud_sync_aborts_total{account=%1} %2\n")
+            .arg(account).arg(mTotal.aborts);
+    out += "# TYPE owncloud_sync_retries_total counter\n";
+    out += QString("owncloud_sync_retries_total{account=%1} %2\n")
+            .arg(account).arg(mTotal.retries);
+    out += "# TYPE owncloud_sync_phase_seconds_total counter\n";
+    for( int i = 0; i < PHASES; i++ ) {
+        out += QString("owncloud_sync_phase_seconds_total{account=%1,"
+                       "phase=\"%2\"} %3\n").arg(account).arg(phaseName(i))
+                .arg(mTotal.phaseMSecs[i]/1000.0,0,'f',3);
+    }
+    out += "# TYPE owncloud_sync_requests_total counter\n";
+    for( int i = 1; i < QWebDAV::DAVTYPES; i++ ) {
+        out += QString("owncloud_sync_requests_total{account=%1,verb=\"%2\"}"
+                       " %3\n").arg(account).arg(QWebDAV::verbName(i))
+                .arg(mTotal.requests[i]);
+    }
+    out += "# TYPE owncloud_sync_sent_bytes_total counter\n";
+    for( int i = 1; i < QWebDAV::DAVTYPES; i++ ) {
+        out += QString("owncloud_sync_sent_bytes_total{account=%1,verb=\"%2\"}"
+                       " %3\n").arg(account).arg(QWebDAV::verbName(i))
+                .arg(mTotal.bytesSent[i]);
+    }
+    out += "# TYPE owncloud_sync_received_bytes_total counter\n";
+    for( int i = 1; i < QWebDAV::DAVTYPES; i++ ) {
+        out += QString("owncloud_sync_received_bytes_total{account=%1,"
+                       "verb=\"%2\"} %3\n").arg(account)
+                .arg(QWebDAV::verbName(i)).arg(mTotal.bytesReceived[i]);
+    }
+    out += "# TYPE owncloud_sync_listing_entries_total counter\n";
+    out += QString("owncloud_sync_listing_entries_total{account=%1} %2\n")
+            .arg(account).arg(mTotal.listingEntries);
+    out += "# TYPE owncloud_sync_db_statements_total counter\n";
+    out += QString("owncloud_sync_db_statements_total{account=%1} %2\n")
+            .arg(account).arg(mTotal.statements);
+    out += "# TYPE owncloud_sync_files_scanned_total counter\n";
+    out += QString("owncloud_sync_files_scanned_total{account=%1} %2\n")
+            .arg(account).arg(mTotal.filesScanned);
+
+    // What the last pass alone did
+    out += "# TYPE owncloud_sync_last_pass_seconds gauge\n";
+    for( int i = CHECKSETTINGS; i < PHASES; i++ ) {
+        out += QString("owncloud_sync_last_pass_seconds{account=%1,"
+                       "phase=\"%2\"} %3\n").arg(account).arg(phaseName(i))
+                .arg(mLastPass.phaseMSecs[i]/1000.0,0,'f',3);
+    }
+    out += "# TYPE owncloud_sync_last_pass_requests gauge\n";
+    for( int i = 1; i < QWebDAV::DAVTYPES; i++ ) {
+        out += QString("owncloud_sync_last_pass_requests{account=%1,"
+                       "verb=\"%2\"} %3\n").arg(account)
+                .arg(QWebDAV::verbName(i)).arg(mLastPass.requests[i]);
+    }
+    out += "# TYPE owncloud_sync_last_pass_listing_entries gauge\n";
+    out += QString("owncloud_sync_last_pass_listing_entries{account=%1} %2\n")
+            .arg(account).arg(mLastPass.listingEntries);
+    out += "# TYPE owncloud_sync_last_pass_db_statements gauge\n";
+    out += QString("owncloud_sync_last_pass_db_statements{account=%1} %2\n")
+            .arg(account).arg(mLastPass.statements);
+    out += "# TYPE owncloud_sync_last_pass_files_scanned gauge\n";
+    out += QString("owncloud_sync_last_pass_files_scanned{account=%1} %2\n")
+            .arg(account).arg(mLastPass.filesScanned);
+    out += "# TYPE owncloud_sync_last_pass_end_seconds gauge\n";
+    out += QString("owncloud_sync_last_pass_end_seconds{account=%1} %2\n")
+            .arg(account).arg(mLastPassEnded/1000);
+    return out.toUtf8();
+}
+
+// Written aside and renamed over, so a collector never reads half a file
+static bool writeReplacing(QString fileName, const QByteArray &data)
+{
+    QString temp = fileName + ".tmp";
+    QFile file(temp);
+    if( !file.open(QIODevice::WriteOnly|QIODevice::Truncate) ) {
+        return false;
+    }
+    if( file.write(data) != data.size() ) {
+        file.close();
+        file.remove();
+        return false;
+    }
+    file.close();
+    QFile::remove(fileName);
+    return QFile::rename(temp,fileName);
+}
+
+bool SyncMetrics::save(QString directory) const
+{
+    QDir dir;
+    if( !dir.mkpath(directory) ) {
+        return false;
+    }
+    QString base = directory + "/" + mAccount;
+    bool json = writeReplacing(base + ".json",toJson());
+    bool prom = writeReplacing(base + ".prom",toPrometheus());
+    return json && prom;
+}
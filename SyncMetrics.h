@@ -0,0 +1,94 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCMETRICS_H
+#define SYNCMETRICS_H
+
+#include <QString>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include "QWebDAV.h"
+
+/*! \brief Counters for one account, kept over its lifetime and per pass.
+  * The engine reports the phase it enters, the files it scans and the
+  * passes it retries; the request and byte counts are copied from the
+  * QWebDAV instance and the statement count is bumped by an SQLite trace
+  * hook. Everything is written out after each pass, as JSON and in the
+  * Prometheus text format, so a textfile collector can pick it up.
+  */
+class SyncMetrics
+{
+public:
+    enum Phase {
+        IDLE,
+        CHECKSETTINGS,
+        LISTREMOTE,
+        LISTLOCAL,
+        TRANSFER,
+        PHASES
+    };
+
+    struct Counters {
+        qint64 phaseMSecs[PHASES];
+        qint64 requests[QWebDAV::DAVTYPES];
+        qint64 bytesSent[QWebDAV::DAVTYPES];
+        qint64 bytesReceived[QWebDAV::DAVTYPES];
+        qint64 listingEntries;
+        qint64 statements;
+        qint64 filesScanned;
+        qint64 retries;
+        qint64 aborts;
+        qint64 passes;
+        Counters();
+        Counters operator-(const Counters &other) const;
+    };
+
+    explicit SyncMetrics(QString account);
+
+    //! The phase numbers follow SyncQtOwnCloud::SyncPosition
+    void enterPhase(int phase);
+    void beginPass();
+    void endPass(bool aborted);
+    void addRetry() { mTotal.retries++; }
+    void addFilesScanned(qint64 count) { mTotal.filesScanned += count; }
+    void setDav(const QWebDAV::Stats &stats);
+    //! Handed to sqlite3_util::countStatements
+    qint64 *statementCounter() { return &mTotal.statements; }
+
+    const Counters &total() const { return mTotal; }
+    const Counters &lastPass() const { return mLastPass; }
+    QString summary() const;
+    QByteArray toJson() const;
+    QByteArray toPrometheus() const;
+    bool save(QString directory) const;
+
+private:
+    QString mAccount;
+    Counters mTotal;
+    Counters mPassStart;
+    Counters mLastPass;
+    bool mInPass;
+    int mPhase;
+    QElapsedTimer mPhaseTimer;
+    qint64 mLastPassEnded;
+
+    void closePhase();
+    static const char *phaseName(int phase);
+};
+
+#endif // SYNCMETRICS_H
@@ -0,0 +1,80 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncPath.h"
+
+#include <QUrl>
+
+QStringRef SyncPath::strip(const QString &path, const QString &base)
+{
+    // The root strips nothing, every path starts with it anyway
+    if( base.isEmpty() || base == "/" || !path.startsWith(base) ) {
+        return QStringRef(&path);
+    }
+    return QStringRef(&path,base.size(),path.size()-base.size());
+}
+
+QString SyncPath::relative(const QString &path, const QString &base)
+{
+    QStringRef stripped = strip(path,base);
+    if( stripped.size() == path.size() ) {
+        return path; // Shares the data instead of copying it
+    }
+    return stripped.toString();
+}
+
+QString SyncPath::join(const QString &dir, const QString &name)
+{
+    bool slash = !dir.endsWith('/') && !name.startsWith('/');
+    QString joined;
+    joined.reserve(dir.size()+name.size()+1);
+    joined.append(dir);
+    if( slash ) {
+        joined.append(QLatin1Char('/'));
+    }
+    joined.append(name);
+    return joined;
+}
+
+QString SyncPath::parent(const QString &path)
+{
+    // A trailing slash marks a directory, it isn't a separator of its own
+    int end = path.endsWith('/') ? path.size()-2 : path.size()-1;
+    int pos = path.lastIndexOf('/',end);
+    if( pos <= 0 ) {
+        return pos == 0 ? QString("/") : QString();
+    }
+    return path.left(pos);
+}
+
+QString SyncPath::fileName(const QString &path)
+{
+    int end = path.endsWith('/') ? path.size()-2 : path.size()-1;
+    int pos = path.lastIndexOf('/',end);
+    return path.mid(pos+1,end-pos);
+}
+
+QByteArray SyncPath::encode(const QString &path)
+{
+    return QUrl::toPercentEncoding(path,"/");
+}
+
+QString SyncPath::decode(const QByteArray &encoded)
+{
+    return QUrl::fromPercentEncoding(encoded);
+}
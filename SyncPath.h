@@ -0,0 +1,52 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCPATH_H
+#define SYNCPATH_H
+
+#include <QString>
+#include <QStringRef>
+#include <QByteArray>
+
+/*! \brief Operations on the relative paths the engine passes around.
+  * Paths stay plain QStrings, since that is what the database, the indexes
+  * and the watchers all key on. They are always kept decoded, with real
+  * spaces and no escaping of any kind, so the same file has the same
+  * string (and qHash) everywhere. Percent-encoding is only applied where a
+  * path turns into a URL and undone where one comes back, in QWebDAV.
+  */
+class SyncPath
+{
+public:
+    // The part of path below base, as a reference into path itself. A path
+    // that isn't below base is handed back whole.
+    static QStringRef strip(const QString &path, const QString &base);
+    // Same as strip(), for callers that need to keep the result
+    static QString relative(const QString &path, const QString &base);
+    // dir + "/" + name, built in a single allocation
+    static QString join(const QString &dir, const QString &name);
+    static QString parent(const QString &path);
+    static QString fileName(const QString &path);
+
+    // For the path part of a URL: everything but unreserved characters and
+    // the separators gets escaped
+    static QByteArray encode(const QString &path);
+    static QString decode(const QByteArray &encoded);
+};
+
+#endif // SYNCPATH_H
@@ -0,0 +1,175 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncPathTable.h"
+#include "SyncGlobal.h"
+
+#include <QStringList>
+#include <QVariant>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+// Keep the id cache from growing without bound on huge trees
+#define _OCS_PATH_CACHE_SIZE 500000
+
+SyncPathTable::SyncPathTable(QString connectionName)
+    : mConnectionName(connectionName)
+{
+}
+
+bool SyncPathTable::createTable()
+{
+    // The root directory has the implicit id 0
+    QString createPaths("create table paths(\n"
+                        "\tid INTEGER PRIMARY KEY ASC,\n"
+                        "\tparent_id integer,\n"
+                        "\tname text,\n"
+                        "\tunique(parent_id,name)\n"
+                        ");");
+    QSqlQuery query(QSqlDatabase::database(mConnectionName));
+    if( !query.exec(createPaths) ) {
+        syncDebug() << "Could not create the paths table: "
+                    << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+qint64 SyncPathTable::id(QString path, bool create)
+{
+    // Collections are stored with a trailing slash, files without one, but
+    // both map onto the same component list.
+    QStringList components = path.split("/",QString::SkipEmptyParts);
+    qint64 parent = 0;
+    for( int i = 0; i < components.size(); i++ ) {
+        parent = lookup(parent,components[i],create);
+        if( parent < 0 ) {
+            return -1;
+        }
+    }
+    return parent;
+}
+
+qint64 SyncPathTable::lookup(qint64 parent, const QString &name, bool create)
+{
+    QPair<qint64,QString> key(parent,name);
+    QHash<QPair<qint64,QString>,qint64>::const_iterator it = mIds.constFind(key);
+    if( it != mIds.constEnd() ) {
+        return it.value();
+    }
+
+    // Names come straight from the file system and the server, so bind
+    // them instead of pasting them into the statement.
+    QSqlQuery query(QSqlDatabase::database(mConnectionName));
+    query.prepare("SELECT id FROM paths WHERE parent_id=? AND name=?;");
+    query.addBindValue(parent);
+    query.addBindValue(name);
+    query.exec();
+    qint64 id = -1;
+    if( query.next() ) {
+        id = query.value(0).toLongLong();
+    } else if ( create ) {
+        query.prepare("INSERT INTO paths (parent_id,name) values(?,?);");
+        query.addBindValue(parent);
+        query.addBindValue(name);
+        if( query.exec() ) {
+            id = query.lastInsertId().toLongLong();
+        } else {
+            syncDebug() << "Could not add path component " << name;
+        }
+    }
+
+    if( id >= 0 ) {
+        if( mIds.size() > _OCS_PATH_CACHE_SIZE ) {
+            clearCache();
+        }
+        mIds.insert(QPair<qint64,QString>(parent,intern(name)),id);
+    }
+    return id;
+}
+
+QString SyncPathTable::intern(const QString &component)
+{
+    QHash<QString,QString>::const_iterator it = mComponents.constFind(component);
+    if( it != mComponents.constEnd() ) {
+        return it.value();
+    }
+    mComponents.insert(component,component);
+    return component;
+}
+
+QString SyncPathTable::subtreeQuery(qint64 id)
+{
+    // All ids at and below the given one, usable as "path_id IN (...)"
+    return QString("WITH RECURSIVE subtree(id) AS (SELECT %1 UNION ALL "
+                   "SELECT paths.id FROM paths JOIN subtree ON "
+                   "paths.parent_id=subtree.id) SELECT id FROM subtree")
+            .arg(id);
+}
+
+void SyncPathTable::removeSubtree(qint64 id)
+{
+    if( id <= 0 ) { // Never drop the root
+        return;
+    }
+    QSqlQuery query(QSqlDatabase::database(mConnectionName));
+    query.exec(QString("DELETE FROM paths WHERE id IN (%1);")
+               .arg(subtreeQuery(id)));
+    // We don't know which cached entries were below this one
+    clearCache();
+}
+
+bool SyncPathTable::rename(QString from, QString to)
+{
+    // Re-parenting one row moves everything below it along, since the rows
+    // underneath only refer to their parent's id.
+    qint64 id = this->id(from,false);
+    QStringList components = to.split("/",QString::SkipEmptyParts);
+    if( id <= 0 || components.isEmpty() ) {
+        return false;
+    }
+    QString name = components.takeLast();
+    qint64 parent = this->id(components.join("/"));
+    if( parent < 0 ) {
+        return false;
+    }
+    // The file tables still refer to whatever is at the target, so the
+    // caller has to drop that first
+    qint64 existing = lookup(parent,name,false);
+    if( existing == id ) {
+        return true;
+    } else if ( existing > 0 ) {
+        syncDebug() << "Rename target is still in use: " << to;
+        return false;
+    }
+    QSqlQuery query(QSqlDatabase::database(mConnectionName));
+    query.prepare("UPDATE paths SET parent_id=?, name=? WHERE id=?;");
+    query.addBindValue(parent);
+    query.addBindValue(name);
+    query.addBindValue(id);
+    bool ok = query.exec();
+    clearCache();
+    return ok;
+}
+
+void SyncPathTable::clearCache()
+{
+    mIds.clear();
+    mComponents.clear();
+}
@@ -0,0 +1,56 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCPATHTABLE_H
+#define SYNCPATHTABLE_H
+
+#include <QString>
+#include <QHash>
+#include <QPair>
+
+/*! \brief Normalized storage of paths as (parent id, name) pairs.
+  * Every path component gets one row in the paths table, keyed by the id of
+  * its parent directory. The file tables refer to these rows through their
+  * path_id column, so a whole directory can be addressed by one integer.
+  * Looked up ids are cached in memory, and component names are interned so
+  * that each distinct name is only stored once.
+  */
+class SyncPathTable
+{
+public:
+    explicit SyncPathTable(QString connectionName);
+
+    bool createTable();
+    qint64 id(QString path, bool create = true);
+    QString subtreeQuery(qint64 id);
+    void removeSubtree(qint64 id);
+    bool rename(QString from, QString to);
+    void clearCache();
+    int cachedIds() const { return mIds.size(); }
+    int components() const { return mComponents.size(); }
+
+private:
+    QString mConnectionName;
+    QHash<QPair<qint64,QString>,qint64> mIds;
+    QHash<QString,QString> mComponents;
+
+    qint64 lookup(qint64 parent, const QString &name, bool create);
+    QString intern(const QString &component);
+};
+
+#endif // SYNCPATHTABLE_H
@@ -0,0 +1,304 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncPathTree.h"
+
+SyncPathTree::SyncPathTree()
+{
+    mRoot = new Node();
+}
+
+SyncPathTree::~SyncPathTree()
+{
+    destroy(mRoot);
+}
+
+void SyncPathTree::destroy(Node *node)
+{
+    QHash<QChar,Node*>::iterator it;
+    for( it = node->children.begin(); it != node->children.end(); ++it ) {
+        destroy(it.value());
+    }
+    delete node;
+}
+
+void SyncPathTree::clear()
+{
+    destroy(mRoot);
+    mRoot = new Node();
+}
+
+qint64 SyncPathTree::size() const
+{
+    return mRoot->count;
+}
+
+bool SyncPathTree::insert(const QString &path)
+{
+    NodePath nodes;
+    Node *node = mRoot;
+    int pos = 0;
+    nodes.append(node);
+    while( pos < path.size() ) {
+        QChar c = path.at(pos);
+        Node *child = node->children.value(c,0);
+        if( !child ) { // Nothing shares this prefix, hang the rest here
+            child = new Node(path.mid(pos));
+            node->children.insert(c,child);
+            nodes.append(child);
+            node = child;
+            pos = path.size();
+            break;
+        }
+
+        // How much of this edge do we share?
+        int common = 0;
+        while( common < child->edge.size() && pos+common < path.size() &&
+               child->edge.at(common) == path.at(pos+common) ) {
+            common++;
+        }
+        if( common < child->edge.size() ) { // Split the edge
+            Node *split = new Node(child->edge.left(common));
+            split->count = child->count;
+            split->dirtyCount = child->dirtyCount;
+            child->edge = child->edge.mid(common);
+            split->children.insert(child->edge.at(0),child);
+            node->children.insert(c,split);
+            child = split;
+        }
+        node = child;
+        pos += common;
+        nodes.append(node);
+    }
+
+    if( node->terminal ) {
+        return false;
+    }
+    node->terminal = true;
+    for( int i = 0; i < nodes.size(); i++ ) {
+        nodes[i]->count++;
+    }
+    return true;
+}
+
+SyncPathTree::Node *SyncPathTree::find(const QString &path,
+                                       NodePath *nodes) const
+{
+    Node *node = mRoot;
+    int pos = 0;
+    if( nodes )
+        nodes->append(node);
+    while( pos < path.size() ) {
+        Node *child = node->children.value(path.at(pos),0);
+        if( !child || path.midRef(pos,child->edge.size()) != child->edge ) {
+            return 0;
+        }
+        pos += child->edge.size();
+        node = child;
+        if( nodes )
+            nodes->append(node);
+    }
+    return node->terminal ? node : 0;
+}
+
+SyncPathTree::Node *SyncPathTree::locate(const QString &prefix,
+                                         QString *reached,
+                                         NodePath *nodes) const
+{
+    // Find the highest node whose subtree holds exactly the paths that
+    // start with prefix. The prefix may end in the middle of its edge.
+    Node *node = mRoot;
+    int pos = 0;
+    if( nodes )
+        nodes->append(node);
+    while( pos < prefix.size() ) {
+        Node *child = node->children.value(prefix.at(pos),0);
+        if( !child ) {
+            return 0;
+        }
+        int common = 0;
+        while( common < child->edge.size() && pos+common < prefix.size() &&
+               child->edge.at(common) == prefix.at(pos+common) ) {
+            common++;
+        }
+        if( common < child->edge.size() && pos+common < prefix.size() ) {
+            return 0; // Diverged in the middle of the edge
+        }
+        pos += common;
+        node = child;
+        if( reached )
+            reached->append(child->edge);
+        if( nodes )
+            nodes->append(node);
+    }
+    return node;
+}
+
+bool SyncPathTree::contains(const QString &path) const
+{
+    return find(path,0) != 0;
+}
+
+bool SyncPathTree::remove(const QString &path)
+{
+    NodePath nodes;
+    Node *node = find(path,&nodes);
+    if( !node ) {
+        return false;
+    }
+    node->terminal = false;
+    bool wasDirty = node->dirty;
+    node->dirty = false;
+    for( int i = 0; i < nodes.size(); i++ ) {
+        nodes[i]->count--;
+        if( wasDirty )
+            nodes[i]->dirtyCount--;
+    }
+    compact(nodes);
+    return true;
+}
+
+void SyncPathTree::compact(NodePath &nodes)
+{
+    // Walk back up, dropping empty leaves and merging single-child chains
+    for( int i = nodes.size()-1; i > 0; i-- ) {
+        Node *node = nodes[i];
+        Node *parent = nodes[i-1];
+        if( node->count == 0 ) {
+            parent->children.remove(node->edge.at(0));
+            destroy(node);
+        } else if ( !node->terminal && node->children.size() == 1 ) {
+            Node *child = node->children.begin().value();
+            child->edge.prepend(node->edge);
+            parent->children.insert(child->edge.at(0),child);
+            node->children.clear();
+            delete node;
+            nodes[i] = child;
+        }
+    }
+}
+
+void SyncPathTree::setDirty(const QString &path, bool dirty)
+{
+    NodePath nodes;
+    Node *node = find(path,&nodes);
+    if( !node || node->dirty == dirty ) {
+        return;
+    }
+    node->dirty = dirty;
+    for( int i = 0; i < nodes.size(); i++ ) {
+        nodes[i]->dirtyCount += dirty ? 1 : -1;
+    }
+}
+
+bool SyncPathTree::isDirty(const QString &path) const
+{
+    Node *node = find(path,0);
+    return node && node->dirty;
+}
+
+bool SyncPathTree::isSubtreeDirty(const QString &prefix) const
+{
+    Node *node = locate(prefix,0,0);
+    return node && node->dirtyCount > 0;
+}
+
+qint64 SyncPathTree::subtreeCount(const QString &prefix) const
+{
+    Node *node = locate(prefix,0,0);
+    return node ? node->count : 0;
+}
+
+void SyncPathTree::collect(const Node *node, QString prefix,
+                           QStringList *list, QVector<bool> *dirty) const
+{
+    if( node->terminal ) {
+        list->append(prefix);
+        if( dirty )
+            dirty->append(node->dirty);
+    }
+    QHash<QChar,Node*>::const_iterator it;
+    for( it = node->children.constBegin(); it != node->children.constEnd();
+         ++it ) {
+        collect(it.value(),prefix+it.value()->edge,list,dirty);
+    }
+}
+
+QStringList SyncPathTree::enumerate(const QString &prefix) const
+{
+    QStringList list;
+    QString reached;
+    Node *node = locate(prefix,&reached,0);
+    if( node ) {
+        collect(node,reached,&list);
+    }
+    return list;
+}
+
+QStringList SyncPathTree::removeSubtree(const QString &prefix)
+{
+    QStringList list;
+    QString reached;
+    NodePath nodes;
+    Node *node = locate(prefix,&reached,&nodes);
+    if( !node || node->count == 0 ) {
+        return list;
+    }
+    if( node == mRoot ) {
+        collect(node,reached,&list);
+        clear();
+        return list;
+    }
+    collect(node,reached,&list);
+
+    // Take the whole branch off its parent in one go
+    qint64 count = node->count;
+    qint64 dirtyCount = node->dirtyCount;
+    nodes.removeLast();
+    for( int i = 0; i < nodes.size(); i++ ) {
+        nodes[i]->count -= count;
+        nodes[i]->dirtyCount -= dirtyCount;
+    }
+    nodes.last()->children.remove(node->edge.at(0));
+    destroy(node);
+    compact(nodes);
+    return list;
+}
+
+QStringList SyncPathTree::moveSubtree(const QString &from, const QString &to)
+{
+    // Keep the dirty marks on the entries being moved, picked up along
+    // with the paths themselves
+    QStringList moved;
+    QVector<bool> dirty;
+    QString reached;
+    Node *node = locate(from,&reached,0);
+    if( !node ) {
+        return moved;
+    }
+    collect(node,reached,&moved,&dirty);
+    removeSubtree(from);
+    for( int i = 0; i < moved.size(); i++ ) {
+        QString name = to + moved[i].mid(from.size());
+        insert(name);
+        if( dirty[i] )
+            setDirty(name,true);
+        moved[i] = name;
+    }
+    return moved;
+}
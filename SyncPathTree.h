@@ -0,0 +1,81 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCPATHTREE_H
+#define SYNCPATHTREE_H
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QVarLengthArray>
+#include <QVector>
+
+/*! \brief In-memory compressed radix tree over relative paths.
+  * Every node keeps the number of paths stored below it, and how many of
+  * those are marked dirty, so prefix enumeration, subtree counts, dirty
+  * checks and subtree removal all cost O(depth + results).
+  * Directories are stored with a trailing slash, so the subtree of "a/"
+  * never includes "a.txt".
+  */
+class SyncPathTree
+{
+public:
+    SyncPathTree();
+    ~SyncPathTree();
+
+    bool insert(const QString &path);
+    bool remove(const QString &path);
+    bool contains(const QString &path) const;
+    void clear();
+    qint64 size() const;
+
+    void setDirty(const QString &path, bool dirty);
+    bool isDirty(const QString &path) const;
+    bool isSubtreeDirty(const QString &prefix) const;
+    qint64 subtreeCount(const QString &prefix) const;
+
+    QStringList enumerate(const QString &prefix) const;
+    QStringList removeSubtree(const QString &prefix);
+    QStringList moveSubtree(const QString &from, const QString &to);
+
+private:
+    struct Node {
+        QString edge;
+        QHash<QChar,Node*> children;
+        bool terminal;
+        bool dirty;
+        qint64 count;
+        qint64 dirtyCount;
+        Node(const QString &label = QString())
+            : edge(label), terminal(false), dirty(false), count(0),
+              dirtyCount(0) {}
+    };
+    typedef QVarLengthArray<Node*,32> NodePath;
+
+    Node *mRoot;
+
+    Node *find(const QString &path, NodePath *nodes) const;
+    Node *locate(const QString &prefix, QString *reached,
+                 NodePath *nodes) const;
+    void collect(const Node *node, QString prefix, QStringList *list,
+                 QVector<bool> *dirty = 0) const;
+    void compact(NodePath &nodes);
+    void destroy(Node *node);
+};
+
+#endif // SYNCPATHTREE_H
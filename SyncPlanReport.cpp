@@ -0,0 +1,179 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncPlanReport.h"
+#include "SyncGlobal.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QObject>
+
+// What one transfer costs in requests: an upload locks the file and its
+// temporary name, PUTs, MOVEs it in place and unlocks both again
+#define _OCS_UPLOAD_REQUESTS 6
+// Assumed when no pass has moved enough data to measure it yet
+#define _OCS_DEFAULT_THROUGHPUT (1024*1024)
+
+static QString jsonList(const QStringList &list)
+{
+    QStringList quoted;
+    for( int i = 0; i < list.size(); i++ ) {
+        quoted.append(syncJsonString(list[i]));
+    }
+    return "[" + quoted.join(",") + "]";
+}
+
+SyncPlanReport::SyncPlanReport(QString account)
+    : mAccount(account), mCreated(QDateTime::currentMSecsSinceEpoch()),
+      mListings(0), mListingMSecs(0), mThroughput(0)
+{
+    for( int i = 0; i < OPERATIONS; i++ ) {
+        mCount[i] = 0;
+        mBytes[i] = 0;
+    }
+}
+
+const char *SyncPlanReport::operationName(int operation)
+{
+    switch(operation) {
+    case UPLOAD: return "upload";
+    case DOWNLOAD: return "download";
+    case MKDIR_SERVER: return "mkdir_server";
+    case MKDIR_LOCAL: return "mkdir_local";
+    case DELETE_SERVER: return "delete_server";
+    case DELETE_LOCAL: return "delete_local";
+    case CONFLICT: return "conflict";
+    default: return "unknown";
+    }
+}
+
+void SyncPlanReport::add(Operation operation, const QString &name,
+                         qint64 size)
+{
+    mCount[operation]++;
+    mBytes[operation] += size;
+    // Only what destroys data or needs a decision is listed by name, the
+    // transfers of a large share would make the report unreadable
+    if( operation == DELETE_SERVER ) {
+        mServerDeletes.append(name);
+    } else if ( operation == DELETE_LOCAL ) {
+        mLocalDeletes.append(name);
+    } else if ( operation == CONFLICT ) {
+        mConflicts.append(name);
+    }
+}
+
+void SyncPlanReport::addListing(qint64 msecs)
+{
+    mListings++;
+    mListingMSecs += msecs;
+}
+
+void SyncPlanReport::setThroughput(qint64 bytesPerSecond)
+{
+    mThroughput = bytesPerSecond;
+}
+
+qint64 SyncPlanReport::bytesUp() const
+{
+    return mBytes[UPLOAD];
+}
+
+qint64 SyncPlanReport::bytesDown() const
+{
+    // A conflict fetches the server's copy first
+    return mBytes[DOWNLOAD] + mBytes[CONFLICT];
+}
+
+qint64 SyncPlanReport::requests() const
+{
+    return qint64(mCount[UPLOAD])*_OCS_UPLOAD_REQUESTS + mCount[DOWNLOAD]
+            + mCount[CONFLICT] + mCount[MKDIR_SERVER] + mCount[DELETE_SERVER];
+}
+
+qint64 SyncPlanReport::requestLatency() const
+{
+    return mListings > 0 ? mListingMSecs/mListings : 0;
+}
+
+qint64 SyncPlanReport::estimatedMSecs() const
+{
+    qint64 throughput = mThroughput > 0 ? mThroughput
+                                        : _OCS_DEFAULT_THROUGHPUT;
+    return requests()*requestLatency()
+            + (bytesUp()+bytesDown())*1000/throughput;
+}
+
+QString SyncPlanReport::summary() const
+{
+    QString text = QObject::tr("Plan for %1: %2 uploads (%3 bytes), "
+                               "%4 downloads (%5 bytes), %6 conflicts, "
+                               "%7 server and %8 local directories to create, "
+                               "%9 server and %10 local deletes.")
+            .arg(mAccount).arg(mCount[UPLOAD]).arg(bytesUp())
+            .arg(mCount[DOWNLOAD]).arg(bytesDown()).arg(mCount[CONFLICT])
+            .arg(mCount[MKDIR_SERVER]).arg(mCount[MKDIR_LOCAL])
+            .arg(mCount[DELETE_SERVER]).arg(mCount[DELETE_LOCAL]);
+    text += QObject::tr(" About %1 requests, %2 minutes%3.")
+            .arg(requests()).arg(estimatedMSecs()/60000.0,0,'f',1)
+            .arg(mThroughput > 0 ? QString()
+                                 : QObject::tr(" at an assumed 1 MB/s"));
+    return text;
+}
+
+QByteArray SyncPlanReport::toJson() const
+{
+    QStringList operations;
+    for( int i = 0; i < OPERATIONS; i++ ) {
+        operations.append(QString("    \"%1\": {\"count\": %2, \"bytes\": %3}")
+                          .arg(operationName(i)).arg(mCount[i])
+                          .arg(mBytes[i]));
+    }
+    QString json = "{\n";
+    json += QString("  \"account\": %1,\n").arg(syncJsonString(mAccount));
+    json += QString("  \"created\": %1,\n").arg(syncJsonString(
+            QDateTime::fromMSecsSinceEpoch(mCreated).toUTC()
+            .toString(Qt::ISODate)));
+    json += "  \"operations\": {\n" + operations.join(",\n") + "\n  },\n";
+    json += QString("  \"bytes_up\": %1,\n").arg(bytesUp());
+    json += QString("  \"bytes_down\": %1,\n").arg(bytesDown());
+    json += QString("  \"listings\": %1,\n").arg(mListings);
+    json += QString("  \"listing_msecs\": %1,\n").arg(mListingMSecs);
+    json += QString("  \"requests\": %1,\n").arg(requests());
+    json += QString("  \"request_latency_msecs\": %1,\n")
+            .arg(requestLatency());
+    json += QString("  \"throughput_bytes_per_sec\": %1,\n")
+            .arg(mThroughput > 0 ? mThroughput : _OCS_DEFAULT_THROUGHPUT);
+    json += QString("  \"throughput_measured\": %1,\n")
+            .arg(mThroughput > 0 ? "true" : "false");
+    json += QString("  \"estimated_msecs\": %1,\n").arg(estimatedMSecs());
+    json += QString("  \"server_deletes\": %1,\n").arg(jsonList(mServerDeletes));
+    json += QString("  \"local_deletes\": %1,\n").arg(jsonList(mLocalDeletes));
+    json += QString("  \"conflicts\": %1\n").arg(jsonList(mConflicts));
+    json += "}\n";
+    return json.toUtf8();
+}
+
+bool SyncPlanReport::save(QString fileName) const
+{
+    QFile file(fileName);
+    if( !file.open(QIODevice::WriteOnly|QIODevice::Truncate) ) {
+        return false;
+    }
+    return file.write(toJson()) >= 0;
+}
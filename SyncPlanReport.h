@@ -0,0 +1,79 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCPLANREPORT_H
+#define SYNCPLANREPORT_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+
+/*! \brief What a dry run found a sync pass would do.
+  * Counts the planned operations and their bytes, and turns them into an
+  * estimate of the HTTP requests and the time the pass would take. The
+  * request latency is measured on the listing the dry run itself does,
+  * the throughput comes from earlier passes when there were any.
+  */
+class SyncPlanReport
+{
+public:
+    enum Operation {
+        UPLOAD,
+        DOWNLOAD,
+        MKDIR_SERVER,
+        MKDIR_LOCAL,
+        DELETE_SERVER,
+        DELETE_LOCAL,
+        CONFLICT,
+        OPERATIONS
+    };
+
+    explicit SyncPlanReport(QString account);
+
+    void add(Operation operation, const QString &name, qint64 size = 0);
+    void addListing(qint64 msecs);
+    void setThroughput(qint64 bytesPerSecond);
+
+    int count(Operation operation) const { return mCount[operation]; }
+    qint64 bytes(Operation operation) const { return mBytes[operation]; }
+    qint64 bytesUp() const;
+    qint64 bytesDown() const;
+    qint64 requests() const;
+    qint64 requestLatency() const;
+    qint64 estimatedMSecs() const;
+
+    QString summary() const;
+    QByteArray toJson() const;
+    bool save(QString fileName) const;
+
+private:
+    QString mAccount;
+    qint64 mCreated;
+    int mCount[OPERATIONS];
+    qint64 mBytes[OPERATIONS];
+    int mListings;
+    qint64 mListingMSecs;
+    qint64 mThroughput;      // Bytes per second, 0 when never measured
+    QStringList mServerDeletes;
+    QStringList mLocalDeletes;
+    QStringList mConflicts;
+
+    static const char *operationName(int operation);
+};
+
+#endif // SYNCPLANREPORT_H
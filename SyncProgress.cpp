@@ -0,0 +1,153 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncProgress.h"
+#include "SyncGlobal.h"
+
+#include <QTimer>
+#include <QMetaObject>
+#include <qmath.h>
+
+// Seconds over which the throughput is smoothed
+#define _OCS_PROGRESS_SMOOTHING 5.0
+
+SyncProgress::SyncProgress(int hz, QObject *parent)
+    : QObject(parent), mRunning(false)
+{
+    mTimer = new QTimer(this);
+    mTimer->setInterval(1000/qMax(1,hz));
+    connect(mTimer,SIGNAL(timeout()),this,SLOT(publish()));
+    mClock.start();
+}
+
+void SyncProgress::report(QObject *account, qint64 transferred, qint64 total,
+                          qint64 fileDone, qint64 fileSize)
+{
+    QMutexLocker locker(&mMutex);
+    Snapshot &current = mEntries[account].current;
+    current.transferred = transferred;
+    current.total = total;
+    current.fileDone = fileDone;
+    current.fileSize = fileSize;
+    if( !mRunning ) {
+        // The timer belongs to the window's thread
+        mRunning = true;
+        QMetaObject::invokeMethod(this,"wake",Qt::QueuedConnection);
+    }
+}
+
+void SyncProgress::finish(QObject *account)
+{
+    QMutexLocker locker(&mMutex);
+    mEntries.remove(account);
+}
+
+void SyncProgress::wake()
+{
+    if( !mTimer->isActive() ) {
+        mTimer->start();
+    }
+}
+
+void SyncProgress::publish()
+{
+    {
+        QMutexLocker locker(&mMutex);
+        qint64 now = mClock.elapsed();
+        Snapshot overall;
+        QHash<QObject*,Entry>::iterator it;
+        for( it = mEntries.begin(); it != mEntries.end(); ++it ) {
+            Entry &entry = it.value();
+            Snapshot &current = entry.current;
+            if( entry.published >= 0 && now > entry.publishedAt ) {
+                double seconds = (now - entry.publishedAt)/1000.0;
+                double instant = qMax(qint64(0),
+                                      current.transferred - entry.published)
+                        / seconds;
+                // Weighted by the time passed, so the rate of publishing
+                // does not change how quickly it follows
+                double alpha = 1.0 - qExp(-seconds/_OCS_PROGRESS_SMOOTHING);
+                current.rate += alpha*(instant - current.rate);
+            }
+            entry.published = current.transferred;
+            entry.publishedAt = now;
+            qint64 left = qMax(qint64(0),current.total - current.transferred);
+            current.eta = current.rate > 1 ? qint64(left/current.rate) : -1;
+
+            overall.transferred += current.transferred;
+            overall.total += current.total;
+            overall.fileDone += current.fileDone;
+            overall.fileSize += current.fileSize;
+            overall.rate += current.rate;
+        }
+        qint64 left = qMax(qint64(0),overall.total - overall.transferred);
+        overall.eta = overall.rate > 1 ? qint64(left/overall.rate) : -1;
+        mOverall = overall;
+        if( mEntries.isEmpty() ) {
+            // Nothing left to follow, sleep until the next report
+            mRunning = false;
+            mTimer->stop();
+        }
+    }
+    emit updated();
+}
+
+bool SyncProgress::isActive(QObject *account) const
+{
+    QMutexLocker locker(&mMutex);
+    return mEntries.contains(account);
+}
+
+SyncProgress::Snapshot SyncProgress::account(QObject *account) const
+{
+    QMutexLocker locker(&mMutex);
+    return mEntries.value(account).current;
+}
+
+SyncProgress::Snapshot SyncProgress::overall() const
+{
+    QMutexLocker locker(&mMutex);
+    return mOverall;
+}
+
+int SyncProgress::active() const
+{
+    QMutexLocker locker(&mMutex);
+    return mEntries.size();
+}
+
+QString SyncProgress::formatRate(double bytesPerSecond)
+{
+    if( bytesPerSecond >= 1024*1024 ) {
+        return tr("%1 MB/s").arg(bytesPerSecond/(1024*1024),0,'f',1);
+    }
+    return tr("%1 KB/s").arg(bytesPerSecond/1024,0,'f',0);
+}
+
+QString SyncProgress::formatEta(qint64 seconds)
+{
+    if( seconds < 0 ) {
+        return tr("unknown");
+    }
+    if( seconds >= 3600 ) {
+        return QString("%1:%2:%3").arg(seconds/3600)
+                .arg((seconds/60)%60,2,10,QChar('0'))
+                .arg(seconds%60,2,10,QChar('0'));
+    }
+    return QString("%1:%2").arg(seconds/60).arg(seconds%60,2,10,QChar('0'));
+}
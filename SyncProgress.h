@@ -0,0 +1,95 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCPROGRESS_H
+#define SYNCPROGRESS_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+
+class QTimer;
+
+/*! \brief Gathers transfer progress from all accounts for the window.
+  * Accounts report their byte counts as often as their replies tell them,
+  * which only stores the numbers. The window is told at a fixed rate, so
+  * the cost of showing progress does not grow with the number of
+  * transfers. Each publish smooths the throughput (an exponentially
+  * weighted average) and works out the time left from what remains of
+  * the pass. Accounts report from their own threads.
+  */
+class SyncProgress : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SyncProgress(int hz = 4, QObject *parent = 0);
+
+    struct Snapshot {
+        qint64 transferred;  // Bytes of the pass moved so far
+        qint64 total;        // Bytes the pass has to move
+        qint64 fileDone;
+        qint64 fileSize;
+        double rate;         // Smoothed, bytes per second
+        qint64 eta;          // Seconds left, -1 when unknown
+        Snapshot() : transferred(0), total(0), fileDone(0), fileSize(0),
+            rate(0), eta(-1) {}
+        int percent() const {
+            return total > 0 ? int(qMin(qint64(100),100*transferred/total)) : 0;
+        }
+        int filePercent() const {
+            return fileSize > 0 ? int(qMin(qint64(100),100*fileDone/fileSize))
+                                : 0;
+        }
+    };
+
+    void report(QObject *account, qint64 transferred, qint64 total,
+                qint64 fileDone, qint64 fileSize);
+    void finish(QObject *account);
+
+    bool isActive(QObject *account) const;
+    Snapshot account(QObject *account) const;
+    Snapshot overall() const;
+    int active() const;
+
+    static QString formatRate(double bytesPerSecond);
+    static QString formatEta(qint64 seconds);
+
+private:
+    struct Entry {
+        Snapshot current;
+        qint64 published;    // Bytes at the last publish
+        qint64 publishedAt;  // Clock of the last publish
+        Entry() : published(-1), publishedAt(0) {}
+    };
+    mutable QMutex mMutex;
+    QHash<QObject*,Entry> mEntries;
+    Snapshot mOverall;
+    QTimer *mTimer;
+    QElapsedTimer mClock;
+    bool mRunning;
+
+signals:
+    void updated();
+
+private slots:
+    void wake();
+    void publish();
+};
+
+#endif // SYNCPROGRESS_H
@@ -18,8 +18,20 @@
  ******************************************************************************/
 #include "SyncGlobal.h"
 #include "SyncQtOwnCloud.h"
-#include "sqlite3_util.h"
+#include "SyncPathTable.h"
+#include "SyncPath.h"
+#include "SyncPlanReport.h"
+#include "SyncMetrics.h"
+#include "SyncTrace.h"
+#include "SyncResourceReport.h"
+#include "SyncDirWatcher.h"
+#include "SyncEventCoalescer.h"
+#include "SyncScheduler.h"
+#include "SyncBudget.h"
+#include "SyncProgress.h"
+#include "SyncLoopMonitor.h"
 #include "QWebDAV.h"
+#include "sqlite3_util.h"
 
 #include <QFile>
 #include <QtSql/QSqlDatabase>
@@ -30,7 +42,6 @@
 #include <QDateTime>
 #include <QTimer>
 #include <QSystemTrayIcon>
-#include <QFileSystemWatcher>
 #include <QFileDialog>
 #include <QTableWidgetItem>
 #include <QComboBox>
@@ -38,22 +49,60 @@
 
 #include <keychain.h>
 
+// Local changes are pushed once they have been quiet for this long, but a
+// steady stream of them is not held back longer than the cap.
+#define _OCS_SETTLE_TIME 2000
+#define _OCS_SETTLE_MAX 15000
+
+// How long a request may go without progress before the pass is abandoned
+#define _OCS_REQUEST_TIMEOUT 7000
+
+// Journal rows fillPlan() reads into a queue at a time
+#define _OCS_PLAN_WINDOW 256
+
 SyncQtOwnCloud::SyncQtOwnCloud(QString name,
                            QSet<QString> *globalFilters,
-                           QString configDir)
+                           QString configDir, SyncScheduler *scheduler,
+                           SyncBudget *budget, SyncProgress *progress)
     : mAccountName(name),
-      mGlobalFilters(globalFilters),mConfigDirectory(configDir)
+      mGlobalFilters(globalFilters->toList()),mConfigDirectory(configDir),
+      mScheduler(scheduler), mBudget(budget), mProgress(progress)
 {
     mBusy = false;
     mIsPaused = false;
 
     // Set the pointers so we can delete them without worrying :)
-    mSyncTimer = 0;
     mFileWatcher = 0;
+    mWebdav = 0;
+    mPaths = 0;
+    mLocalScanner = 0;
+    mCoalescer = 0;
+    mLoopMonitor = 0;
+    mIO = 0;
+    mWaitingForDisk = false;
+    mDBOpen = false;
+
+    // All deadlines live in the shared scheduler, 0 means none is set
+    mPolling = false;
+    mPollId = 0;
+    mFlushId = 0;
+    mRequestId = 0;
+    mRequestTimerRestarted = 0;
+    mSettleId = 0;
+    mSaveDBInterval = 370000;
+    mSettleStarted = 0;
+
+    // Connections and disk scans are handed out by the shared budget
+    mHoldsConnection = false;
+    mHoldsDisk = false;
+    mWaitingForBudget = false;
+    mLastProgress = 0;
+    mFilePercent = 0;
+    mTotalPercent = 0;
+    mPendingMoves = 0;
     mHardStop = false;
     mIsFirstRun = true;
     mDownloadingConflictingFile = false;
-    mFileAccessBusy = false;
     mConflictsExist = false;
     mSettingsCheck = true;
     mIsEnabled = false;
@@ -62,18 +111,44 @@ SyncQtOwnCloud::SyncQtOwnCloud(QString name,
     mNotifySyncEmitted = false;
     mLastSyncAborted = SYNCFINISHED;
     mSyncPosition = SYNCFINISHED;
+    mListingFreshness = 3600;
+    mFiltersChanged = false;
+    mFullScan = false;
+    mForceFullScan = false;
+    mFullScanInterval = 7;
+
+    mLocalPassOnly = false;
+    mPartialPass = false;
+    mDryRun = false;
+    mPlan = 0;
+    mListingStarted = 0;
+    mTransferStarted = 0;
+    mPassTransferBytes = 0;
+    mPassTransferMSecs = 0;
+    mMetrics = 0;
+
+    mPlanMemory = 4096*1024;
+    resetPlan();
+    mTotalToDownload = 0;
+    mTotalToUpload = 0;
+    mTotalToTransfer = 0;
+    mTotalDownloaded = 0;
+    mTotalUploaded = 0;
+    mTotalTransfered = 0;
+    mDBFileName = QDir::toNativeSeparators(mConfigDirectory+"/")+mAccountName+".db";
+}
 
-    mRequestTimer = new QTimer(this);
-    connect(mRequestTimer,SIGNAL(timeout()),this,SLOT(requestTimedout()));
-
-    // Create a QWebDAV instance
+void SyncQtOwnCloud::load()
+{
+    // Everything from here on is created on the account's own thread, so
+    // the sockets, timers and the database connection all belong to it
     mWebdav = new QWebDAV();
 
     // Connect to QWebDAV signals
     connect(mWebdav,SIGNAL(directoryListingError(QString)),
             this, SLOT(directoryListingError(QString)));
-    connect(mWebdav,SIGNAL(directoryListingReady(QList<QWebDAV::FileInfo>)),
-            this, SLOT(processDirectoryListing(QList<QWebDAV::FileInfo>)));
+    connect(mWebdav,SIGNAL(directoryListingReady(QWebDAV::Listing)),
+            this, SLOT(processDirectoryListing(QWebDAV::Listing)));
     connect(mWebdav,SIGNAL(fileReady(QNetworkReply*,QString)),
             this, SLOT(processFileReady(QNetworkReply*,QString)));
 
@@ -83,15 +158,44 @@ SyncQtOwnCloud::SyncQtOwnCloud(QString name,
             this, SLOT(serverDirectoryCreated(QString)));
     connect(mWebdav,SIGNAL(errorFileLocked(QString)),
             this, SLOT(errorFileLocked(QString)));
+    connect(mWebdav,SIGNAL(moveFinished(QString,QString,bool)),
+            this, SLOT(serverMoveFinished(QString,QString,bool)));
 
-    mDownloadingFiles.clear();
-    mDownloadConflict.clear();
-    mUploadingFiles.clear();
-
-    // Initialize the Database
+    // Initialize the Database. It lives directly on disk (in WAL mode) so
+    // every committed change is durable without copying the whole thing.
     mDB = QSqlDatabase::addDatabase("QSQLITE",mAccountName);
-    mDB.setDatabaseName(":memory:"); // Use memory for now
-    mDBFileName = QDir::toNativeSeparators(mConfigDirectory+"/")+mAccountName+".db";
+    mDB.setDatabaseName(mDBFileName);
+    mPaths = new SyncPathTable(mAccountName);
+    mMetrics = new SyncMetrics(mAccountName);
+
+    // The first scan of the local tree runs in the background
+    mLocalScanner = new SyncLocalScanner(this);
+
+    // Tells how long a pass ever kept this thread from its event loop
+    mLoopMonitor = new SyncLoopMonitor(this);
+
+    // Writes, renames and deletes of local files happen on these threads
+    mIO = new SyncIOService(2,this);
+    connect(mIO,SIGNAL(finished(SyncIOResult)),
+            this, SLOT(ioFinished(SyncIOResult)));
+
+    // Watcher events settle here first, so the engine only sees one net
+    // change per path
+    mCoalescer = new SyncEventCoalescer(this);
+    connect(mCoalescer,SIGNAL(fileChanged(QString)),
+            this, SLOT(localFileChanged(QString)));
+    connect(mCoalescer,SIGNAL(directoryChanged(QString)),
+            this, SLOT(localDirectoryChanged(QString)));
+    connect(mCoalescer,SIGNAL(removed(QString,bool)),
+            this, SLOT(localFileRemoved(QString,bool)));
+    connect(mCoalescer,SIGNAL(renamed(QString,QString,bool)),
+            this, SLOT(localFileRenamed(QString,QString,bool)));
+    connect(mLocalScanner,SIGNAL(entriesReady(QVector<SyncLocalEntry>)),
+            this, SLOT(processLocalEntries(QVector<SyncLocalEntry>)));
+    connect(mLocalScanner,SIGNAL(directoriesReady(QVector<SyncLocalDir>)),
+            this, SLOT(processLocalDirs(QVector<SyncLocalDir>)));
+    connect(mLocalScanner,SIGNAL(finished()),
+            this, SLOT(localScanFinished()));
 
     // Find out if the database exists.
     QFile dbFile(mDBFileName);
@@ -102,7 +206,8 @@ SyncQtOwnCloud::SyncQtOwnCloud(QString name,
             mDBOpen = false;
         } else {
             mDBOpen = true;
-            loadDBFromFile();
+            sqlite3_util::countStatements(mDB,mMetrics->statementCounter());
+            configureDB();
             readConfigFromDB();
             //ui->buttonSave->setDisabled(true);
             syncDebug() << "Checking configuration!";
@@ -114,22 +219,27 @@ SyncQtOwnCloud::SyncQtOwnCloud(QString name,
                                 &passwdLoop,SLOT(quit()));
             passwdJob.start();
             passwdLoop.exec();
+            mStateLock.lock();
             if(passwdJob.error()) {
                 mPassword = "";
                 syncDebug() << "Error: Could not read password.";
             } else {
                 mPassword = passwdJob.textData();
             }
+            mStateLock.unlock();
+            loadLocalTree();
+            replayJournal();
             initialize();
         }
     } else {
-      createDataBase(); // Create the database in memory
+      createDataBase(); // Create the database on disk
     }
+    updateFilters();
 
-    mSaveDBTimer = new QTimer(this);
-    connect(mSaveDBTimer, SIGNAL(timeout()), this, SLOT(saveDBToFile()));
-    mSaveDBTimer->start(370000);
+    // The save timer now only checkpoints the write-ahead log
+    scheduleFlush();
     updateStatus();
+    emit loaded(this);
 }
 
 void SyncQtOwnCloud::errorFileLocked(QString fileName)
@@ -140,13 +250,40 @@ void SyncQtOwnCloud::errorFileLocked(QString fileName)
 
 void SyncQtOwnCloud::setSaveDBTime(qint64 seconds)
 {
-    mSaveDBTimer->stop();
-    mSaveDBTimer->start(seconds*1000);
+    mSaveDBInterval = seconds*1000;
+    scheduleFlush();
+}
+
+void SyncQtOwnCloud::scheduleFlush()
+{
+    // A checkpoint can easily wait for some other wakeup
+    mScheduler->cancel(mFlushId);
+    mFlushId = mScheduler->schedule(this,SLOT(flushDue(qint64)),mSaveDBInterval,
+                                    30000,0,mAccountName+": checkpoint");
+}
+
+void SyncQtOwnCloud::flushDue(qint64 id)
+{
+    if( id != mFlushId ) { // Cancelled after it came due
+        return;
+    }
+    mFlushId = 0;
+    saveDBToFile();
+    scheduleFlush();
+}
+
+void SyncQtOwnCloud::toggleEnabled()
+{
+    // Flipped here rather than by the window, which might read a value
+    // that is about to change
+    setEnabled(!mIsEnabled);
 }
 
 void SyncQtOwnCloud::setEnabled( bool enabled)
 {
+    mStateLock.lock();
     mIsEnabled = enabled;
+    mStateLock.unlock();
     saveConfigToDB();
     QSqlQuery query(QSqlDatabase::database(mAccountName));
     query.exec("SELECT * FROM config;");
@@ -165,6 +302,7 @@ void SyncQtOwnCloud::setEnabled( bool enabled)
         syncDebug() << "Stopping " << mAccountName;
         stop();
     }
+    updateStatus();
 }
 
 void SyncQtOwnCloud::directoryListingError(QString url)
@@ -181,18 +319,95 @@ void SyncQtOwnCloud::updateStatus()
     if( !mBusy ) {
         // ???
     } else {
-        if( mSyncTimer )
-           mSyncTimer->stop();
+        cancelPoll();
         emit toStatus(tr("%1 out of %2 bytes").arg(mTransferState+mCurrentFile)
                       .arg(mCurrentFileSize));
     }
+    emit statusChanged(this);
+}
+
+QString SyncQtOwnCloud::statusText()
+{
+    QMutexLocker locker(&mStateLock);
+    if( !mBusy ) {
+        return mIsPaused ? tr("Paused") : tr("Idle");
+    }
+    if( mWaitingForBudget ) {
+        return tr("Waiting for its turn");
+    }
+    if( mWaitingForDisk ) {
+        return tr("Waiting for the disk");
+    }
+    switch(mSyncPosition) {
+    case LISTLOCALDIR:
+        return tr("Scanning local files");
+    case LISTREMOTEDIR:
+        return tr("Listing server");
+    case TRANSFER:
+        return tr("%1%2 (%3%, %4% overall)").arg(mTransferState)
+                .arg(mCurrentFile).arg(mFilePercent).arg(mTotalPercent);
+    default:
+        return tr("Synchronizing");
+    }
+}
+
+void SyncQtOwnCloud::pollDue(qint64 id)
+{
+    if( id != mPollId ) { // Cancelled after it came due
+        return;
+    }
+    timeToSync();
 }
 
 void SyncQtOwnCloud::timeToSync()
 {
+    // Keep polling, sync() takes this back once the pass really starts
+    mPollId = 0;
+    schedulePoll();
     if(mIsPaused) { // Paused, skip this sync cycle
         return;
     }
+    mLocalPassOnly = false; // The poll always looks at the whole server
+    mNotifySyncEmitted = true;
+    emit readyToSync(this);
+}
+
+void SyncQtOwnCloud::scheduleLocalSync()
+{
+    if( !mIsEnabled ) {
+        return;
+    }
+    // Every change restarts the window, so a burst ends up in one pass
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if( !mScheduler->isScheduled(mSettleId) ) {
+        mSettleStarted = now;
+    }
+    qint64 left = _OCS_SETTLE_MAX - (now - mSettleStarted);
+    mScheduler->cancel(mSettleId);
+    mSettleId = mScheduler->schedule(this,SLOT(localSyncDue(qint64)),
+                                     qBound(qint64(0),left,
+                                            qint64(_OCS_SETTLE_TIME)),
+                                     500,0,mAccountName+": local changes");
+}
+
+void SyncQtOwnCloud::localSyncDue(qint64 id)
+{
+    if( id != mSettleId ) { // Cancelled after it came due
+        return;
+    }
+    mSettleId = 0;
+    if( mIsPaused || !mIsEnabled || mNotifySyncEmitted ) {
+        return; // Nothing to do, or a pass is already on its way
+    }
+    if( mBusy || mPendingMoves > 0 ) {
+        // Try again once the current pass is out of the way
+        mSettleStarted = QDateTime::currentMSecsSinceEpoch();
+        mSettleId = mScheduler->schedule(this,SLOT(localSyncDue(qint64)),
+                                         _OCS_SETTLE_TIME,500,0,
+                                         mAccountName+": local changes");
+        return;
+    }
+    mLocalPassOnly = true;
     mNotifySyncEmitted = true;
     emit readyToSync(this);
 }
@@ -201,11 +416,13 @@ void SyncQtOwnCloud::sync()
 {
     mNeedsSync = true;
     mNotifySyncEmitted = false;
-    if(!mIsEnabled) {
+    bool localOnly = mLocalPassOnly;
+    mLocalPassOnly = false;
+    if(!mIsEnabled && !mDryRun) {
         return;
     }
 
-    if ( mBusy ) {
+    if ( mBusy || mPendingMoves > 0 ) {
         emit toLog(tr("Ooops, looks like %1 is busy, we'll try again later")
                    .arg(mAccountName));
         return;
@@ -216,25 +433,35 @@ void SyncQtOwnCloud::sync()
         return;
     }
 
+    // Hand over whatever local changes are still settling
+    mCoalescer->flush();
+
     // Announce we are busy!
+    mStateLock.lock();
     mBusy = true;
-    if(mSyncTimer)
-        mSyncTimer->stop();
-
+    mStateLock.unlock();
+    cancelPoll();
+    mLoopMonitor->reset();
+    mLoopMonitor->start();
+    mPassTransferBytes = 0;
+    mPassTransferMSecs = 0;
+    mMetrics->beginPass();
+
+    mPartialPass = false;
     emit toLog(tr("\nSynchronizing %1 on: %2")
                .arg(mAccountName)
                .arg(QDateTime::currentDateTime().toString()));
 
     // First, continue right where the last sync left off.
     if( mLastSyncAborted != SYNCFINISHED ) {
+        mMetrics->addRetry();
         switch(mLastSyncAborted) {
         emit toLog(tr("Last sync unsuccessful. Resumming."));
         case LISTLOCALDIR:
-            scanLocalDirectory(mLocalDirectory);
-            break;
+            startLocalScan();
+            return;
         case LISTREMOTEDIR:
-            restartRequestTimer();
-            mWebdav->dirList(mRemoteDirectory+"/");
+            startRemoteListing();
             return;
         case TRANSFER:
             processNextStep();
@@ -244,39 +471,566 @@ void SyncQtOwnCloud::sync()
         }
     }
 
+    // Forget what a new filter hides before anything gets compared
+    if(mFiltersChanged) {
+        mDB.transaction();
+        forgetFilteredFiles();
+        mDB.commit();
+        // What a removed filter no longer hides can sit in any directory
+        mForceFullScan = true;
+        localOnly = false;
+    }
+
     // If this is the first run, scan the directory, otherwise just wait
     // for the watcher to update us :)
     if(mIsFirstRun) {
-        //syncDebug() << "Scanning local directory: ";
-        scanLocalDirectory(mLocalDirectory);
-        //syncDebug() << "Scanning local directory!!!";
+        startLocalScan();
+        return;
+    }
+    // Only local changes to push? Then there is no need to walk the server.
+    mPartialPass = localOnly;
+    localScanFinished();
+}
+
+void SyncQtOwnCloud::startLocalScan()
+{
+    // The scan runs on its own threads, the results come back in batches.
+    // Directories that did not change since the last complete pass are not
+    // read again, unless it is time to verify everything.
+    mStateLock.lock();
+    mSyncPosition = LISTLOCALDIR;
+    mStateLock.unlock();
+    mMetrics->enterPhase(mSyncPosition);
+    // Only so many accounts get to hammer the disk at once
+    if( !mHoldsDisk ) {
+        if( !mBudget->acquire(this,SyncBudget::DISK,SLOT(diskGranted())) ) {
+            mStateLock.lock();
+            mWaitingForBudget = true;
+            mStateLock.unlock();
+            updateStatus();
+            return;
+        }
+        mHoldsDisk = true;
+    }
+    updateStatus();
+    mScannedDirs.clear();
+    mFullScan = needsFullScan();
+    if( mFullScan ) {
+        emit toLog(tr("Verifying all local files of %1").arg(mAccountName));
+        mLocalScanner->start(mLocalDirectory,mFilterMatcher);
+    } else {
+        mLocalScanner->start(mLocalDirectory,mFilterMatcher,loadScanCache());
+    }
+}
+
+bool SyncQtOwnCloud::needsFullScan()
+{
+    // Without inotify every file needs a watch of its own anyway
+    if( mForceFullScan || !mFileWatcher->coversFiles() ) {
+        return true;
+    }
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec("SELECT value FROM sync_state WHERE key='last_full_scan';");
+    if( !query.next() ) {
+        return true;
+    }
+    qint64 age = QDateTime::currentMSecsSinceEpoch()
+            - query.value(0).toLongLong();
+    return age > mFullScanInterval*24*3600*1000;
+}
+
+SyncScanCache SyncQtOwnCloud::loadScanCache()
+{
+    SyncScanCache cache;
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec("SELECT directory,mtime,ctime,inode FROM local_dirs;");
+    while( query.next() ) {
+        QString dir = query.value(0).toString();
+        cache.stamps.insert(dir,SyncDirStamp(query.value(1).toLongLong(),
+                                             query.value(2).toLongLong(),
+                                             query.value(3).toLongLong()));
+        // The scanner names subdirectories parent + "/" + name
+        if( dir != mLocalDirectory ) {
+            cache.children[dir.left(dir.lastIndexOf('/'))].append(dir);
+        }
+    }
+    return cache;
+}
+
+void SyncQtOwnCloud::saveScanCache()
+{
+    // Only a pass that made it all the way through may vouch for these
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    mDB.transaction();
+    query.exec("DELETE FROM local_dirs;");
+    query.prepare("INSERT INTO local_dirs (directory,mtime,ctime,inode) "
+                  "values(?,?,?,?);");
+    QHash<QString,SyncDirStamp>::const_iterator it;
+    for( it = mScannedDirs.constBegin(); it != mScannedDirs.constEnd(); ++it ) {
+        query.addBindValue(it.key());
+        query.addBindValue(it.value().mtime);
+        query.addBindValue(it.value().ctime);
+        query.addBindValue(it.value().inode);
+        query.exec();
+    }
+    if( mFullScan ) {
+        query.exec(QString("INSERT OR REPLACE INTO sync_state (key,value) "
+                           "values('last_full_scan','%1');")
+                   .arg(QDateTime::currentMSecsSinceEpoch()));
+        mForceFullScan = false;
+    }
+    mDB.commit();
+    mScannedDirs.clear();
+    mFullScan = false;
+}
+
+void SyncQtOwnCloud::setFullScanInterval(qint64 days)
+{
+    mFullScanInterval = days;
+}
+
+void SyncQtOwnCloud::verifyLocalTree()
+{
+    // Read every local directory again on the next pass
+    mForceFullScan = true;
+    mIsFirstRun = true;
+    mNeedsSync = true;
+    timeToSync();
+}
+
+void SyncQtOwnCloud::dryRun()
+{
+    // Only from a clean slate, whatever is queued would end up in the plan
+    if( mBusy || mPendingMoves > 0 || mLastSyncAborted != SYNCFINISHED ||
+            planPending() || !mPendingIO.isEmpty() ) {
+        emit toLog(tr("%1 is busy, try planning its sync again later")
+                   .arg(mAccountName));
+        return;
+    }
+    delete mPlan;
+    mPlan = new SyncPlanReport(mAccountName);
+    mDryRun = true;
+    emit toLog(tr("Planning a sync of %1. Nothing will be transferred or "
+                  "deleted.").arg(mAccountName));
+    sync();
+    if( !mBusy ) { // Never got going
+        mDryRun = false;
+        delete mPlan;
+        mPlan = 0;
+    }
+}
+
+void SyncQtOwnCloud::finishDryRun()
+{
+    mDryRun = false;
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec("SELECT value FROM sync_state WHERE key='throughput';");
+    if( query.next() ) {
+        mPlan->setThroughput(query.value(0).toLongLong());
+    }
+    QString fileName = QDir::toNativeSeparators(mConfigDirectory+"/")
+            + mAccountName + "_plan.json";
+    emit toLog(mPlan->summary());
+    if( mPlan->save(fileName) ) {
+        emit toLog(tr("Sync plan written to %1").arg(fileName));
+    } else {
+        emit toLog(tr("Could not write the sync plan to %1").arg(fileName));
+    }
+    delete mPlan;
+    mPlan = 0;
+
+    // Nothing was done, so the next pass has to find all of it again. The
+    // path ids handed out during the pass were rolled back as well.
+    mScannedDirs.clear();
+    mPaths->clearCache();
+    mTotalToDownload = 0;
+    mTotalToUpload = 0;
+    mTotalToTransfer = 0;
+    releaseConnection();
+    mStateLock.lock();
+    mBusy = false;
+    mSyncPosition = SYNCFINISHED;
+    mStateLock.unlock();
+    mLastSyncAborted = SYNCFINISHED;
+    mLoopMonitor->stop();
+    saveMetrics(false);
+    if( mIsEnabled ) {
+        schedulePoll();
+    }
+    emit finishedSync(this);
+    updateStatus();
+}
+
+void SyncQtOwnCloud::recordTransfer(qint64 bytes)
+{
+    mPassTransferBytes += bytes;
+    mPassTransferMSecs += QDateTime::currentMSecsSinceEpoch()-mTransferStarted;
+}
+
+void SyncQtOwnCloud::saveThroughput()
+{
+    // Tiny passes are all latency, they say nothing about the bandwidth
+    if( mPassTransferMSecs < 1000 || mPassTransferBytes < 1024*1024 ) {
+        return;
+    }
+    qint64 rate = mPassTransferBytes*1000/mPassTransferMSecs;
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec("SELECT value FROM sync_state WHERE key='throughput';");
+    if( query.next() && query.value(0).toLongLong() > 0 ) {
+        rate = (rate + query.value(0).toLongLong())/2;
+    }
+    query.exec(QString("INSERT OR REPLACE INTO sync_state (key,value) "
+                       "values('throughput','%1');").arg(rate));
+}
+
+void SyncQtOwnCloud::saveMetrics(bool aborted)
+{
+    mMetrics->setDav(mWebdav->stats());
+    mMetrics->endPass(aborted);
+    syncDebug() << mAccountName << mMetrics->summary();
+    QString dir = QDir::toNativeSeparators(mConfigDirectory+"/metrics");
+    if( !mMetrics->save(dir) ) {
+        syncDebug() << "Could not write the metrics of" << mAccountName
+                    << "to" << dir;
+    }
+    // Kept up to date, so a slow leak shows between two passes
+    SyncResourceReport report(mAccountName);
+    collectResources(&report);
+    saveResources(&report);
+}
+
+static qint64 queueBytes(const QQueue<SyncQtOwnCloud::FileInfo> &queue)
+{
+    qint64 bytes = 0;
+    for( int i = 0; i < queue.size(); i++ ) {
+        bytes += sizeof(SyncQtOwnCloud::FileInfo)
+                + SyncResourceReport::stringBytes(queue[i].name);
+    }
+    return bytes;
+}
+
+static qint64 stringsBytes(const QList<QString> &strings)
+{
+    qint64 bytes = 0;
+    for( int i = 0; i < strings.size(); i++ ) {
+        bytes += SyncResourceReport::stringBytes(strings[i]);
     }
+    return bytes;
+}
+
+void SyncQtOwnCloud::collectResources(SyncResourceReport *report)
+{
+    // Hash nodes are counted at two pointers besides what they hold
+    const qint64 node = 2*sizeof(void*);
+    report->add("queues","directories to list",mDirectoryQueue.size(),
+                stringsBytes(mDirectoryQueue));
+    report->add("queues","server directories",mMakeServerDirs.size(),
+                stringsBytes(mMakeServerDirs));
+    report->add("queues","uploads",mUploadingFiles.size(),
+                queueBytes(mUploadingFiles));
+    report->add("queues","downloads",mDownloadingFiles.size(),
+                queueBytes(mDownloadingFiles));
+    report->add("queues","download conflicts",mDownloadConflict.size(),
+                queueBytes(mDownloadConflict));
+    report->add("queues","upload conflicts",mUploadingConflictFiles.size(),
+                queueBytes(mUploadingConflictFiles));
+    qint64 unloaded = 0;
+    for( int i = 0; i < PLANQUEUES; i++ ) {
+        unloaded += mPlanUnloaded[i];
+    }
+    report->add("queues","planned, still on disk",unloaded);
+    report->add("queues","plan budget",1,mPlanMemory);
+    report->add("queues","local directories",mScanDirectories.size(),
+                stringsBytes(mScanDirectories));
+    report->add("queues","pending disk writes",mPendingIO.size(),
+                mPendingIO.size()*(sizeof(PendingIO)+node));
+    report->add("queues","settling watch events",mCoalescer->pending());
+
+    report->add("local","scanned directories",mScannedDirs.size(),
+                mScannedDirs.size()*(sizeof(SyncDirStamp)+node));
+    report->add("local","tree entries",mLocalTree.size());
+    if( mFileWatcher ) {
+        report->add("local","watches",mFileWatcher->count());
+    }
+
+    report->add("paths","cached ids",mPaths->cachedIds(),
+                mPaths->cachedIds()*(2*sizeof(qint64)+sizeof(QString)+node));
+    report->add("paths","components",mPaths->components(),
+                mPaths->components()*(2*sizeof(QString)+node));
+
+    mWebdav->reportResources(report);
+
+    report->add("io","pending requests",mIO->pending(),mIO->pendingBytes());
+
+    if( mDBOpen ) {
+        QSqlQuery query(QSqlDatabase::database(mAccountName));
+        qint64 pageSize = 0;
+        query.exec("PRAGMA page_size;");
+        if( query.next() ) {
+            pageSize = query.value(0).toLongLong();
+        }
+        query.exec("PRAGMA page_count;");
+        if( query.next() ) {
+            report->add("database","pages",query.value(0).toLongLong(),0);
+            report->add("database","file bytes",
+                        query.value(0).toLongLong()*pageSize);
+        }
+        query.exec("PRAGMA freelist_count;");
+        if( query.next() ) {
+            report->add("database","free pages",query.value(0).toLongLong());
+        }
+        qint64 cache = sqlite3_util::cacheBytes(mDB);
+        if( cache >= 0 ) {
+            report->add("database","page cache",1,cache);
+        }
+    }
+}
+
+bool SyncQtOwnCloud::saveResources(SyncResourceReport *report)
+{
+    QString dir = QDir::toNativeSeparators(mConfigDirectory+"/diagnostics");
+    QDir().mkpath(dir);
+    return report->save(QDir::toNativeSeparators(dir+"/")
+                        + mAccountName + "_resources.json");
+}
+
+void SyncQtOwnCloud::dumpResources()
+{
+    SyncResourceReport report(mAccountName);
+    collectResources(&report);
+    emit toLog(report.summary());
+    if( !saveResources(&report) ) {
+        emit toLog(tr("Could not write the resources of %1")
+                   .arg(mAccountName));
+    }
+}
+
+void SyncQtOwnCloud::processLocalDirs(QVector<SyncLocalDir> dirs)
+{
+    SYNC_TRACE_SCOPE("SyncQtOwnCloud::processLocalDirs");
+    if( mSyncPosition != LISTLOCALDIR ) {
+        return; // Left over from a cancelled scan
+    }
+    mDB.transaction();
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    for( int i = 0; i < dirs.size(); i++ ) {
+        mFileWatcher->addDirectory(dirs[i].path);
+        mScannedDirs.insert(dirs[i].path,dirs[i].stamp);
+        if( !dirs[i].unchanged ) {
+            continue; // Its entries come through processLocalEntries()
+        }
+        // Nothing was added, removed or renamed in here, so what we knew
+        // about its entries still holds
+        qint64 id = mPaths->id(localDBName(dirs[i].path,true),false);
+        if( id < 0 ) {
+            continue;
+        }
+        query.exec(QString("INSERT OR IGNORE INTO local_files_processing "
+                           "(file_name,file_size,file_type,last_modified,"
+                           "last_sync,prev_modified,conflict,path_id) "
+                           "SELECT file_name,file_size,file_type,"
+                           "last_modified,last_sync,last_modified,conflict,"
+                           "path_id FROM local_files WHERE path_id IN "
+                           "(SELECT id FROM paths WHERE parent_id='%1');")
+                   .arg(id));
+    }
+    mDB.commit();
+}
+
+void SyncQtOwnCloud::processLocalEntries(QVector<SyncLocalEntry> entries)
+{
+    SYNC_TRACE_SCOPE("SyncQtOwnCloud::processLocalEntries");
+    if( mSyncPosition != LISTLOCALDIR ) {
+        return; // Left over from a cancelled scan
+    }
+    static const QString collection("collection");
+    static const QString file("file");
+    mMetrics->addFilesScanned(entries.size());
+    // One transaction per batch
+    mDB.transaction();
+    for( int i = 0; i < entries.size(); i++ ) {
+        // Directories are watched through processLocalDirs()
+        if( !entries[i].isDir ) {
+            mFileWatcher->addFile(entries[i].path);
+        }
+        updateDBLocalFile(entries[i].path,entries[i].size,
+                          entries[i].lastModified,
+                          entries[i].isDir ? collection : file);
+    }
+    mDB.commit();
+}
+
+void SyncQtOwnCloud::diskGranted()
+{
+    mStateLock.lock();
+    mWaitingForBudget = false;
+    mStateLock.unlock();
+    mHoldsDisk = true;
+    if( mHardStop || mSyncPosition != LISTLOCALDIR ) {
+        releaseDisk();
+        return;
+    }
+    startLocalScan();
+}
 
+void SyncQtOwnCloud::releaseDisk()
+{
+    if( mHoldsDisk ) {
+        mHoldsDisk = false;
+        mBudget->release(this,SyncBudget::DISK);
+    }
+}
+
+void SyncQtOwnCloud::localScanFinished()
+{
+    releaseDisk();
+    mDB.transaction();
     if ( mScanDirectoriesSet.size() != 0 ) {
         while( mScanDirectories.size() > 0 ) {
-            QString relativeName = mScanDirectories.dequeue();
-            QString name(relativeName);
-            name.replace("_sssspace_"," ");
+            QString name = mScanDirectories.dequeue();
             scanLocalDirectoryForNewFiles(name);
-            mScanDirectoriesSet.remove(relativeName);
+            mScanDirectoriesSet.remove(name);
         }
     }
+    mDB.commit();
 
     // Then scan the base directory of the WebDAV server
     //syncDebug() << "Scanning server: " << mRemoteDirectory+"/";
-    mWebdav->dirList(mRemoteDirectory+"/");
-    mSyncPosition = LISTREMOTEDIR;
+    if( mPartialPass ) {
+        startPartialListing();
+    } else {
+        startRemoteListing();
+    }
+}
+
+void SyncQtOwnCloud::startRemoteListing()
+{
+    // Pick up where an interrupted listing left off, as long as the
+    // collections listed so far are still fresh enough to trust.
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec("SELECT min(listed_at) FROM listing_done;");
+    mDirectoryQueue.clear();
+    if( query.next() && !query.value(0).isNull() ) {
+        qint64 age = QDateTime::currentMSecsSinceEpoch()
+                - query.value(0).toLongLong();
+        if( age < mListingFreshness*1000 ) {
+            query.exec("SELECT directory FROM listing_queue;");
+            while( query.next() ) {
+                mDirectoryQueue.enqueue(query.value(0).toString());
+            }
+        }
+    }
+    if( !mDirectoryQueue.empty() ) {
+        emit toLog(tr("Resuming remote listing of %1, %2 collections left.")
+                   .arg(mAccountName).arg(mDirectoryQueue.size()));
+        listRemoteDirectory(mDirectoryQueue.dequeue());
+        return;
+    }
+
+    // Nothing (usable) to resume, so start over from the top
+    clearListingCheckpoint();
+    query.exec("DELETE FROM server_files_processing;");
+    listRemoteDirectory(mRemoteDirectory+"/");
+}
+
+void SyncQtOwnCloud::startPartialListing()
+{
+    // Only the collections holding changed entries are listed, one level
+    // deep. The rest of the server is left to the next full pass.
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec("DELETE FROM server_files_processing;");
+    QSet<QString> parents;
+    query.exec("SELECT file_name FROM local_files_processing;");
+    while( query.next() ) {
+        QString name = query.value(0).toString();
+        if( name.endsWith("/") )
+            name.chop(1);
+        parents.insert(name.left(name.lastIndexOf('/')+1));
+    }
+
+    QStringList dirs = parents.toList();
+    QStringList ids;
+    qint64 root = mPaths->id(mRemoteDirectory+"/",false);
+    mDirectoryQueue.clear();
+    for( int i = 0; i < dirs.size(); i++ ) {
+        qint64 id = mPaths->id(dirs[i],false);
+        if( id < 0 ) {
+            continue;
+        }
+        // A collection the server does not have yet gets created instead
+        if( id != root ) {
+            QSqlQuery known = queryDBFileInfo(dirs[i],"server_files");
+            if( !known.next() ) {
+                continue;
+            }
+        }
+        mDirectoryQueue.enqueue(dirs[i]);
+        ids.append(QString::number(id));
+    }
+    // Deletions on the server are only judged within what we listed
+    mListedScope = QString("path_id IN (SELECT id FROM paths WHERE "
+                           "parent_id IN (%1))")
+            .arg(ids.isEmpty() ? QString("-1") : ids.join(","));
+    emit toLog(tr("Checking %1 changed collections of %2")
+               .arg(mDirectoryQueue.size()).arg(mAccountName));
+    if( mDirectoryQueue.empty() ) {
+        syncFiles();
+        return;
+    }
+    listRemoteDirectory(mDirectoryQueue.dequeue());
+}
+
+void SyncQtOwnCloud::listRemoteDirectory(QString dir)
+{
+    mCurrentListing = dir;
+    mListingStarted = QDateTime::currentMSecsSinceEpoch();
+    mWebdav->dirList(dir);
+    if( mSyncPosition != LISTREMOTEDIR ) {
+        mStateLock.lock();
+        mSyncPosition = LISTREMOTEDIR;
+        mStateLock.unlock();
+        mMetrics->enterPhase(mSyncPosition);
+        updateStatus();
+    }
     restartRequestTimer();
 }
 
+void SyncQtOwnCloud::clearListingCheckpoint()
+{
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec("DELETE FROM listing_queue;");
+    query.exec("DELETE FROM listing_done;");
+}
+
+void SyncQtOwnCloud::setListingFreshness(qint64 seconds)
+{
+    mListingFreshness = seconds;
+}
+
 SyncQtOwnCloud::~SyncQtOwnCloud()
 {
+    mScheduler->cancelAll(this);
+    releaseConnection();
+    releaseDisk();
+    mBudget->forget(this);
+    mProgress->finish(this);
     delete mWebdav;
+    delete mPaths;
+    delete mPlan;
+    if( mDB.isOpen() ) {
+        sqlite3_util::countStatements(mDB,0);
+    }
     mDB.close();
+    mDB = QSqlDatabase();
+    QSqlDatabase::removeDatabase(mAccountName);
+    delete mMetrics;
 }
 
-void SyncQtOwnCloud::processDirectoryListing(QList<QWebDAV::FileInfo> fileInfo)
+void SyncQtOwnCloud::processDirectoryListing(QWebDAV::Listing listing)
 {
+    SYNC_TRACE_SCOPE("SyncQtOwnCloud::processDirectoryListing");
+    // Shared with QWebDAV, the entries are only ever read from here on
+    const QVector<QWebDAV::FileInfo> &fileInfo = *listing;
     stopRequestTimer();
     if( mSettingsCheck ) {
         // Great, we were just checking
@@ -284,11 +1038,20 @@ void SyncQtOwnCloud::processDirectoryListing(QList<QWebDAV::FileInfo> fileInfo)
         settingsAreFine();
         return;
     }
+    if( mDryRun ) {
+        mPlan->addListing(QDateTime::currentMSecsSinceEpoch()-mListingStarted);
+    }
     // Compare against the database of known files
     QSqlQuery query(QSqlDatabase::database(mAccountName));
     QSqlQuery add(QSqlDatabase::database(mAccountName));
+    QSqlQuery queue(QSqlDatabase::database(mAccountName));
     QString conflict("");
     QString prev("");
+    // Insert the whole listing in one transaction, one commit per listing
+    mDB.transaction();
+    add.prepare("INSERT INTO server_files_processing(file_name,file_size,"
+                "file_type,last_modified,conflict,prev_modified,path_id) "
+                "values(?,?,?,?,?,?,?);");
     for(int i = 0; i < fileInfo.size(); i++ ){
         // Check if it is a restricted file
         if ( isFileFiltered(fileInfo[i].fileName)) {
@@ -298,46 +1061,52 @@ void SyncQtOwnCloud::processDirectoryListing(QList<QWebDAV::FileInfo> fileInfo)
         if(query.next()) { // File exists get conflict and last_modified
             prev = query.value(4).toString();
             conflict = query.value(7).toString();
-            if ( conflict != "" && !mUploadingConflictFilesSet.contains(
-                     fileInfo[i].fileName.replace(" ","_sssspace_")) ) {
+            if ( conflict != "" &&
+                 !mUploadingConflictFilesSet.contains(fileInfo[i].fileName) ) {
                 // Enable the conflict resolution window
                 emit conflictExists(this);
                 mConflictsExist = true;
                 //syncDebug() << "SFile still conflicts: " << fileInfo[i].fileName;
             }
         } // Now add to the processing DB
-        QString addStatement = QString("INSERT INTO server_files_processing("
-                                       "file_name,file_size,file_type,"
-                                       "last_modified,conflict,"
-                                       "prev_modified) "
-                                       "values('%1','%2','%3','%4','%5',"
-                                       "'%6');")
-                .arg(fileInfo[i].fileName).arg(fileInfo[i].size)
-                .arg(fileInfo[i].type).arg(fileInfo[i].lastModified)
-                .arg(conflict).arg(prev);
-        //syncDebug() << "Query: " << addStatement;
-        add.exec(addStatement);
+        add.addBindValue(fileInfo[i].fileName);
+        add.addBindValue(fileInfo[i].size);
+        add.addBindValue(fileInfo[i].typeName());
+        add.addBindValue(fileInfo[i].lastModified);
+        add.addBindValue(conflict);
+        add.addBindValue(prev);
+        add.addBindValue(mPaths->id(fileInfo[i].fileName));
+        add.exec();
         // If a collection, list those contents too
-        if(fileInfo[i].type == "collection") {
+        if(fileInfo[i].isCollection() && !mPartialPass) {
             mDirectoryQueue.enqueue(fileInfo[i].fileName);
+            queue.exec(QString("INSERT OR IGNORE INTO listing_queue "
+                               "values('%1');").arg(fileInfo[i].fileName));
         }
     }
+    // Checkpoint this collection as listed, together with its entries
+    if( !mPartialPass ) {
+        queue.exec(QString("INSERT OR REPLACE INTO listing_done "
+                           "values('%1','%2');").arg(mCurrentListing)
+                   .arg(QDateTime::currentMSecsSinceEpoch()));
+        queue.exec(QString("DELETE FROM listing_queue WHERE directory='%1';")
+                   .arg(mCurrentListing));
+    }
+    mDB.commit();
     if(!mDirectoryQueue.empty()) {
-        mWebdav->dirList(mDirectoryQueue.dequeue());
-        mSyncPosition = LISTREMOTEDIR;
-        restartRequestTimer();
+        listRemoteDirectory(mDirectoryQueue.dequeue());
     } else {
+        if( !mPartialPass ) {
+            clearListingCheckpoint();
+        }
         syncFiles();
     }
 }
 
 void SyncQtOwnCloud::processFileReady(QNetworkReply *reply,QString fileName)
 {
-    fileName = stringRemoveBasePath(fileName,mRemoteDirectory);
-    // Temporarily remove this watcher so we don't get a message when
-    // we modify it.
-    if(mFileWatcher)
-        mFileWatcher->removePath(mLocalDirectory+fileName);
+    SYNC_TRACE_SCOPE("SyncQtOwnCloud::processFileReady");
+    fileName = SyncPath::relative(fileName,mRemoteDirectory);
     QString finalName;
     if(mDownloadingConflictingFile) {
         finalName = getConflictName(fileName);
@@ -345,71 +1114,190 @@ void SyncQtOwnCloud::processFileReady(QNetworkReply *reply,QString fileName)
     } else {
         finalName = fileName;
     }
-    QFile file(mLocalDirectory+finalName);
-    if (!file.open(QIODevice::WriteOnly)) {
-        syncDebug() << "Could not open file " << file.fileName() << "for writting.";
-        processNextStep();
+    // Temporarily ignore this file so we don't get a message when
+    // we modify it. It is watched again once the data has landed.
+    if(mFileWatcher)
+        mFileWatcher->ignore(mLocalDirectory+finalName);
+
+    // The disk gets the data on its own time, the network moves on
+    PendingIO io;
+    io.operation = mDownloadingConflictingFile ? "download_conflict"
+                                               : "download";
+    io.name = fileName;
+    io.path = mLocalDirectory+finalName;
+    io.size = mCurrentFileSize;
+    recordTransfer(mCurrentFileSize);
+    mPendingIO.insert(mIO->write(io.path,reply->readAll()),io);
+    reply->deleteLater();
+    processNextStep();
+}
+
+void SyncQtOwnCloud::ioFinished(SyncIOResult result)
+{
+    SYNC_TRACE_SCOPE("SyncQtOwnCloud::ioFinished");
+    if( !mPendingIO.contains(result.id) ) {
         return;
     }
-    QDataStream out(&file);
-    qint64 bytes = reply->bytesAvailable();
-    qint64 bytesToRead;
-    while( bytes > 0 ) {
-        if( bytes > 100 ) {
-            bytesToRead = 100;
-            bytes -= 100;
-        } else {
-            bytesToRead = bytes;
-            bytes = 0;
+    PendingIO io = mPendingIO.take(result.id);
+    if( !result.ok ) {
+        syncDebug() << "Local " << io.operation << " failed: " << result.path
+                    << result.error;
+    }
+
+    if( io.operation == "download" || io.operation == "download_conflict" ) {
+        if(mFileWatcher)
+            mFileWatcher->resume(io.path); // Watch it again!
+        if( result.ok ) {
+            updateDBDownload(io.name,io.operation == "download_conflict",
+                             io.size);
+        }
+    } else if( io.operation == "mkdir_local" ) {
+        if( result.ok ) {
+            emit toLog(tr("Created local directory: %1").arg(io.name));
+        }
+    } else if( io.operation == "delete_local" ) {
+        if( result.ok ) {
+            localDeleteDone(io.name,false);
         }
-        out.writeRawData(reply->read(bytesToRead).constData(),bytesToRead);
+    } else if( io.operation == "delete_local_dir" ) {
+        if( result.ok ) {
+            localDeleteDone(io.name,true);
+        }
+    } else if( io.operation == "conflict_server" ) {
+        if( result.ok ) {
+            QSqlQuery query(QSqlDatabase::database(mAccountName));
+            QString statement = QString("UPDATE local_files SET last_sync='%1'"
+                                      "WHERE file_name='%2';")
+                    .arg(io.lastModified).arg(io.name);
+            query.exec(statement);
+            statement = QString("UPDATE local_files_processing SET "
+                                "last_sync='%1' WHERE file_name='%2';")
+                    .arg(io.lastModified).arg(io.name);
+            query.exec(statement);
+            clearFileConflict(io.name);
+        }
+        // Add back to the watcher
+        if(mFileWatcher)
+            mFileWatcher->resume(io.path);
+    }
+
+    // Whatever was held back for the disk may go on now
+    if( mWaitingForDisk ) {
+        mStateLock.lock();
+        mWaitingForDisk = false;
+        mStateLock.unlock();
+        processNextStep();
     }
-    file.flush();
-    file.close();
-    updateDBDownload(fileName);
-    if(mFileWatcher)
-        mFileWatcher->addPath(mLocalDirectory+fileName); // Add the watcher back!
-    reply->deleteLater();
-    processNextStep();
 }
 
 void SyncQtOwnCloud::processNextStep()
 {
+    SYNC_TRACE_SCOPE("SyncQtOwnCloud::processNextStep");
     stopRequestTimer();
     if(mHardStop) { // Hard stop, usually indicates account will be removed
         return;
     }
 
+    mStateLock.lock();
     mSyncPosition = TRANSFER;
+    mStateLock.unlock();
+    mMetrics->enterPhase(mSyncPosition);
+
+    // The request that brought us here is done, its connection goes back
+    releaseConnection();
+
+    if(mIsPaused || mWaitingForBudget || mWaitingForDisk) {
+        return;
+    }
+
+    // Load the next window of the plan before deciding what comes next
+    fillPlan();
+
+    // Anything left to send first needs a connection from the budget
+    bool work = mMakeServerDirs.size() != 0 || mDownloadingFiles.size() != 0
+            || mUploadingFiles.size() != 0
+            || mUploadingConflictFiles.size() != 0
+            || mDownloadConflict.size() != 0;
+
+    // A slow disk holds back further downloads, and the pass is only over
+    // once everything it wrote has landed
+    bool downloads = mMakeServerDirs.size() == 0 &&
+            ( mDownloadingFiles.size() != 0 ||
+              ( mUploadingFiles.size() == 0 &&
+                mUploadingConflictFiles.size() == 0 &&
+                mDownloadConflict.size() != 0 ) );
+    if( (downloads && mIO->isSaturated()) ||
+            (!work && !mPendingIO.isEmpty()) ) {
+        mStateLock.lock();
+        mWaitingForDisk = true;
+        mStateLock.unlock();
+        updateStatus();
+        return;
+    }
+    if( work ) {
+        if( !mBudget->acquire(this,SyncBudget::CONNECTION,
+                              SLOT(connectionGranted())) ) {
+            mStateLock.lock();
+            mWaitingForBudget = true;
+            mStateLock.unlock();
+            updateStatus();
+            return;
+        }
+        mHoldsConnection = true;
+    }
+    startNextOperation();
+}
 
-    if(mIsPaused) {
+void SyncQtOwnCloud::connectionGranted()
+{
+    mStateLock.lock();
+    mWaitingForBudget = false;
+    mStateLock.unlock();
+    mHoldsConnection = true;
+    if( mHardStop || mIsPaused ) {
+        releaseConnection();
         return;
     }
+    startNextOperation();
+}
+
+void SyncQtOwnCloud::releaseConnection()
+{
+    if( mHoldsConnection ) {
+        mHoldsConnection = false;
+        mBudget->release(this,SyncBudget::CONNECTION);
+    }
+}
 
+void SyncQtOwnCloud::startNextOperation()
+{
     if( mMakeServerDirs.size() != 0 ) {
-            mWebdav->mkdir(mMakeServerDirs.dequeue());
+            QString dir = mMakeServerDirs.dequeue();
+            mPlanBytes -= SyncResourceReport::stringBytes(dir);
+            mWebdav->mkdir(dir);
             restartRequestTimer();
             //syncDebug() << "Making the following directories on server: " <<
           //            serverDirs[i];
     // Check if there is another file to dowload, if so, start that process
     }else if( mDownloadingFiles.size() != 0 ) {
-        download(mDownloadingFiles.dequeue());
+        download(dequeueOperation(mDownloadingFiles));
     } else if ( mUploadingFiles.size() != 0 ) { // Maybe an upload?
-        upload(mUploadingFiles.dequeue());
+        upload(dequeueOperation(mUploadingFiles));
     } else if ( mUploadingConflictFiles.size() !=0 ) { // Upload conflict files
-        FileInfo info = mUploadingConflictFiles.dequeue();
+        FileInfo info = dequeueOperation(mUploadingConflictFiles);
         upload(info);
         clearFileConflict(info.name);
-        mUploadingConflictFilesSet.remove(info.name.replace(" ","_sssspace_"));
+        mUploadingConflictFilesSet.remove(info.name);
     } else if ( mDownloadConflict.size() != 0 ) { // Download conflicting files
         mDownloadingConflictingFile = true;
-        download(mDownloadConflict.dequeue());
+        download(dequeueOperation(mDownloadConflict));
         emit conflictExists(this);
     } else { // We are done! Start the sync clock
         mDownloadingConflictingFile = false;
+        mStateLock.lock();
         mBusy = false;
-        if(mSyncTimer)
-            mSyncTimer->start();
+        mStateLock.unlock();
+        schedulePoll();
         emit toLog(tr("Finished %1: %2").arg(mAccountName)
                                 .arg(QDateTime::currentDateTime().toString()));
         if(mConflictsExist) {
@@ -417,12 +1305,29 @@ void SyncQtOwnCloud::processNextStep()
         } else {
             //mSystemTray->setIcon(mDefaultIcon);
         }
+        QString lastSync = QDateTime::currentDateTime().toString();
         QSqlQuery query(QSqlDatabase::database(mAccountName));
-        query.exec(QString("UPDATE config SET lastsync='%1';").arg(
-                       QDateTime::currentDateTime().toString()));
+        query.exec(QString("UPDATE config SET lastsync='%1';").arg(lastSync));
+        mStateLock.lock();
+        mLastSync = lastSync;
+        mStateLock.unlock();
+        journalClear();
+        resetPlan();
+        saveThroughput();
+        mPartialPass = false;
+        if( !mScannedDirs.isEmpty() ) {
+            saveScanCache();
+        }
         mNeedsSync = false;
         mLastSyncAborted = SYNCFINISHED;
+        mStateLock.lock();
         mSyncPosition = SYNCFINISHED;
+        mStateLock.unlock();
+        mLoopMonitor->stop();
+        mProgress->finish(this);
+        saveMetrics(false);
+        syncDebug() << mAccountName << "event loop lag:"
+                    << mLoopMonitor->summary();
         emit finishedSync(this);
     }
     updateStatus();
@@ -430,16 +1335,40 @@ void SyncQtOwnCloud::processNextStep()
 
 QString SyncQtOwnCloud::getLastSync()
 {
-    QSqlQuery query(QSqlDatabase::database(mAccountName));
-    query.exec("SELECT lastsync FROM config;");
-    if( query.next() ) {
-        return query.value(0).toString();
+    // Kept in step with the config table, so no thread but ours touches it
+    QMutexLocker locker(&mStateLock);
+    return mLastSync;
+}
+
+QList<QStringList> SyncQtOwnCloud::getConflicts()
+{
+    // Called from the window, so it reads through a connection of its own.
+    // WAL lets it do so while a pass is writing.
+    QList<QStringList> conflicts;
+    QString connection = mAccountName+"_conflicts";
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE",connection);
+        db.setDatabaseName(mDBFileName);
+        if( db.open() ) {
+            QSqlQuery query(db);
+            query.exec("SELECT * from conflicts;");
+            while( query.next() ) {
+                QStringList row;
+                for( int i = 0; i < 4; i++ ) {
+                    row << query.value(i).toString();
+                }
+                conflicts.append(row);
+            }
+            db.close();
+        }
     }
-    return QString("");
+    QSqlDatabase::removeDatabase(connection);
+    return conflicts;
 }
 
 void SyncQtOwnCloud::scanLocalDirectory( QString dirPath)
 {
+    SYNC_TRACE_SCOPE("SyncQtOwnCloud::scanLocalDirectory");
     QDir dir(dirPath);
     dir.setFilter(QDir::Files|QDir::NoDot|QDir::NoDotDot|QDir::AllEntries
                   |QDir::Hidden);
@@ -452,7 +1381,7 @@ void SyncQtOwnCloud::scanLocalDirectory( QString dirPath)
         }
 
         //syncDebug() << "Relative Path: " << relativeName;
-        processLocalFile(dirPath + "/" + name);
+        processLocalFile(SyncPath::join(dirPath,name));
 
         // Check if it is a directory, and if so, process it
     }
@@ -473,7 +1402,11 @@ void SyncQtOwnCloud::processLocalFile(QString name)
     }
 
     // Add to the watcher
-    mFileWatcher->addPath(name+append);
+    if( file.isDir() ) {
+        mFileWatcher->addDirectory(name);
+    } else {
+        mFileWatcher->addFile(name);
+    }
     updateDBLocalFile(name + append,
                       file.size(),file.lastModified().toUTC()
                       .toMSecsSinceEpoch(),type);
@@ -486,12 +1419,13 @@ void SyncQtOwnCloud::processLocalFile(QString name)
 void SyncQtOwnCloud::updateDBLocalFile(QString name, qint64 size, qint64 last,
                                    QString type )
 {
+    SYNC_TRACE_SCOPE("SyncQtOwnCloud::updateDBLocalFile");
     // Do not upload the server conflict files
     if( isFileFiltered(name)) {
         return;
     }
     // Get the relative name of the file
-    name = stringRemoveBasePath(name, mLocalDirectory);
+    name = SyncPath::relative(name, mLocalDirectory);
     name = mRemoteDirectory + name;
     //syncDebug() << "Local file name: " << name;
     // Check against the database
@@ -518,15 +1452,19 @@ void SyncQtOwnCloud::updateDBLocalFile(QString name, qint64 size, qint64 last,
             return; // Nothing changed
         }
     }
+    // Only the latest state of a file counts
+    query.exec(QString("DELETE FROM local_files_processing WHERE "
+                       "file_name='%1';").arg(name));
     QString addStatement = QString("INSERT INTO local_files_processing "
                                    "(file_name,file_size,file_type,"
                                    "last_modified,prev_modified,conflict,"
-                                   "last_sync) values('%1','%2','%3','%4','%5',"
-                                   "'%6','%7');")
+                                   "last_sync,path_id) values('%1','%2','%3',"
+                                   "'%4','%5','%6','%7','%8');")
             .arg(name).arg(size).arg(type).arg(last).arg(prev).arg(conflict)
-            .arg(sync);
+            .arg(sync).arg(mPaths->id(name));
     //syncDebug() << "Query: " << addStatement;
     query.exec(addStatement);
+    mLocalTree.setDirty(name,true);
     mNeedsSync = true;  // Since a local file was changed, we need to sync
     // before closing
     //syncDebug() << "Processing: " << mLocalDirectory + relativeName << " Size: "
@@ -535,6 +1473,7 @@ void SyncQtOwnCloud::updateDBLocalFile(QString name, qint64 size, qint64 last,
 
 QSqlQuery SyncQtOwnCloud::queryDBFileInfo(QString fileName, QString table)
 {
+    SYNC_TRACE_SCOPE("SyncQtOwnCloud::queryDBFileInfo");
     QSqlQuery query(QSqlDatabase::database(mAccountName));
     query.exec("SELECT * FROM " + table + " WHERE file_name = '" +
                      fileName + "';");
@@ -543,6 +1482,7 @@ QSqlQuery SyncQtOwnCloud::queryDBFileInfo(QString fileName, QString table)
 
 QSqlQuery SyncQtOwnCloud::queryDBAllFiles(QString table)
 {
+    SYNC_TRACE_SCOPE("SyncQtOwnCloud::queryDBAllFiles");
     QSqlQuery query(QSqlDatabase::database(mAccountName));
     query.exec("SELECT * FROM " + table + ";");
     return query;
@@ -550,9 +1490,16 @@ QSqlQuery SyncQtOwnCloud::queryDBAllFiles(QString table)
 
 void SyncQtOwnCloud::syncFiles()
 {
+    SYNC_TRACE_SCOPE("SyncQtOwnCloud::syncFiles");
     QList<QString> localDirs;
     QSqlQuery localQuery;
-    if( !mIsFirstRun ) {
+    mDB.transaction();
+    // Start a fresh plan, but keep whatever is still pending
+    QSqlQuery journal(QSqlDatabase::database(mAccountName));
+    journal.exec("DELETE FROM journal WHERE done='yes';");
+    // A partial pass only compares what changed, so it leaves out the
+    // unchanged entries here
+    if( !mIsFirstRun && !mPartialPass ) {
         localQuery = queryDBAllFiles("local_files");
         while ( localQuery.next() ) {
             QSqlQuery query(QSqlDatabase::database(mAccountName));
@@ -562,8 +1509,9 @@ void SyncQtOwnCloud::syncFiles()
             if(!query.next()) {
                 query.exec(QString("INSERT INTO local_files_processing (file_name,"
                                    "file_size,file_type,last_modified,last_sync,"
-                                   "prev_modified,conflict) "
-                                   "values('%1','%2','%3','%4','%5','%6','%7');")
+                                   "prev_modified,conflict,path_id) "
+                                   "values('%1','%2','%3','%4','%5','%6','%7',"
+                                   "'%8');")
                            .arg(localQuery.value(1).toString())
                            .arg(localQuery.value(2).toString())
                            .arg(localQuery.value(3).toString())
@@ -571,6 +1519,7 @@ void SyncQtOwnCloud::syncFiles()
                            .arg(localQuery.value(5).toString())
                            .arg(localQuery.value(7).toString())
                            .arg(localQuery.value(8).toString())
+                           .arg(localQuery.value(9).toString())
                            );
             }
         }
@@ -638,7 +1587,7 @@ void SyncQtOwnCloud::syncFiles()
                                         localModifiedTime.toString());
                         //syncDebug() << "UPLOAD:   " << localName;
                     } else { // There is no conflict
-                        mUploadingFiles.enqueue(FileInfo(localName,localSize));
+                        enqueueOperation("upload",FileInfo(localName,localSize));
                         mTotalToUpload +=localSize;
                         //syncDebug() << "File " << localName << " is newer than server!";
                     }
@@ -660,7 +1609,7 @@ void SyncQtOwnCloud::syncFiles()
                                         serverModifiedTime.toString(),
                                         localModifiedTime.toString());
                     } else { // There is no conflict
-                        mDownloadingFiles.enqueue(FileInfo(localName,serverSize));
+                        enqueueOperation("download",FileInfo(localName,serverSize));
                         mTotalToDownload += serverSize;
                         //syncDebug() << "OLDER:    " << localName;
                     }
@@ -674,9 +1623,9 @@ void SyncQtOwnCloud::syncFiles()
             if(!check.next()) {
                 //syncDebug() << "NEW:      " << localName;
                 if ( localType == "collection") {
-                    mMakeServerDirs.enqueue(localName);
+                    enqueueOperation("mkdir",FileInfo(localName,0));
                 } else {
-                    mUploadingFiles.enqueue(FileInfo(localName,localSize));
+                    enqueueOperation("upload",FileInfo(localName,localSize));
                     mTotalToUpload += localSize;
                 }
             }
@@ -704,36 +1653,51 @@ void SyncQtOwnCloud::syncFiles()
                 if( serverType == "collection") {
                     localDirs.append(serverName);
                 } else {
-                    mDownloadingFiles.enqueue(FileInfo(serverName,serverSize));
+                    enqueueOperation("download",FileInfo(serverName,serverSize));
                     mTotalToDownload += serverSize;
                 }
                 syncDebug() << "DOWNLOAD new file: " << serverName;
             }
         }
     }
-    for( int i = 0; i < mDownloadConflict.size(); i++ ) {
-        mTotalToDownload += mDownloadConflict[i].size;
-    }
-    for( int i = 0; i < mUploadingConflictFiles.size(); i++ ) {
-        mTotalToUpload += mUploadingConflictFiles[i].size;
+    // Conflicts may have been planned before this pass, count them all
+    journal.exec("SELECT operation,sum(file_size) FROM journal WHERE done='' "
+                 "AND operation IN ('download_conflict','upload_conflict') "
+                 "GROUP BY operation;");
+    while( journal.next() ) {
+        if( journal.value(0).toString() == "download_conflict" ) {
+            mTotalToDownload += journal.value(1).toLongLong();
+        } else {
+            mTotalToUpload += journal.value(1).toLongLong();
+        }
     }
     mTotalToTransfer = mTotalToDownload+mTotalToUpload;
 
-    // Make local dirs
+    // Make local dirs. Downloads into them create missing parents on their
+    // own, so they need not wait for these.
     for(int i = 0; i < localDirs.size(); i++ ) {
-        QDir dir;
-        if (!dir.mkdir(mLocalDirectory+
-                       stringRemoveBasePath(localDirs[i],mRemoteDirectory)) ) {
-            syncDebug() << "Could not make directory "+mLocalDirectory+
-                        stringRemoveBasePath(localDirs[i],mRemoteDirectory);
-        } else {
-            emit toLog(tr("Created local directory: %1").arg(localDirs[i]));
-            //syncDebug() << "Made directory "+mLocalDirectory+localDirs[i];
+        if( mDryRun ) {
+            mPlan->add(SyncPlanReport::MKDIR_LOCAL,localDirs[i]);
+            continue;
         }
+        PendingIO io;
+        io.operation = "mkdir_local";
+        io.name = localDirs[i];
+        io.path = mLocalDirectory+
+                SyncPath::relative(localDirs[i],mRemoteDirectory);
+        mPendingIO.insert(mIO->mkdir(io.path),io);
     }
 
     // Delete removed files and reset the file status
     deleteRemovedFiles();
+    if( mDryRun ) {
+        // Everything this pass wrote to the database goes again, so the
+        // next real pass plans exactly the same
+        mDB.rollback();
+        finishDryRun();
+        return;
+    }
+    mDB.commit();
     mIsFirstRun = false;
 
     // Let's get the ball rolling!
@@ -743,6 +1707,10 @@ void SyncQtOwnCloud::syncFiles()
 void SyncQtOwnCloud::setFileConflict(QString name, qint64 size, QString server_last,
                                  QString local_last)
 {
+    if( mDryRun ) {
+        mPlan->add(SyncPlanReport::CONFLICT,name,size);
+        return;
+    }
     QSqlQuery conflict(QSqlDatabase::database(mAccountName));
     QString conflictText = QString("UPDATE server_files_processing SET conflict='yes'"
                     " WHERE file_name='%1';").arg(name);
@@ -753,7 +1721,7 @@ void SyncQtOwnCloud::setFileConflict(QString name, qint64 size, QString server_l
     conflictText = QString("INSERT INTO conflicts values('%1','','%2','%3');")
             .arg(name).arg(server_last).arg(local_last);
     conflict.exec(conflictText);
-    mDownloadConflict.enqueue(FileInfo(name,size));
+    enqueueOperation("download_conflict",FileInfo(name,size));
     mConflictsExist = true;
     emit toMessage(tr("%1 has a conflict!").arg(mAccountName),
                    tr("File %1 conflicts.").arg(name),
@@ -765,12 +1733,17 @@ void SyncQtOwnCloud::download( FileInfo file )
 {
     syncDebug() << "Will download file: " << file.name;
     mCurrentFileSize = file.size;
+    mStateLock.lock();
     mCurrentFile = file.name;
     if(mDownloadingConflictingFile) {
         mTransferState = tr("Downloading conflicting file ");
     } else {
         mTransferState = tr("Downloading ");
     }
+    mFilePercent = 0;
+    mStateLock.unlock();
+    mLastProgress = 0;
+    mTransferStarted = QDateTime::currentMSecsSinceEpoch();
     QNetworkReply *reply = mWebdav->get(file.name);
     connect(reply, SIGNAL(downloadProgress(qint64,qint64)),
             this, SLOT(transferProgress(qint64,qint64)));
@@ -781,17 +1754,23 @@ void SyncQtOwnCloud::download( FileInfo file )
 void SyncQtOwnCloud::upload( FileInfo fileInfo)
 {
     QString localName = fileInfo.name;
-    localName = stringRemoveBasePath(localName,mRemoteDirectory);
+    localName = SyncPath::relative(localName,mRemoteDirectory);
     mCurrentFileSize = fileInfo.size;
+    mStateLock.lock();
     mCurrentFile = fileInfo.name;
     mTransferState = tr("Uploading ");
+    mFilePercent = 0;
+    mStateLock.unlock();
     syncDebug() << "Uploading File " +mLocalDirectory + mCurrentFile;
     QFile file(mLocalDirectory+localName);
     if (!file.open(QIODevice::ReadOnly)) {
         syncDebug() << "File read error " + mLocalDirectory+localName+" Code: "
                     << file.error();
+        processNextStep(); // Skip it, and don't sit on the connection
         return;
     }
+    mLastProgress = 0;
+    mTransferStarted = QDateTime::currentMSecsSinceEpoch();
     QNetworkReply *reply = mWebdav->put(fileInfo.name,mLocalDirectory+localName,
                                         "_ocs_uploading.");
     connect(reply, SIGNAL(uploadProgress(qint64,qint64)),
@@ -800,7 +1779,8 @@ void SyncQtOwnCloud::upload( FileInfo fileInfo)
     updateStatus();
 }
 
-void SyncQtOwnCloud::updateDBDownload(QString name)
+void SyncQtOwnCloud::updateDBDownload(QString name, bool conflict,
+                                      qint64 size)
 {
     // This seems redundant, a little, really.
     QString fileName = mLocalDirectory+name;
@@ -811,9 +1791,11 @@ void SyncQtOwnCloud::updateDBDownload(QString name)
     }
 
     QString downloadText;
-    if( mDownloadingConflictingFile ) {
+    if( conflict ) {
+        journalDone("download_conflict",dbName);
         downloadText = tr("Downloaded conflicting file: %1").arg(dbName);
     } else {
+        journalDone("download",dbName);
         // Check against the database
         QSqlQuery query = queryDBFileInfo(dbName,"local_files");
         if (query.next() ) { // We already knew about this file. Update.
@@ -829,20 +1811,23 @@ void SyncQtOwnCloud::updateDBDownload(QString name)
             query.exec(updateStatement);
         } else { // We did not know about this file, add
             QString addStatement = QString("INSERT INTO local_files (file_name,"
-                                           "file_size,file_type,last_modified,last_sync) "
-                                           "values('%1','%2','%3','%4','%5');")
+                                           "file_size,file_type,last_modified,last_sync,"
+                                           "path_id) "
+                                           "values('%1','%2','%3','%4','%5','%6');")
                     .arg(dbName).arg(file.size())
                     .arg("file")
                     .arg(file.lastModified().toUTC().toMSecsSinceEpoch())
-                    .arg(file.lastModified().toUTC().toMSecsSinceEpoch());
+                    .arg(file.lastModified().toUTC().toMSecsSinceEpoch())
+                    .arg(mPaths->id(dbName));
             query.exec(addStatement);
+            mLocalTree.insert(dbName);
         }
         copyServerProcessing(dbName);
         downloadText = tr("Downloaded file: %1").arg(dbName);
     }
     emit toLog(downloadText);
     //syncDebug() << "Did this get called?";
-    mTotalTransfered += mCurrentFileSize;
+    mTotalTransfered += size;
 }
 
 void SyncQtOwnCloud::updateDBUpload(QString name)
@@ -871,11 +1856,11 @@ void SyncQtOwnCloud::updateDBUpload(QString name)
         //syncDebug() << "Query: " << updateStatement;
     } else { // We did not know about this file, add
         QString addStatement = QString("INSERT INTO server_files (file_name,"
-                             "file_size,file_type,last_modified) "
-                                       "values('%1','%2','%3','%4');")
+                             "file_size,file_type,last_modified,path_id) "
+                                       "values('%1','%2','%3','%4','%5');")
                 .arg(name).arg(file.size())
                 .arg("file")
-                .arg(time);
+                .arg(time).arg(mPaths->id(name));
         query.exec(addStatement);
 //        QString updateStatement =
 //                QString("UPDATE local_files_processing SET file_size='%1',"
@@ -884,6 +1869,8 @@ void SyncQtOwnCloud::updateDBUpload(QString name)
 //        query.exec(updateStatement);
     }
     emit toLog(tr("Uploaded file: %1").arg(name));
+    journalDone("upload",name);
+    journalDone("upload_conflict",name);
     QString updateStatement =
             QString("UPDATE local_files_processing SET last_sync='%1'"
                     "where file_name='%2'")
@@ -891,42 +1878,54 @@ void SyncQtOwnCloud::updateDBUpload(QString name)
     query.exec(updateStatement);
     copyLocalProcessing(name);
     mTotalTransfered += mCurrentFileSize;
+    recordTransfer(mCurrentFileSize);
     processNextStep();
 }
 
 void SyncQtOwnCloud::transferProgress(qint64 current, qint64 total)
 {
-    stopRequestTimer();
-    // First update the current file progress bar
-    qint64 percent;
-    if ( total > 0 ) {
-        percent = 100*current/total;
-        emit progressFile(percent);
-        //ui->progressFile->setValue(percent);
-    } else {
-        percent = 0;
+    // This comes for every chunk a reply moves, so it only keeps count.
+    // The window picks the numbers up from mProgress at its own pace.
+    if( current > mLastProgress ) {
+        // What moved since last time counts against our fair share
+        mBudget->charge(this,current-mLastProgress);
+    }
+    mLastProgress = current;
+
+    qint64 size = total > 0 ? total : mCurrentFileSize;
+    qint64 done = qMin(current,size);
+    mProgress->report(this,mTotalTransfered+done,mTotalToTransfer,done,size);
+    mStateLock.lock();
+    mFilePercent = size > 0 ? 100*done/size : 0;
+    if (mTotalToTransfer > 0) {
+        mTotalPercent = 100*(mTotalTransfered+done)/mTotalToTransfer;
     }
+    mStateLock.unlock();
 
-    // Then update the total progress bar
-    qint64 additional = (mCurrentFileSize*percent)/100;
-    if (mTotalToTransfer > 0) {
-        emit progressTotal(100*(mTotalTransfered+additional)/mTotalToTransfer);
+    // The request is alive. Moving its deadline goes through the
+    // scheduler, which may add up to a second of its own, so only push it
+    // out once a quarter of the timeout has passed. That leaves a live
+    // transfer well clear of _OCS_REQUEST_TIMEOUT.
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if( now - mRequestTimerRestarted >= _OCS_REQUEST_TIMEOUT/4 ) {
+        restartRequestTimer();
     }
-    restartRequestTimer();
 }
 
-void SyncQtOwnCloud::updateDBVersion(int fromVersion)
+bool SyncQtOwnCloud::updateDBVersion(int fromVersion)
 {
-    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    // Each case takes the database from that version to the next one. The
+    // whole upgrade goes in one transaction, so a failed step leaves the
+    // old version behind intact.
+    mDB.transaction();
+    bool ok = true;
     switch(fromVersion) {
     case 0: // Same as Version 1 (used in case a version is not found)
-    case 1:
-    case 2:
-        QString createVersion("create table db_version(\n"
+    case 1: {
+        // A version 1 database may or may not have this one already
+        QString createVersion("create table if not exists db_version(\n"
                               "\tversion integer"
                               ");");
-        QString updateVersion = QString("INSERT INTO db_version values('%1');")
-                .arg(_OCS_DB_VERSION);
         QString createLocalProcessing("create table local_files_processing(\n"
                                       "\tid INTEGER PRIMARY KEY ASC,\n"
                                       "\tfile_name text unique,\n"
@@ -946,14 +1945,141 @@ void SyncQtOwnCloud::updateDBVersion(int fromVersion)
                                        "\tprev_modified text,\n"
                                        "\tconflict text\n"
                                        ");");
+        ok = ok && execSchema(createVersion)
+                && execSchema(createLocalProcessing)
+                && execSchema(createServerProcessing);
+    }
+        // Fall through
+    case 2:
+        ok = ok && createJournal();
+        // Fall through
+    case 3:
+        ok = ok && createListingCheckpoint();
+        // Fall through
+    case 4: {
+        // Refer to the normalized paths table from all file tables
+        QStringList tables;
+        tables << "local_files" << "server_files"
+               << "local_files_processing" << "server_files_processing";
+        for( int i = 0; ok && i < tables.size(); i++ ) {
+            ok = execSchema(QString("ALTER TABLE %1 ADD COLUMN path_id "
+                                    "integer;").arg(tables[i]));
+        }
+        ok = ok && createPathIndexes();
+        QSqlQuery rows(QSqlDatabase::database(mAccountName));
+        for( int i = 0; ok && i < tables.size(); i++ ) {
+            rows.exec(QString("SELECT id,file_name FROM %1;")
+                      .arg(tables[i]));
+            while( ok && rows.next() ) {
+                ok = execSchema(QString("UPDATE %1 SET path_id='%2' WHERE "
+                                        "id='%3';")
+                                .arg(tables[i])
+                                .arg(mPaths->id(rows.value(1).toString()))
+                                .arg(rows.value(0).toString()));
+            }
+        }
+    }
+        // Fall through
+    case 5:
+        ok = ok && createScanCache();
+        // Fall through
+    case 6:
+        ok = ok && createPlanIndex();
+        break;
+    }
 
+    // Finally record the version we just updated to
+    ok = ok && execSchema("DELETE FROM db_version;")
+            && execSchema(QString("INSERT INTO db_version values('%1');")
+                          .arg(_OCS_DB_VERSION));
+    if( !ok ) {
+        mDB.rollback();
+        mPaths->clearCache();
+        emit toLog(tr("Could not upgrade the database of %1 from version "
+                      "%2, it will not be synced.").arg(mAccountName)
+                   .arg(fromVersion));
+        return false;
+    }
+    mDB.commit();
+    return true;
+}
 
-        query.exec(createVersion);
-        query.exec(updateVersion);
-        query.exec(createLocalProcessing);
-        query.exec(createServerProcessing);
-        break;
+bool SyncQtOwnCloud::execSchema(const QString &statement)
+{
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    if( !query.exec(statement) ) {
+        syncDebug() << "Database statement failed: " << statement;
+        syncDebug() << query.lastError().text();
+        return false;
     }
+    return true;
+}
+
+bool SyncQtOwnCloud::createJournal()
+{
+    // Operations planned by syncFiles(). Each one is marked done as it
+    // completes, so that whatever is left can be replayed after a restart.
+    QString createJournal("create table journal(\n"
+                          "\tid INTEGER PRIMARY KEY ASC,\n"
+                          "\toperation text,\n"
+                          "\tfile_name text,\n"
+                          "\tfile_size text,\n"
+                          "\tdone text\n"
+                          ");");
+    QString createJournalIndex("create index journal_file_name on "
+                               "journal(file_name);");
+    return execSchema(createJournal) && execSchema(createJournalIndex);
+}
+
+bool SyncQtOwnCloud::createPlanIndex()
+{
+    // fillPlan() reads the journal one operation at a time, in id order
+    return execSchema("create index journal_plan on "
+                      "journal(operation,done,id);");
+}
+
+bool SyncQtOwnCloud::createPathIndexes()
+{
+    return mPaths->createTable()
+            && execSchema("create index local_files_path on "
+                          "local_files(path_id);")
+            && execSchema("create index server_files_path on "
+                          "server_files(path_id);")
+            && execSchema("create index local_processing_path on "
+                          "local_files_processing(path_id);")
+            && execSchema("create index server_processing_path on "
+                          "server_files_processing(path_id);");
+}
+
+bool SyncQtOwnCloud::createScanCache()
+{
+    // The stamps of every directory seen by the last complete local scan,
+    // and small bits of state such as when everything was last verified.
+    QString createDirs("create table local_dirs(\n"
+                       "\tdirectory text unique,\n"
+                       "\tmtime integer,\n"
+                       "\tctime integer,\n"
+                       "\tinode integer\n"
+                       ");");
+    QString createState("create table sync_state(\n"
+                        "\tkey text unique,\n"
+                        "\tvalue text\n"
+                        ");");
+    return execSchema(createDirs) && execSchema(createState);
+}
+
+bool SyncQtOwnCloud::createListingCheckpoint()
+{
+    // The remote listing frontier, and the collections already ingested
+    // into server_files_processing during the current listing.
+    QString createQueue("create table listing_queue(\n"
+                        "\tdirectory text unique\n"
+                        ");");
+    QString createDone("create table listing_done(\n"
+                       "\tdirectory text unique,\n"
+                       "\tlisted_at text\n"
+                       ");");
+    return execSchema(createQueue) && execSchema(createDone);
 }
 
 void SyncQtOwnCloud::createDataBase()
@@ -965,6 +2091,8 @@ void SyncQtOwnCloud::createDataBase()
         mDBOpen = false;
     } else {
         mDBOpen = true;
+        sqlite3_util::countStatements(mDB,mMetrics->statementCounter());
+        configureDB();
     }
     QString createLocal("create table local_files(\n"
                         "\tid INTEGER PRIMARY KEY ASC,\n"
@@ -975,7 +2103,8 @@ void SyncQtOwnCloud::createDataBase()
                         "\tlast_sync text,\n"
                         "\tfound text,\n"
                         "\tprev_modified text,\n"
-                        "\tconflict text\n"
+                        "\tconflict text,\n"
+                        "\tpath_id integer\n"
                         ");");
     QString createServer("create table server_files(\n"
                          "\tid INTEGER PRIMARY KEY ASC,\n"
@@ -985,7 +2114,8 @@ void SyncQtOwnCloud::createDataBase()
                          "\tlast_modified text,\n"
                          "\tfound text,\n"
                          "\tprev_modified text,\n"
-                         "\tconflict text\n"
+                         "\tconflict text,\n"
+                         "\tpath_id integer\n"
                          ");");
 
     QString createLocalProcessing("create table local_files_processing(\n"
@@ -996,7 +2126,8 @@ void SyncQtOwnCloud::createDataBase()
                                   "\tlast_modified text,\n"
                                   "\tlast_sync text,\n"
                                   "\tprev_modified text,\n"
-                                  "\tconflict text\n"
+                                  "\tconflict text,\n"
+                                  "\tpath_id integer\n"
                                   ");");
     QString createServerProcessing("create table server_files_processing(\n"
                                    "\tid INTEGER PRIMARY KEY ASC,\n"
@@ -1005,7 +2136,8 @@ void SyncQtOwnCloud::createDataBase()
                                    "\tfile_type text,\n"
                                    "\tlast_modified text,\n"
                                    "\tprev_modified text,\n"
-                                   "\tconflict text\n"
+                                   "\tconflict text,\n"
+                                   "\tpath_id integer\n"
                                    ");");
 
     QString createConflicts("create table conflicts(\n"
@@ -1043,7 +2175,14 @@ void SyncQtOwnCloud::createDataBase()
     query.exec(createConflicts);
     query.exec(createFilters);
     query.exec(createVersion);
-
+    query.exec(QString("INSERT INTO db_version values('%1');")
+               .arg(_OCS_DB_VERSION));
+    if( !createJournal() || !createPlanIndex() || !createListingCheckpoint()
+            || !createPathIndexes() || !createScanCache() ) {
+        emit toLog(tr("Could not create the database of %1.")
+                   .arg(mAccountName));
+        mDBOpen = false;
+    }
 }
 
 void SyncQtOwnCloud::readConfigFromDB()
@@ -1051,15 +2190,24 @@ void SyncQtOwnCloud::readConfigFromDB()
     QSqlQuery query(QSqlDatabase::database(mAccountName));
 
     // First identify what database verion we have
-    query.exec("SELECT * from version;");
+    bool upgraded = true;
+    query.exec("SELECT version from db_version;");
     if( query.next() ) { // We found a version
         int version = query.value(0).toInt();
-        if( version < _OCS_DB_VERSION )
-            updateDBVersion(version);
-    } else { // No version information, update from beginning
-        updateDBVersion(1);
+        if( version < _OCS_DB_VERSION && !updateDBVersion(version) ) {
+            upgraded = false;
+        }
+    } else {
+        // No version information. Databases created by version 2 left
+        // db_version empty until their next start, but already have the
+        // processing tables. Only older ones go through from the beginning.
+        QSqlQuery tables(QSqlDatabase::database(mAccountName));
+        tables.exec("SELECT name FROM sqlite_master WHERE type='table' AND "
+                    "name='local_files_processing';");
+        upgraded = updateDBVersion(tables.next() ? 2 : 1);
     }
     query.exec("SELECT * from config;");
+    QMutexLocker locker(&mStateLock);
     if(query.next()) {
         mHost = query.value(0).toString();
         mUsername = query.value(1).toString();
@@ -1073,10 +2221,14 @@ void SyncQtOwnCloud::readConfigFromDB()
         } else {
             mIsEnabled = false;
         }
+        mLastSync = query.value(7).toString();
     } else {
         // There is no configuration on the db
         mDBOpen = false;
     }
+    if( !upgraded ) { // Don't sync against a half upgraded database
+        mDBOpen = false;
+    }
 
     // Now also read the filters on file
     query.exec("SELECT * from filters;");
@@ -1087,18 +2239,46 @@ void SyncQtOwnCloud::readConfigFromDB()
 
 void SyncQtOwnCloud::removeFilter(QString filter)
 {
+    mStateLock.lock();
     mFilters.remove(filter);
+    mStateLock.unlock();
+    updateFilters();
     QSqlQuery query(QSqlDatabase::database(mAccountName));
     query.exec(QString("DELETE FROM filters WHERE filter='%1';").arg(filter));
+    emit filterListChanged(this);
 }
 
 void SyncQtOwnCloud::addFilter(QString filter)
 {
     if(!mFilters.contains(filter)) {
+        mStateLock.lock();
         mFilters.insert(filter);
+        mStateLock.unlock();
         QSqlQuery query(QSqlDatabase::database(mAccountName));
         query.exec(QString("INSERT into filters values('%1');").arg(filter));
+        filtersChanged();
     }
+    emit filterListChanged(this);
+}
+
+void SyncQtOwnCloud::filtersChanged()
+{
+    updateFilters();
+    mFiltersChanged = true;
+}
+
+void SyncQtOwnCloud::setGlobalFilters(QStringList filters)
+{
+    // A copy of the window's list, so it can change while we match
+    mGlobalFilters = filters;
+    filtersChanged();
+}
+
+void SyncQtOwnCloud::updateFilters()
+{
+    QStringList list = mFilters.toList();
+    list.append(mGlobalFilters);
+    mFilterMatcher.setFilters(list);
 }
 
 void SyncQtOwnCloud::saveConfigToDB()
@@ -1133,6 +2313,10 @@ void SyncQtOwnCloud::settingsAreFine()
 {
     if(mIsEnabled) {
         start();
+        // Transfers left over from the last run can go right away
+        if(mLastSyncAborted == TRANSFER && !mBusy ) {
+            timeToSync();
+        }
     } else {
         stop();
     }
@@ -1140,11 +2324,8 @@ void SyncQtOwnCloud::settingsAreFine()
 
 void SyncQtOwnCloud::start()
 {
-    if(mSyncTimer)
-        delete mSyncTimer;
-    mSyncTimer = new QTimer(this);
-    connect(mSyncTimer, SIGNAL(timeout()), this, SLOT(timeToSync()));
-    mSyncTimer->start(mUpdateTime*1000);
+    mPolling = true;
+    schedulePoll();
 }
 
 void SyncQtOwnCloud::stop()
@@ -1152,10 +2333,28 @@ void SyncQtOwnCloud::stop()
     if( mNeedsSync && !mNotifySyncEmitted )
         emit readyToSync(this);
 
-    if(mSyncTimer)
-        mSyncTimer->stop();
-    delete mSyncTimer;
-    mSyncTimer = 0;
+    mPolling = false;
+    cancelPoll();
+}
+
+void SyncQtOwnCloud::schedulePoll()
+{
+    if( !mPolling ) {
+        return;
+    }
+    // A tenth of the interval either way spreads the accounts out, and
+    // lets their polls share wakeups
+    qint64 interval = mUpdateTime*1000;
+    mScheduler->cancel(mPollId);
+    mPollId = mScheduler->schedule(this,SLOT(pollDue(qint64)),interval,
+                                   interval/10,interval/10,
+                                   mAccountName+": poll");
+}
+
+void SyncQtOwnCloud::cancelPoll()
+{
+    mScheduler->cancel(mPollId);
+    mPollId = 0;
 }
 
 void SyncQtOwnCloud::deleteWatcher()
@@ -1167,49 +2366,130 @@ void SyncQtOwnCloud::deleteWatcher()
 
 void SyncQtOwnCloud::localDirectoryChanged(QString name)
 {
-    // Maybe this was caused by us renaming a file, just wait it out
-    while (mFileAccessBusy ) {
-        //sleep(1);
-    }
     // If it was caused by one directory being deleted, then delete it now
     // and don't scan it!
     QDir dir(name);
     if( !dir.exists() ) {
-        name = stringRemoveBasePath(name,mLocalDirectory);
-        name = mRemoteDirectory + name;
-        emit toLog(tr("Local directory was deleted: %1").arg(name));
-        deleteFromServer(stringRemoveBasePath(name,mLocalDirectory));
+        localFileRemoved(name,true);
         return;
     }
     // Since we don't want to be scanning the directories every single
     // time a file is changed (since temporary files could be the cause)
     // instead we'll add them to a list and have a separate timer
     // randomly go through them
-    QString relativeName(name);
-    relativeName = stringRemoveBasePath(relativeName,mLocalDirectory);
-    // Replace spaces because it may confuse QSet
-    relativeName.replace(" ","_sssspace_");
+    QString relativeName = SyncPath::relative(name,mLocalDirectory);
     if( !mScanDirectoriesSet.contains(relativeName) ) {
         // Add to the list
         mScanDirectoriesSet.insert(relativeName);
         mScanDirectories.enqueue(relativeName);
     }
+    scheduleLocalSync();
 }
 
 void SyncQtOwnCloud::localFileChanged(QString name)
 {
     //syncDebug() << "Checking file status: " << name;
     QFileInfo info(name);
-    name = stringRemoveBasePath(name,mLocalDirectory);
     if( info.exists() ) { // Ok, file did not get deleted
-        updateDBLocalFile(name,info.size(),
+        updateDBLocalFile(SyncPath::relative(name,mLocalDirectory),info.size(),
                         info.lastModified().toUTC().toMSecsSinceEpoch(),"file");
-    } else { // File got deleted (or moved!) I can't do anything about
-        // the moves for now. But I can delete! So do that for now :)
-        name = mRemoteDirectory + name;
+        scheduleLocalSync();
+    } else { // File got deleted (moves arrive through localFileRenamed)
+        localFileRemoved(name,false);
+    }
+}
+
+QString SyncQtOwnCloud::localDBName(QString path, bool isDir)
+{
+    // Same naming as updateDBLocalFile
+    while( path.endsWith("/") )
+        path.chop(1);
+    QString name = mRemoteDirectory + SyncPath::relative(path,mLocalDirectory);
+    return isDir ? name + "/" : name;
+}
+
+void SyncQtOwnCloud::localFileRemoved(QString path, bool isDir)
+{
+    QString name = localDBName(path,isDir);
+    // Only what was synced before can be deleted on the server. This also
+    // skips the events caused by our own deletions.
+    if( !mLocalTree.contains(name) ) {
+        return;
+    }
+    if( isDir ) {
+        emit toLog(tr("Local directory was deleted: %1").arg(name));
+    } else {
         emit toLog(tr("Local file was deleted: %1").arg(name));
-        deleteFromServer(stringRemoveBasePath(name,mLocalDirectory));
     }
+    deleteFromServer(name);
+}
+
+void SyncQtOwnCloud::localFileRenamed(QString from, QString to, bool isDir)
+{
+    QString fromName = localDBName(from,isDir);
+    QString toName = localDBName(to,isDir);
+    bool filtered = isFileFiltered(QFileInfo(to).fileName());
+
+    // Only a rename of something the server already has can be a MOVE.
+    // Anything else is the old name going away and a new one showing up.
+    if( !mLocalTree.contains(fromName) || mBusy || filtered ) {
+        localFileRemoved(from,isDir);
+        if( filtered ) {
+            return;
+        } else if( isDir ) {
+            localDirectoryChanged(QFileInfo(to).absolutePath());
+        } else {
+            localFileChanged(to);
+        }
+        return;
+    }
+
+    emit toLog(tr("Local rename: %1 to %2").arg(fromName).arg(toName));
+    mDB.transaction();
+    // Whatever the rename replaced is gone, along with its rows
+    dropSubtreeFromDB(toName);
+    if( isDir ) {
+        mLocalTree.removeSubtree(toName);
+    }
+    mLocalTree.remove(toName);
+    mPaths->rename(fromName,toName);
+    renameInDB("local_files",fromName,toName);
+    renameInDB("local_files_processing",fromName,toName);
+    mLocalTree.moveSubtree(fromName,toName);
+    mDB.commit();
+
+    // The server side follows once the server confirms
+    mPendingMoves++;
+    mWebdav->move(fromName,toName);
+}
+
+void SyncQtOwnCloud::serverMoveFinished(QString from, QString to, bool success)
+{
+    mPendingMoves--;
+    mDB.transaction();
+    if( success ) {
+        renameInDB("server_files",from,to);
+        emit toLog(tr("Renamed on server: %1 to %2").arg(from).arg(to));
+    } else {
+        // Fall back to deleting the old name, and uploading the new one
+        emit toLog(tr("Could not rename %1 on server, it will be uploaded "
+                      "again").arg(from));
+        mWebdav->deleteFile(from);
+        QSqlQuery drop(QSqlDatabase::database(mAccountName));
+        drop.exec("DELETE FROM server_files WHERE "+nameCondition(from)+";");
+    }
+    mDB.commit();
+    mNeedsSync = true;
+}
+
+void SyncQtOwnCloud::localWatchOverflow()
+{
+    // Changes were lost, and only a full scan can tell which
+    emit toLog(tr("Too many local changes at once, %1 will rescan")
+               .arg(mAccountName));
+    mIsFirstRun = true;
+    mForceFullScan = true;
+    mNeedsSync = true;
 }
 
 void SyncQtOwnCloud::scanLocalDirectoryForNewFiles(QString path)
@@ -1248,12 +2528,33 @@ void SyncQtOwnCloud::scanLocalDirectoryForNewFiles(QString path)
     }
 }
 
+void SyncQtOwnCloud::configureDB()
+{
+    // Write-ahead logging keeps commits cheap and lets readers continue
+    // while we write. NORMAL synchronous is durable across application
+    // crashes, and only fsyncs the log at checkpoints.
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec("PRAGMA journal_mode=WAL;");
+    if( !query.next() || query.value(0).toString().toLower() != "wal" ) {
+        syncDebug() << "Could not switch database to WAL mode: "
+                    << mDBFileName;
+    }
+    query.exec("PRAGMA synchronous=NORMAL;");
+    query.exec("PRAGMA temp_store=MEMORY;");
+    query.exec("PRAGMA cache_size=-16384;");     // 16 MB of page cache
+    query.exec("PRAGMA mmap_size=268435456;");   // Map up to 256 MB
+    query.exec("PRAGMA wal_autocheckpoint=1000;");
+}
+
 void SyncQtOwnCloud::saveDBToFile()
 {
-    if( sqlite3_util::sqliteDBMemFile( mDB, mDBFileName, true ) ) {
-        syncDebug() << "Successfully saved DB to file!";
+    // Everything is already on disk, just fold the log back into the
+    // database without blocking anybody.
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    if( query.exec("PRAGMA wal_checkpoint(PASSIVE);") ) {
+        syncDebug() << "Successfully checkpointed DB!";
     } else {
-        syncDebug() << "Failed to save DB to file!";
+        syncDebug() << "Failed to checkpoint DB!" << query.lastError().text();
     }
 
     QKeychain::WritePasswordJob passwdJob(_OCS_APP_NAME);
@@ -1270,17 +2571,9 @@ void SyncQtOwnCloud::saveDBToFile()
     }
 }
 
-void SyncQtOwnCloud::loadDBFromFile()
-{
-    if( sqlite3_util::sqliteDBMemFile( mDB, mDBFileName, false ) ) {
-        syncDebug() << "Successfully loaded DB from file!";
-    } else {
-        syncDebug() << "Failed to load DB from file!";
-    }
-}
-
 void SyncQtOwnCloud::deleteRemovedFiles()
 {
+    SYNC_TRACE_SCOPE("SyncQtOwnCloud::deleteRemovedFiles");
     QStringList localCopy;
     QStringList serverCopy;
     // Any file that has not been found will be deleted!
@@ -1334,9 +2627,10 @@ void SyncQtOwnCloud::deleteRemovedFiles()
     //syncDebug() << "Looking for local files to delete!";
     QSqlQuery server(QSqlDatabase::database(mAccountName));
     QSqlQuery serverFound(QSqlDatabase::database(mAccountName));
+    QString scope = mPartialPass ? " AND "+mListedScope : QString();
     // First delete the files
-    // First delete the files
-    server.exec("SELECT file_name from server_files WHERE file_type='file';");
+    server.exec(QString("SELECT file_name from server_files WHERE "
+                        "file_type='file'%1;").arg(scope));
     while(server.next()) {
         serverFound.exec(QString("SELECT file_name from "
                                 "server_files_processing WHERE "
@@ -1356,8 +2650,8 @@ void SyncQtOwnCloud::deleteRemovedFiles()
     }
 
     // Then delete the collections
-    server.exec("SELECT file_name from server_files WHERE "
-               "file_type='collection';");
+    server.exec(QString("SELECT file_name from server_files WHERE "
+                        "file_type='collection'%1;").arg(scope));
     while(server.next()) {
         serverFound.exec(QString("SELECT file_name from "
                                 "server_files_processing WHERE "
@@ -1387,24 +2681,62 @@ void SyncQtOwnCloud::deleteRemovedFiles()
 
 void SyncQtOwnCloud::deleteFromLocal(QString name, bool isDir)
 {
-    // Remove the watcher before deleting.
-    QString localName = stringRemoveBasePath(name,mRemoteDirectory);
-    mFileWatcher->removePath(mLocalDirectory+localName);
-    if(!isDir) {
-        if( !QFile::remove(mLocalDirectory+localName ) ) {
-            syncDebug() << "File deletion failed: " << mLocalDirectory+localName;
-            return;
+    // The watcher reports our own deletions too, but by then we have
+    // forgotten about the file, so they are ignored.
+    // The database forgets the entry once the I/O service is done with it
+    QString localName = SyncPath::relative(name,mRemoteDirectory);
+    PendingIO io;
+    io.name = name;
+    io.path = mLocalDirectory+localName;
+    if( mDryRun ) {
+        if( !isDir || !mLocalTree.isSubtreeDirty(name) ) {
+            mPlan->add(SyncPlanReport::DELETE_LOCAL,name);
         }
-        emit toLog(tr("Deleted local file: %1").arg(name));
+        return;
+    }
+    if(!isDir) {
+        io.operation = "delete_local";
+        mPendingIO.insert(mIO->remove(io.path),io);
     } else {
-        QDir dir;
-        if( !dir.rmdir(mLocalDirectory+localName) ) {
-            syncDebug() << "Directory deletion failed: "
+        // Never throw away local changes that have not been uploaded yet
+        if( mLocalTree.isSubtreeDirty(name) ) {
+            syncDebug() << "Directory has unsynced changes, keeping: "
                         << mLocalDirectory+localName;
             return;
         }
+
+        // Remove what we know lives below it, deepest entries first, so
+        // the directory itself can go. Anything we never synced stays
+        // and makes the final rmdir fail.
+        QStringList children = mLocalTree.enumerate(name);
+        QStringList paths;
+        children.sort();
+        for( int i = children.size()-1; i >= 0; i-- ) {
+            if( children[i] == name )
+                continue;
+            QString child = mLocalDirectory +
+                    SyncPath::relative(children[i],mRemoteDirectory);
+            if( children[i].endsWith("/") ) {
+                mFileWatcher->removeDirectory(child);
+            }
+            paths.append(child);
+        }
+        mFileWatcher->removeDirectory(io.path);
+        io.operation = "delete_local_dir";
+        mPendingIO.insert(mIO->removeTree(io.path,paths),io);
+    }
+}
+
+void SyncQtOwnCloud::localDeleteDone(QString name, bool isDir)
+{
+    if(!isDir) {
+        emit toLog(tr("Deleted local file: %1").arg(name));
+    } else {
         emit toLog(tr("Deleted local directory: %1").arg(name));
+        dropSubtreeFromDB(name);
+        mLocalTree.removeSubtree(name);
     }
+    mLocalTree.remove(name);
     dropFromDB("local_files","file_name",name);
     dropFromDB("server_files","file_name",name);
     dropFromDB("local_files_processing","file_name",name);
@@ -1413,9 +2745,18 @@ void SyncQtOwnCloud::deleteFromLocal(QString name, bool isDir)
 
 void SyncQtOwnCloud::deleteFromServer(QString name)
 {
+    if( mDryRun ) {
+        mPlan->add(SyncPlanReport::DELETE_SERVER,name);
+        return;
+    }
     // Delete from server
     mWebdav->deleteFile(name);
     emit toLog(tr("Deleting from server: %1").arg(name));
+    if( name.endsWith("/") ) { // Everything below it is gone too
+        dropSubtreeFromDB(name);
+        mLocalTree.removeSubtree(name);
+    }
+    mLocalTree.remove(name);
     dropFromDB("server_files","file_name",name);
     dropFromDB("local_files","file_name",name);
     dropFromDB("server_files_processing","file_name",name);
@@ -1428,33 +2769,110 @@ void SyncQtOwnCloud::dropFromDB(QString table, QString column, QString condition
     drop.exec("DELETE FROM "+table+" WHERE "+column+"='"+condition+"';");
 }
 
+QString SyncQtOwnCloud::nameCondition(QString name)
+{
+    // The name itself, and for a collection everything below it
+    if( name.endsWith("/") ) {
+        return QString("substr(file_name,1,%1)='%2'").arg(name.size())
+                .arg(name);
+    }
+    return QString("file_name='%1'").arg(name);
+}
+
+void SyncQtOwnCloud::renameInDB(QString table, QString from, QString to)
+{
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec(QString("UPDATE %1 SET file_name='%2'||substr(file_name,%3) "
+                       "WHERE %4;").arg(table).arg(to).arg(from.size()+1)
+               .arg(nameCondition(from)));
+}
+
+void SyncQtOwnCloud::dropSubtreeFromDB(QString name)
+{
+    qint64 id = mPaths->id(name,false);
+    if( id <= 0 ) {
+        return;
+    }
+    // One indexed statement per table for the whole directory
+    QString subtree = mPaths->subtreeQuery(id);
+    QSqlQuery drop(QSqlDatabase::database(mAccountName));
+    drop.exec(QString("DELETE FROM local_files WHERE path_id IN (%1);")
+              .arg(subtree));
+    drop.exec(QString("DELETE FROM server_files WHERE path_id IN (%1);")
+              .arg(subtree));
+    drop.exec(QString("DELETE FROM local_files_processing WHERE path_id IN "
+                      "(%1);").arg(subtree));
+    drop.exec(QString("DELETE FROM server_files_processing WHERE path_id IN "
+                      "(%1);").arg(subtree));
+    mPaths->removeSubtree(id);
+}
+
+void SyncQtOwnCloud::loadLocalTree()
+{
+    mLocalTree.clear();
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec("SELECT file_name FROM local_files;");
+    while(query.next()) {
+        mLocalTree.insert(query.value(0).toString());
+    }
+}
+
+void SyncQtOwnCloud::forgetFilteredFiles()
+{
+    // Files that a new filter now hides would otherwise look deleted on
+    // the next pass (and get removed on the other side). Forget about them
+    // instead, and leave the actual files alone. Whole directories go in a
+    // single step.
+    mFiltersChanged = false;
+    QStringList known = mLocalTree.enumerate("");
+    known.sort();
+    QString skipped;
+    for( int i = 0; i < known.size(); i++ ) {
+        QString name = known[i];
+        if( !skipped.isEmpty() && name.startsWith(skipped) ) {
+            continue;
+        }
+        if( !isFileFiltered(SyncPath::relative(name,mRemoteDirectory)) ) {
+            continue;
+        }
+        syncDebug() << "Filtered, no longer tracking: " << name;
+        if( name.endsWith("/") ) {
+            dropSubtreeFromDB(name);
+            mLocalTree.removeSubtree(name);
+            skipped = name;
+        }
+        mLocalTree.remove(name);
+        dropFromDB("local_files","file_name",name);
+        dropFromDB("server_files","file_name",name);
+        dropFromDB("local_files_processing","file_name",name);
+        dropFromDB("server_files_processing","file_name",name);
+    }
+}
+
 void SyncQtOwnCloud::processFileConflict(QString name, QString wins)
 {
-    QString localName = stringRemoveBasePath(name,mRemoteDirectory);
+    QString localName = SyncPath::relative(name,mRemoteDirectory);
     if( wins == "local" ) {
         QFileInfo info(mLocalDirectory+localName);
-        QFile::remove(mLocalDirectory+getConflictName(localName));
-        mUploadingConflictFiles.enqueue(FileInfo(name,info.size()));
-        mUploadingConflictFilesSet.insert(name.replace(" ","_sssspace_"));
+        PendingIO io;
+        io.operation = "conflict_local";
+        io.name = name;
+        io.path = mLocalDirectory+getConflictName(localName);
+        mPendingIO.insert(mIO->remove(io.path),io);
+        enqueueOperation("upload_conflict",FileInfo(name,info.size()));
+        mUploadingConflictFilesSet.insert(name);
     } else {
-        // Stop watching the old file, since it will get removed
-        mFileWatcher->removePath(mLocalDirectory+localName);
+        // Stop watching the old file, since it will get replaced. The
+        // server's copy is moved over it in one step.
+        mFileWatcher->ignore(mLocalDirectory+localName);
         QFileInfo info(mLocalDirectory+getConflictName(localName));
-        qint64 last = info.lastModified().toMSecsSinceEpoch();
-        QFile::remove(mLocalDirectory+localName);
-        QFile::rename(mLocalDirectory+getConflictName(localName),
-                      mLocalDirectory+localName);
-        QSqlQuery query(QSqlDatabase::database(mAccountName));
-        QString statement = QString("UPDATE local_files SET last_sync='%1'"
-                                  "WHERE file_name='%2';").arg(last).arg(name);
-        query.exec(statement);
-        statement = QString("UPDATE local_files_processing SET last_sync='%1'"
-                                  "WHERE file_name='%2';").arg(last).arg(name);
-        query.exec(statement);
-
-        // Add back to the watcher
-        mFileWatcher->addPath(mLocalDirectory+localName);
-        clearFileConflict(name);
+        PendingIO io;
+        io.operation = "conflict_server";
+        io.name = name;
+        io.path = mLocalDirectory+localName;
+        io.lastModified = info.lastModified().toMSecsSinceEpoch();
+        mPendingIO.insert(mIO->rename(mLocalDirectory+
+                                      getConflictName(localName),io.path),io);
     }
 }
 
@@ -1480,24 +2898,29 @@ void SyncQtOwnCloud::clearFileConflict(QString name)
 
 QString SyncQtOwnCloud::getConflictName(QString name)
 {
-    QFileInfo info(name);
-    return QString(info.absolutePath()+
-                   "/_ocs_serverconflict."+info.fileName());
+    return SyncPath::join(SyncPath::parent(name),
+                          "_ocs_serverconflict."+SyncPath::fileName(name));
 }
 
 void SyncQtOwnCloud::initialize(QString host, QString user, QString pass,
                               QString remote, QString local, qint64 time)
 {
-    mHost = stringRemoveBasePath(host,"/files/webdav.php");
-    QRegExp reg("/*$");
-    mHost.replace(reg,""); // Get rid of trailing /'s
-    reg = QRegExp("/.*$");
+    mStateLock.lock();
+    mHost = host;
+    while( mHost.endsWith('/') ) { // Get rid of trailing /'s
+        mHost.chop(1);
+    }
+    // Whoever pasted the whole WebDAV address gets it added back below
+    QString dav("/files/webdav.php");
+    if( mHost.endsWith(dav) ) {
+        mHost.chop(dav.size());
+    }
     QString subDir = mHost;
     subDir.replace("http://","");
     subDir.replace("https://","");
-    int pos = reg.indexIn(subDir);
-    if( pos >-1 ) { // Found a match
-        subDir = reg.cap(0);
+    int pos = subDir.indexOf('/');
+    if( pos >-1 ) { // Installed below the server's root
+        subDir = subDir.mid(pos);
     } else {
         subDir = "";
     }
@@ -1506,6 +2929,7 @@ void SyncQtOwnCloud::initialize(QString host, QString user, QString pass,
     mRemoteDirectory = remote;
     mLocalDirectory = local;
     mUpdateTime = time;
+    mStateLock.unlock();
     // Initialize WebDAV
     mWebdav->initialize(mHost+"/files/webdav.php",
                         mUsername,mPassword,subDir+"/files/webdav.php");
@@ -1518,23 +2942,33 @@ void SyncQtOwnCloud::initialize(QString host, QString user, QString pass,
 
     // Create a File System Watcher
     delete mFileWatcher;
-    mFileWatcher = new QFileSystemWatcher(this);
+    mFileWatcher = new SyncDirWatcher(this);
     connect(mFileWatcher,SIGNAL(fileChanged(QString)),
-            this, SLOT(localFileChanged(QString)));
+            mCoalescer, SLOT(slotFileChanged(QString)));
     connect(mFileWatcher,SIGNAL(directoryChanged(QString)),
-            this, SLOT(localDirectoryChanged(QString)));
-
-    mFileWatcher->addPath(mLocalDirectory+"/");
+            mCoalescer, SLOT(slotDirectoryChanged(QString)));
+    connect(mFileWatcher,SIGNAL(removed(QString,bool)),
+            mCoalescer, SLOT(slotRemoved(QString,bool)));
+    connect(mFileWatcher,SIGNAL(renamed(QString,QString,bool)),
+            mCoalescer, SLOT(slotRenamed(QString,QString,bool)));
+    connect(mFileWatcher,SIGNAL(overflow()),
+            this, SLOT(localWatchOverflow()));
+
+    mFileWatcher->addDirectory(mLocalDirectory);
     saveConfigToDB();
     saveDBToFile();
     mSettingsCheck = true;
     mWebdav->dirList(remote+"/");
+    mStateLock.lock();
     mSyncPosition = CHECKSETTINGS;
+    mStateLock.unlock();
+    mMetrics->enterPhase(mSyncPosition);
     restartRequestTimer();
 }
 
 QStringList SyncQtOwnCloud::getFilterList()
 {
+    QMutexLocker locker(&mStateLock);
     QStringList list;
     QList<QString> filters = mFilters.toList();
     for( int i = 0; i < filters.size(); i++ ) {
@@ -1554,51 +2988,55 @@ bool SyncQtOwnCloud::isFileFiltered(QString name)
         //syncDebug() << "File: " +name+" ignored by " + mAccountName;
         return true;
     }
-    QList<QString> list = mFilters.toList();
-    list.append( mGlobalFilters->toList() );
-
-    // Else, look through the filters and see if this file is excluded
-    for( int i = 0; i < list.size(); i++ ) {
-        QString filter = list[i];
-        if(filter.contains("*")) { // Must build general expression
-            filter.replace("?","\\\?");
-            filter.replace(".","\\\.");
-            filter.replace("*",".*");
-            QRegExp reg(filter);
-            if( name.contains(reg) ) {
-                //syncDebug() << "File: " +name+" ignored by " + mAccountName + " because of " + filter;
-                return true;
-            }
 
-        } else if( name.contains(filter) ) {
-            //syncDebug() << "File: " +name+" ignored by " + mAccountName + " because of " + filter;
-            return true;
-        }
-    }
-    return false;
+    // Else, see if any of the (precompiled) filters excludes this file
+    return mFilterMatcher.matches(name);
 }
 
 void SyncQtOwnCloud::deleteAccount()
 {
     // Stop all transfer processes
     mHardStop = true;
+    mLocalScanner->cancel();
 
-    // Stop and delete the timer
-    if(mSyncTimer) {
-        mSyncTimer->stop();
-    }
+    // Drop everything still scheduled for this account
+    mPolling = false;
+    mScheduler->cancelAll(this);
+    releaseConnection();
+    releaseDisk();
+    mBudget->forget(this);
 
-    // Delete the database
+    // Delete the database (and its write-ahead log)
     mDB.close();
     QFile dbFile(mDBFileName);
     dbFile.remove();
+    QFile::remove(mDBFileName+"-wal");
+    QFile::remove(mDBFileName+"-shm");
 }
 
-void SyncQtOwnCloud::requestTimedout()
+void SyncQtOwnCloud::requestTimedout(qint64 id)
 {
+    // The deadline may have been moved or stopped while this call was
+    // on its way here. Only the current one aborts the pass.
+    if( id != mRequestId ) {
+        return;
+    }
     //emit toLog(tr("The request timed out"));
+    releaseConnection();
+    mStateLock.lock();
     mBusy = false;
+    mStateLock.unlock();
     start();
+    mLoopMonitor->stop();
+    mProgress->finish(this);
+    saveMetrics(true);
+    if( mDryRun ) {
+        mDryRun = false;
+        delete mPlan;
+        mPlan = 0;
+        emit toLog(tr("Planning the sync of %1 did not finish")
+                   .arg(mAccountName));
+    }
     emit toLog(tr("Sync timedout %1: %2").arg(mAccountName)
                             .arg(QDateTime::currentDateTime().toString()));
     emit finishedSync(this);
@@ -1608,12 +3046,17 @@ void SyncQtOwnCloud::requestTimedout()
 
 void SyncQtOwnCloud::restartRequestTimer()
 {
-    mRequestTimer->start(7000);
+    mScheduler->cancel(mRequestId);
+    mRequestTimerRestarted = QDateTime::currentMSecsSinceEpoch();
+    mRequestId = mScheduler->schedule(this,SLOT(requestTimedout(qint64)),
+                                      _OCS_REQUEST_TIMEOUT,1000,0,
+                                      mAccountName+": request deadline");
 }
 
 void SyncQtOwnCloud::stopRequestTimer()
 {
-    mRequestTimer->stop();
+    mScheduler->cancel(mRequestId);
+    mRequestId = 0;
 }
 
 bool SyncQtOwnCloud::needsSync()
@@ -1624,17 +3067,10 @@ bool SyncQtOwnCloud::needsSync()
     return mNeedsSync;
 }
 
-QString SyncQtOwnCloud::stringRemoveBasePath(QString path, QString base)
-{
-    if( base != "/" )  {
-        path.replace(QRegExp("^"+base),"");
-    }
-    return path;
-}
-
 void SyncQtOwnCloud::serverDirectoryCreated(QString name)
 {
     emit toLog(tr("Created directory on server: %1").arg(name));
+    journalDone("mkdir",name);
     processNextStep();
 }
 
@@ -1650,8 +3086,8 @@ void SyncQtOwnCloud::copyLocalProcessing(QString fileName)
                    .arg(fileName));
         query.exec(QString("INSERT INTO local_files (file_name,"
                            "file_size,file_type,last_modified,last_sync,"
-                           "prev_modified,conflict) "
-                           "values('%1','%2','%3','%4','%5','%6','%7');")
+                           "prev_modified,conflict,path_id) "
+                           "values('%1','%2','%3','%4','%5','%6','%7','%8');")
                    .arg(queryProcessing.value(1).toString())
                    .arg(queryProcessing.value(2).toString())
                    .arg(queryProcessing.value(3).toString())
@@ -1659,7 +3095,14 @@ void SyncQtOwnCloud::copyLocalProcessing(QString fileName)
                    .arg(queryProcessing.value(5).toString())
                    .arg(queryProcessing.value(6).toString())
                    .arg(queryProcessing.value(7).toString())
+                   .arg(queryProcessing.value(8).toString())
                    );
+        // A dry run rolls the database back afterwards, the tree has to
+        // keep matching it
+        if( !mDryRun ) {
+            mLocalTree.insert(fileName);
+            mLocalTree.setDirty(fileName,false);
+        }
     }
     queryProcessing.exec(QString("DELETE FROM local_files_processing WHERE "
                                  "file_name='%1';").arg(fileName));
@@ -1676,16 +3119,229 @@ void SyncQtOwnCloud::copyServerProcessing(QString fileName)
         query.exec(QString("DELETE FROM server_files WHERE file_name='%1';")
                    .arg(fileName));
         query.exec(QString("INSERT INTO server_files (file_name,"
-                           "file_size,file_type,last_modified,prev_modified,conflict) "
-                           "values('%1','%2','%3','%4','%5','%6');")
+                           "file_size,file_type,last_modified,prev_modified,conflict,"
+                           "path_id) "
+                           "values('%1','%2','%3','%4','%5','%6','%7');")
                    .arg(queryProcessing.value(1).toString())
                    .arg(queryProcessing.value(2).toString())
                    .arg(queryProcessing.value(3).toString())
                    .arg(queryProcessing.value(4).toString())
                    .arg(queryProcessing.value(5).toString())
                    .arg(queryProcessing.value(6).toString())
+                   .arg(queryProcessing.value(7).toString())
                    );
     }
     queryProcessing.exec(QString("DELETE FROM server_files_processing WHERE "
                                  "file_name='%1';").arg(fileName));
 }
+
+void SyncQtOwnCloud::enqueueOperation(QString operation, FileInfo info)
+{
+    if( mDryRun ) {
+        if( operation == "upload" || operation == "upload_conflict" ) {
+            mPlan->add(SyncPlanReport::UPLOAD,info.name,info.size);
+        } else if ( operation == "download" ) {
+            mPlan->add(SyncPlanReport::DOWNLOAD,info.name,info.size);
+        } else if ( operation == "download_conflict" ) {
+            mPlan->add(SyncPlanReport::CONFLICT,info.name,info.size);
+        } else if ( operation == "mkdir" ) {
+            mPlan->add(SyncPlanReport::MKDIR_SERVER,info.name);
+        }
+        return;
+    }
+    int queue = planQueue(operation);
+    if( queue < 0 ) {
+        syncDebug() << "Unknown operation " << operation << " for "
+                    << info.name;
+        return;
+    }
+
+    // The plan itself lives in the journal, fillPlan() brings it into
+    // memory a window at a time. Never plan the same operation twice for
+    // one file while the first one is still pending.
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec(QString("INSERT INTO journal (operation,file_name,file_size,"
+                       "done) SELECT '%1','%2','%3','' WHERE NOT EXISTS "
+                       "(SELECT 1 FROM journal WHERE operation='%1' AND "
+                       "file_name='%2' AND done='');")
+               .arg(operation).arg(info.name).arg(info.size));
+    if( query.numRowsAffected() != 1 ) {
+        return;
+    }
+    mPlanUnloaded[queue]++;
+}
+
+SyncQtOwnCloud::FileInfo SyncQtOwnCloud::dequeueOperation(
+        QQueue<FileInfo> &queue)
+{
+    FileInfo info = queue.dequeue();
+    mPlanBytes -= sizeof(FileInfo) + SyncResourceReport::stringBytes(info.name);
+    return info;
+}
+
+int SyncQtOwnCloud::planQueue(const QString &operation)
+{
+    for( int i = 0; i < PLANQUEUES; i++ ) {
+        if( operation == planOperation(i) ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *SyncQtOwnCloud::planOperation(int queue)
+{
+    switch(queue) {
+    case PLANMKDIR: return "mkdir";
+    case PLANDOWNLOAD: return "download";
+    case PLANUPLOAD: return "upload";
+    case PLANUPLOADCONFLICT: return "upload_conflict";
+    case PLANDOWNLOADCONFLICT: return "download_conflict";
+    default: return "";
+    }
+}
+
+int SyncQtOwnCloud::planLoaded(int queue) const
+{
+    switch(queue) {
+    case PLANMKDIR: return mMakeServerDirs.size();
+    case PLANDOWNLOAD: return mDownloadingFiles.size();
+    case PLANUPLOAD: return mUploadingFiles.size();
+    case PLANUPLOADCONFLICT: return mUploadingConflictFiles.size();
+    case PLANDOWNLOADCONFLICT: return mDownloadConflict.size();
+    default: return 0;
+    }
+}
+
+bool SyncQtOwnCloud::planPending() const
+{
+    for( int i = 0; i < PLANQUEUES; i++ ) {
+        if( mPlanUnloaded[i] > 0 || planLoaded(i) > 0 ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SyncQtOwnCloud::fillPlan()
+{
+    // Queues are topped up in the order startNextOperation() works them
+    // off, for as long as the budget allows. A queue that ran dry always
+    // gets a window, so a small budget slows the pass but never stalls it.
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    for( int i = 0; i < PLANQUEUES; i++ ) {
+        bool dry = planLoaded(i) == 0;
+        while( mPlanUnloaded[i] > 0 && (dry || mPlanBytes < mPlanMemory) ) {
+            query.exec(QString("SELECT id,file_name,file_size FROM journal "
+                               "WHERE operation='%1' AND done='' AND id>%2 "
+                               "ORDER BY id LIMIT %3;")
+                       .arg(planOperation(i)).arg(mPlanCursor[i])
+                       .arg(_OCS_PLAN_WINDOW));
+            int rows = 0;
+            while( query.next() ) {
+                rows++;
+                mPlanCursor[i] = query.value(0).toLongLong();
+                mPlanUnloaded[i]--;
+                FileInfo info(query.value(1).toString(),
+                              query.value(2).toString().toLongLong());
+                mPlanBytes += SyncResourceReport::stringBytes(info.name);
+                if( i != PLANMKDIR ) {
+                    mPlanBytes += sizeof(FileInfo);
+                }
+                switch(i) {
+                case PLANMKDIR:
+                    mMakeServerDirs.enqueue(info.name);
+                    break;
+                case PLANDOWNLOAD:
+                    mDownloadingFiles.enqueue(info);
+                    break;
+                case PLANUPLOAD:
+                    mUploadingFiles.enqueue(info);
+                    break;
+                case PLANUPLOADCONFLICT:
+                    mUploadingConflictFiles.enqueue(info);
+                    break;
+                case PLANDOWNLOADCONFLICT:
+                    mDownloadConflict.enqueue(info);
+                    break;
+                }
+            }
+            if( rows == 0 ) { // The rest was already taken care of
+                mPlanUnloaded[i] = 0;
+            }
+            dry = false;
+        }
+    }
+}
+
+void SyncQtOwnCloud::resetPlan()
+{
+    mMakeServerDirs.clear();
+    mDownloadingFiles.clear();
+    mUploadingFiles.clear();
+    mUploadingConflictFiles.clear();
+    mDownloadConflict.clear();
+    mPlanBytes = 0;
+    for( int i = 0; i < PLANQUEUES; i++ ) {
+        mPlanCursor[i] = 0;
+        mPlanUnloaded[i] = 0;
+    }
+}
+
+void SyncQtOwnCloud::setPlanMemory(qint64 kilobytes)
+{
+    mPlanMemory = kilobytes*1024;
+}
+
+void SyncQtOwnCloud::journalDone(QString operation, QString name)
+{
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec(QString("UPDATE journal SET done='yes' WHERE file_name='%1' "
+                       "AND operation='%2';").arg(name).arg(operation));
+}
+
+void SyncQtOwnCloud::journalClear()
+{
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec("DELETE FROM journal;");
+}
+
+void SyncQtOwnCloud::replayJournal()
+{
+    // Put whatever was planned but never finished straight back into the
+    // transfer queues. The next sync resumes at the TRANSFER step and only
+    // afterwards verifies the tree again.
+    // Only the counts are read here, fillPlan() loads the rows as the
+    // transfers get to them.
+    resetPlan();
+    QSqlQuery query(QSqlDatabase::database(mAccountName));
+    query.exec("SELECT operation,count(*),sum(file_size) FROM journal "
+               "WHERE done='' GROUP BY operation;");
+    int replayed = 0;
+    while( query.next() ) {
+        int queue = planQueue(query.value(0).toString());
+        if( queue < 0 ) {
+            continue;
+        }
+        mPlanUnloaded[queue] = query.value(1).toLongLong();
+        if( queue == PLANDOWNLOAD || queue == PLANDOWNLOADCONFLICT ) {
+            mTotalToDownload += query.value(2).toLongLong();
+        } else if ( queue == PLANUPLOAD || queue == PLANUPLOADCONFLICT ) {
+            mTotalToUpload += query.value(2).toLongLong();
+        }
+        replayed += query.value(1).toInt();
+    }
+    query.exec("SELECT file_name FROM journal WHERE done='' AND "
+               "operation='upload_conflict';");
+    while( query.next() ) {
+        mUploadingConflictFilesSet.insert(query.value(0).toString());
+    }
+    mTotalToTransfer = mTotalToDownload+mTotalToUpload;
+
+    if( replayed > 0 ) {
+        syncDebug() << "Replaying " << replayed << " pending operations for "
+                    << mAccountName;
+        mLastSyncAborted = TRANSFER;
+        mNeedsSync = true;
+    }
+}
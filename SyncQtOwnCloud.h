@@ -29,11 +29,25 @@
 #include <QIcon>
 #include <QSet>
 #include <QSqlQuery>
+#include <QMutex>
+#include "SyncPathTree.h"
+#include "SyncFilterMatcher.h"
+#include "SyncLocalScanner.h"
+#include "SyncIOService.h"
 
 class QTimer;
-class QFileSystemWatcher;
+class SyncDirWatcher;
+class SyncEventCoalescer;
+class SyncScheduler;
+class SyncBudget;
+class SyncProgress;
+class SyncLoopMonitor;
 class QNetworkReply;
 class OwnPasswordManager;
+class SyncPathTable;
+class SyncPlanReport;
+class SyncMetrics;
+class SyncResourceReport;
 
 class SyncQtOwnCloud : public QObject
 {
@@ -41,10 +55,10 @@ class SyncQtOwnCloud : public QObject
 
 public:
     explicit SyncQtOwnCloud(QString name,
-                            QSet<QString> *globalFilters,QString configDir);
+                            QSet<QString> *globalFilters,QString configDir,
+                            SyncScheduler *scheduler, SyncBudget *budget,
+                            SyncProgress *progress);
     ~SyncQtOwnCloud();
-    void initialize(QString host, QString user, QString pass, QString remote,
-                    QString local, qint64 time);
 
     struct FileInfo {
         QString name;
@@ -55,6 +69,15 @@ public:
         }
     };
 
+    struct PendingIO {
+        QString operation;
+        QString name;       // As in the database
+        QString path;       // Local path it acts on
+        qint64 size;
+        qint64 lastModified;
+        PendingIO() : size(0), lastModified(0) {}
+    };
+
     enum SyncPosition {
         SYNCFINISHED,
         CHECKSETTINGS,
@@ -63,41 +86,51 @@ public:
         TRANSFER
     };
 
-    QSqlQuery getConflicts() {
-        QSqlQuery query(QSqlDatabase::database(mAccountName));
-        query.exec("SELECT * from conflicts;");
-        return query;
+    // The transfer queues, in the order they are worked off
+    enum PlanQueue {
+        PLANMKDIR,
+        PLANDOWNLOAD,
+        PLANUPLOAD,
+        PLANUPLOADCONFLICT,
+        PLANDOWNLOADCONFLICT,
+        PLANQUEUES
     };
 
-    QString getName() { return mAccountName; }
-    QString getHost() { return mHost; }
-    QString getUserName() { return mUsername; }
-    QString getPassword() { return mPassword; }
-    QString getRemoteDirectory() { return mRemoteDirectory; }
-    QString getLocalDirectory() { return mLocalDirectory; }
-    qint64 getUpdateTime() { return mUpdateTime; }
-    bool isEnabled() { return mIsEnabled; }
+    // The getters below may be called from any thread. Everything else
+    // runs on the account's own thread, so call it through invokeMethod.
+    QList<QStringList> getConflicts();
 
-    void setEnabled(bool enabled);
-    void saveConfigToDB();
-    void processFileConflict(QString name, QString wins);
+    QString getName() { return mAccountName; }
+    QString getHost() { QMutexLocker locker(&mStateLock); return mHost; }
+    QString getUserName() { QMutexLocker locker(&mStateLock); return mUsername; }
+    QString getPassword() { QMutexLocker locker(&mStateLock); return mPassword; }
+    QString getRemoteDirectory() {
+        QMutexLocker locker(&mStateLock);
+        return mRemoteDirectory;
+    }
+    QString getLocalDirectory() {
+        QMutexLocker locker(&mStateLock);
+        return mLocalDirectory;
+    }
+    qint64 getUpdateTime() {
+        QMutexLocker locker(&mStateLock);
+        return mUpdateTime;
+    }
+    bool isEnabled() { QMutexLocker locker(&mStateLock); return mIsEnabled; }
+    bool isBusy() { QMutexLocker locker(&mStateLock); return mBusy; }
+    int filePercent() {
+        QMutexLocker locker(&mStateLock);
+        return mFilePercent;
+    }
+    int totalPercent() {
+        QMutexLocker locker(&mStateLock);
+        return mTotalPercent;
+    }
+    QString statusText();
     bool needsSync();
-    void deleteWatcher();
-    void stop();
     QString getLastSync();
     QStringList getFilterList();
-    void addFilter(QString filter);
-    void removeFilter(QString filter);
     void hardStop();
-    void deleteAccount();
-    void setSaveDBTime(qint64 seconds);
-    void pause() { mIsPaused = true; }
-    void resume() {
-        mIsPaused = false;
-        if(mSyncPosition == TRANSFER) {
-            processNextStep();
-        }
-    }
 
 private:
     bool mStorePasswordInDB;
@@ -108,11 +141,25 @@ private:
     bool mNotifySyncEmitted;
     bool mHardStop;
     QSet<QString> mFilters;
-    QSet<QString> *mGlobalFilters;
+    QStringList mGlobalFilters;
+    SyncFilterMatcher mFilterMatcher;
     QString mLastSync;
+    // Guards what the getters and statusText() read. Our own thread only
+    // writes those while holding it, and reads them without.
+    mutable QMutex mStateLock;
     QSqlDatabase mDB;
+    SyncPathTable *mPaths;
+    SyncPathTree mLocalTree;
+    SyncLocalScanner *mLocalScanner;
+    QHash<QString,SyncDirStamp> mScannedDirs;
+    bool mFullScan;
+    bool mForceFullScan;
+    qint64 mFullScanInterval;
+    bool mFiltersChanged;
     QString mDBFileName;
     QQueue<QString> mDirectoryQueue;
+    QString mCurrentListing;
+    qint64 mListingFreshness;
     QString mHomeDirectory;
     QString mRemoteDirectory;
     QString mLocalDirectory;
@@ -120,14 +167,42 @@ private:
     QString mHost;
     QString mPassword;
     QString mUsername;
-    QTimer *mSyncTimer;
-    QTimer *mSaveDBTimer;
-    QTimer *mRequestTimer;
+    SyncScheduler *mScheduler;
+    SyncBudget *mBudget;
+    SyncProgress *mProgress;
+    bool mHoldsConnection;
+    bool mHoldsDisk;
+    bool mWaitingForBudget;
+    qint64 mLastProgress;
+    int mFilePercent;
+    int mTotalPercent;
+    bool mPolling;
+    qint64 mPollId;
+    qint64 mFlushId;
+    qint64 mRequestId;
+    qint64 mRequestTimerRestarted;
+    qint64 mSettleId;
+    qint64 mSaveDBInterval;
+    qint64 mSettleStarted;
+    bool mLocalPassOnly;
+    bool mPartialPass;
+    bool mDryRun;               // Plan the pass, but touch nothing
+    SyncPlanReport *mPlan;
+    qint64 mListingStarted;
+    qint64 mTransferStarted;
+    qint64 mPassTransferBytes;
+    qint64 mPassTransferMSecs;
+    SyncMetrics *mMetrics;
+    QString mListedScope;
     QQueue<QString>  mMakeServerDirs;
     QQueue<FileInfo> mUploadingFiles;
     QQueue<FileInfo> mDownloadingFiles;
     QQueue<FileInfo> mDownloadConflict;
     QQueue<FileInfo> mUploadingConflictFiles;
+    qint64 mPlanMemory;         // Bytes the loaded part of the plan may take
+    qint64 mPlanBytes;          // Bytes it takes now
+    qint64 mPlanCursor[PLANQUEUES];    // Last journal id loaded per queue
+    qint64 mPlanUnloaded[PLANQUEUES];  // Rows still only in the journal
     qint64 mTotalToDownload;
     qint64 mTotalToUpload;
     qint64 mTotalToTransfer;
@@ -140,13 +215,18 @@ private:
     bool mBusy;
     bool mDBOpen;
     qint64 mUpdateTime;
-    QFileSystemWatcher *mFileWatcher;
+    SyncDirWatcher *mFileWatcher;
+    SyncEventCoalescer *mCoalescer;
+    SyncLoopMonitor *mLoopMonitor;
+    SyncIOService *mIO;
+    QHash<qint64,PendingIO> mPendingIO;
+    bool mWaitingForDisk;
+    int mPendingMoves;
     bool mIsFirstRun;
     bool mDownloadingConflictingFile;
     QSet<QString> mScanDirectoriesSet;
     QQueue<QString> mScanDirectories;
     QSet<QString> mUploadingConflictFilesSet;
-    bool mFileAccessBusy;
     bool mConflictsExist;
     bool mSettingsCheck;
     QString mAccountName;
@@ -157,25 +237,63 @@ private:
 
     void updateDBLocalFile(QString name,qint64 size,qint64 last,QString type);
     void scanLocalDirectory(QString dirPath);
+    void startLocalScan();
     QSqlQuery queryDBFileInfo(QString fileName, QString table);
     QSqlQuery queryDBAllFiles(QString table);
     void syncFiles();
     void upload(FileInfo fileName);
     void download(FileInfo fileName);
-    void updateDBDownload(QString fileName);
+    void updateDBDownload(QString fileName, bool conflict, qint64 size);
     void copyServerProcessing(QString fileName);
     void copyLocalProcessing(QString fileName);
     void processNextStep();
+    void startNextOperation();
+    void releaseConnection();
+    void releaseDisk();
     void createDataBase();
-    void updateDBVersion(int fromVersion);
+    void configureDB();
+    bool execSchema(const QString &statement);
+    bool createJournal();
+    bool createPlanIndex();
+    bool createListingCheckpoint();
+    bool createPathIndexes();
+    bool createScanCache();
+    bool needsFullScan();
+    SyncScanCache loadScanCache();
+    void saveScanCache();
+    void startRemoteListing();
+    void startPartialListing();
+    void scheduleLocalSync();
+    void listRemoteDirectory(QString dir);
+    void clearListingCheckpoint();
+    void enqueueOperation(QString operation, FileInfo info);
+    FileInfo dequeueOperation(QQueue<FileInfo> &queue);
+    void fillPlan();
+    void resetPlan();
+    int planLoaded(int queue) const;
+    bool planPending() const;
+    static int planQueue(const QString &operation);
+    static const char *planOperation(int queue);
+    void journalDone(QString operation, QString name);
+    void journalClear();
+    void replayJournal();
+    bool updateDBVersion(int fromVersion);
     void initialize();
     void readConfigFromDB();
     void scanLocalDirectoryForNewFiles(QString name);
     void processLocalFile(QString name);
     void deleteRemovedFiles();
     void deleteFromLocal(QString name, bool isDir);
+    void localDeleteDone(QString name, bool isDir);
     void deleteFromServer(QString name);
     void dropFromDB(QString table, QString column, QString condition );
+    void dropSubtreeFromDB(QString name);
+    QString nameCondition(QString name);
+    void renameInDB(QString table, QString from, QString to);
+    QString localDBName(QString path, bool isDir);
+    void loadLocalTree();
+    void updateFilters();
+    void forgetFilteredFiles();
     void setFileConflict(QString name, qint64 size, QString server_last,
                          QString local_last);
     void clearFileConflict(QString name);
@@ -185,9 +303,15 @@ private:
     bool isFileFiltered(QString name);
     void restartRequestTimer();
     void stopRequestTimer();
-
-    // String manipulation functions
-    QString stringRemoveBasePath(QString path, QString base);
+    void schedulePoll();
+    void cancelPoll();
+    void scheduleFlush();
+    void finishDryRun();
+    void recordTransfer(qint64 bytes);
+    void saveThroughput();
+    void saveMetrics(bool aborted);
+    void collectResources(SyncResourceReport *report);
+    bool saveResources(SyncResourceReport *report);
 
 signals:
     void toLog(QString text);
@@ -196,27 +320,68 @@ signals:
                    QSystemTrayIcon::MessageIcon icon);
     void conflictExists(SyncQtOwnCloud*);
     void conflictResolved(SyncQtOwnCloud*);
-    void progressFile(qint64 value);
-    void progressTotal(qint64 value);
     void readyToSync(SyncQtOwnCloud*);
     void finishedSync(SyncQtOwnCloud*);
+    void statusChanged(SyncQtOwnCloud*);
+    void loaded(SyncQtOwnCloud*);
+    void filterListChanged(SyncQtOwnCloud*);
 
 public slots:
+    void load();
+    void initialize(QString host, QString user, QString pass, QString remote,
+                    QString local, qint64 time);
+    void setEnabled(bool enabled);
+    void toggleEnabled();
+    void saveConfigToDB();
+    void processFileConflict(QString name, QString wins);
+    void deleteWatcher();
+    void stop();
+    void addFilter(QString filter);
+    void removeFilter(QString filter);
+    void filtersChanged();
+    void setGlobalFilters(QStringList filters);
+    void deleteAccount();
+    void setSaveDBTime(qint64 seconds);
+    void setListingFreshness(qint64 seconds);
+    void setFullScanInterval(qint64 days);
+    void setPlanMemory(qint64 kilobytes);
+    void verifyLocalTree();
+    void dryRun();
+    void dumpResources();
+    void pause() { mIsPaused = true; }
+    void resume() {
+        mIsPaused = false;
+        if(mSyncPosition == TRANSFER) {
+            processNextStep();
+        }
+    }
     void directoryListingError(QString url);
-    void processDirectoryListing(QList<QWebDAV::FileInfo> fileInfo);
+    void processDirectoryListing(QWebDAV::Listing listing);
     void processFileReady(QNetworkReply *reply,QString fileName);
     void updateDBUpload(QString fileName);
     void timeToSync();
+    void pollDue(qint64 id);
     void sync();
     void updateStatus();
     void transferProgress(qint64 current,qint64 total);
     void localFileChanged(QString name);
     void localDirectoryChanged(QString name);
+    void localFileRemoved(QString path, bool isDir);
+    void localFileRenamed(QString from, QString to, bool isDir);
+    void localWatchOverflow();
+    void serverMoveFinished(QString from, QString to, bool success);
     void saveDBToFile();
-    void loadDBFromFile();
-    void requestTimedout();
+    void flushDue(qint64 id);
+    void requestTimedout(qint64 id);
     void serverDirectoryCreated(QString name);
     void errorFileLocked(QString fileName);
+    void processLocalEntries(QVector<SyncLocalEntry> entries);
+    void processLocalDirs(QVector<SyncLocalDir> dirs);
+    void localScanFinished();
+    void ioFinished(SyncIOResult result);
+    void localSyncDue(qint64 id);
+    void connectionGranted();
+    void diskGranted();
 };
 
 #endif // OWNCLOUDSYNC_H
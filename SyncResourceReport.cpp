@@ -0,0 +1,108 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncResourceReport.h"
+#include "SyncGlobal.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QObject>
+#include <QStringList>
+
+SyncResourceReport::SyncResourceReport(QString account)
+    : mAccount(account), mTaken(QDateTime::currentMSecsSinceEpoch())
+{
+}
+
+void SyncResourceReport::add(const char *subsystem, const char *item,
+                             qint64 count, qint64 bytes)
+{
+    Row row;
+    row.subsystem = subsystem;
+    row.item = item;
+    row.count = count;
+    row.bytes = bytes;
+    mRows.append(row);
+}
+
+qint64 SyncResourceReport::bytes() const
+{
+    qint64 total = 0;
+    for( int i = 0; i < mRows.size(); i++ ) {
+        total += mRows[i].bytes;
+    }
+    return total;
+}
+
+qint64 SyncResourceReport::bytes(const char *subsystem) const
+{
+    qint64 total = 0;
+    for( int i = 0; i < mRows.size(); i++ ) {
+        if( qstrcmp(mRows[i].subsystem,subsystem) == 0 ) {
+            total += mRows[i].bytes;
+        }
+    }
+    return total;
+}
+
+QString SyncResourceReport::summary() const
+{
+    QString text = QObject::tr("Resources of %1, about %2 KB:")
+            .arg(mAccount).arg(bytes()/1024);
+    const char *subsystem = 0;
+    for( int i = 0; i < mRows.size(); i++ ) {
+        if( !subsystem || qstrcmp(subsystem,mRows[i].subsystem) != 0 ) {
+            subsystem = mRows[i].subsystem;
+            text += QString("\n  %1 (%2 KB)").arg(subsystem)
+                    .arg(bytes(subsystem)/1024);
+        }
+        text += QString("\n    %1: %2").arg(mRows[i].item,-24)
+                .arg(mRows[i].count);
+        if( mRows[i].bytes > 0 ) {
+            text += QString(", %1 KB").arg(mRows[i].bytes/1024);
+        }
+    }
+    return text;
+}
+
+QByteArray SyncResourceReport::toJson() const
+{
+    QStringList rows;
+    for( int i = 0; i < mRows.size(); i++ ) {
+        rows.append(QString("    {\"subsystem\": \"%1\", \"item\": \"%2\", "
+                            "\"count\": %3, \"bytes\": %4}")
+                    .arg(mRows[i].subsystem).arg(mRows[i].item)
+                    .arg(mRows[i].count).arg(mRows[i].bytes));
+    }
+    QString json("{\n");
+    json += QString("  \"account\": %1,\n").arg(syncJsonString(mAccount));
+    json += QString("  \"taken\": %1,\n").arg(mTaken);
+    json += QString("  \"bytes\": %1,\n").arg(bytes());
+    json += QString("  \"resources\": [\n%1\n  ]\n").arg(rows.join(",\n"));
+    json += "}\n";
+    return json.toUtf8();
+}
+
+bool SyncResourceReport::save(QString fileName) const
+{
+    QFile file(fileName);
+    if( !file.open(QIODevice::WriteOnly|QIODevice::Truncate) ) {
+        return false;
+    }
+    return file.write(toJson()) >= 0;
+}
@@ -0,0 +1,62 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCRESOURCEREPORT_H
+#define SYNCRESOURCEREPORT_H
+
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+
+/*! \brief A snapshot of what one account holds on to.
+  * Each subsystem adds its queues, tables and buffers as rows of an item
+  * count and an estimate of the heap bytes behind them. Snapshots taken
+  * over a long uptime show which structure keeps growing.
+  */
+class SyncResourceReport
+{
+public:
+    explicit SyncResourceReport(QString account);
+
+    void add(const char *subsystem, const char *item, qint64 count,
+             qint64 bytes = 0);
+
+    qint64 bytes() const;
+    qint64 bytes(const char *subsystem) const;
+    QString summary() const;
+    QByteArray toJson() const;
+    bool save(QString fileName) const;
+
+    //! Rough heap cost of a string, header and UTF-16 data
+    static qint64 stringBytes(const QString &string) {
+        return 24 + 2*qint64(string.capacity());
+    }
+
+private:
+    struct Row {
+        const char *subsystem;
+        const char *item;
+        qint64 count;
+        qint64 bytes;
+    };
+    QString mAccount;
+    qint64 mTaken;
+    QVector<Row> mRows;
+};
+
+#endif // SYNCRESOURCEREPORT_H
@@ -0,0 +1,286 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncScheduler.h"
+#include "SyncGlobal.h"
+
+#include <QTimer>
+#include <QDateTime>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QPair>
+
+// Slot width and count of the wheel. One turn covers a bit over a minute,
+// longer deadlines simply stay in their slot for more than one turn.
+#define _OCS_WHEEL_GRANULARITY 250
+#define _OCS_WHEEL_SLOTS 256
+
+SyncScheduler::SyncScheduler(QObject *parent)
+    : QObject(parent), mMutex(QMutex::Recursive), mNextId(1),
+      mNextWakeup(-1), mWakeups(0)
+{
+    mWheel.resize(_OCS_WHEEL_SLOTS);
+    mClock.start();
+    mCursor = 0;
+    mTimer = new QTimer(this);
+    mTimer->setSingleShot(true);
+    connect(mTimer,SIGNAL(timeout()),this,SLOT(tick()));
+    // qrand() is seeded per thread, and every account schedules from its
+    // own, so they would all draw the same jitter
+    mRandom = quint32(QDateTime::currentMSecsSinceEpoch()) | 1;
+}
+
+quint32 SyncScheduler::random()
+{
+    // xorshift32, called with mMutex held
+    mRandom ^= mRandom << 13;
+    mRandom ^= mRandom >> 17;
+    mRandom ^= mRandom << 5;
+    return mRandom;
+}
+
+int SyncScheduler::slotOf(qint64 time) const
+{
+    return int((time/_OCS_WHEEL_GRANULARITY)%_OCS_WHEEL_SLOTS);
+}
+
+qint64 SyncScheduler::schedule(QObject *receiver, const char *member,
+                               qint64 delay, qint64 slack, qint64 jitter,
+                               QString label)
+{
+    // SLOT() prefixes the signature with a code, invokeMethod wants the name
+    QByteArray method(member+1);
+    method = method.left(method.indexOf('('));
+
+    QMutexLocker locker(&mMutex);
+    qint64 now = mClock.elapsed();
+    qint64 due = now + qMax(qint64(0),delay);
+    if( jitter > 0 ) {
+        due += qint64(random()%quint32(qMin(jitter+1,qint64(0x7fffffff))));
+    }
+
+    Entry entry;
+    entry.receiver = receiver;
+    entry.method = method;
+    entry.label = label.isEmpty() ? QString(method) : label;
+    entry.fireAt = slack > 0 ? coalesce(due,due+slack) : due;
+    entry.passId = QByteArray(member+1).contains("(qint64)");
+
+    qint64 id = mNextId++;
+    mEntries.insert(id,entry);
+    mWheel[slotOf(entry.fireAt)].append(id);
+    if( mNextWakeup < 0 || entry.fireAt < mNextWakeup ) {
+        arm();
+    }
+    return id;
+}
+
+qint64 SyncScheduler::coalesce(qint64 earliest, qint64 latest) const
+{
+    // Ride along with the wakeup that is already planned
+    if( mNextWakeup >= earliest && mNextWakeup <= latest ) {
+        return mNextWakeup;
+    }
+    // Or with any other deadline inside the window
+    qint64 span = qMin(qint64(_OCS_WHEEL_SLOTS),
+                       latest/_OCS_WHEEL_GRANULARITY -
+                       earliest/_OCS_WHEEL_GRANULARITY + 1);
+    for( qint64 i = 0; i < span; i++ ) {
+        const QList<qint64> &slot =
+                mWheel[slotOf(earliest+i*_OCS_WHEEL_GRANULARITY)];
+        for( int j = 0; j < slot.size(); j++ ) {
+            QHash<qint64,Entry>::const_iterator it = mEntries.constFind(slot[j]);
+            if( it != mEntries.constEnd() && it.value().fireAt >= earliest &&
+                    it.value().fireAt <= latest ) {
+                return it.value().fireAt;
+            }
+        }
+    }
+    // Otherwise round down onto a coarse boundary, so unrelated deadlines
+    // with similar slack still tend to land on the same instant
+    qint64 grain = _OCS_WHEEL_GRANULARITY;
+    while( grain*2 <= latest-earliest ) {
+        grain *= 2;
+    }
+    return qMax(earliest,(latest/grain)*grain);
+}
+
+void SyncScheduler::cancel(qint64 id)
+{
+    // The slot keeps the id until it comes around, then drops it
+    QMutexLocker locker(&mMutex);
+    QHash<qint64,Entry>::iterator it = mEntries.find(id);
+    if( it == mEntries.end() ) {
+        return;
+    }
+    bool armed = it.value().fireAt == mNextWakeup;
+    mEntries.erase(it);
+    if( armed ) {
+        arm(); // Don't wake up for nothing
+    }
+}
+
+void SyncScheduler::cancelAll(QObject *receiver)
+{
+    QMutexLocker locker(&mMutex);
+    QList<qint64> ids;
+    QHash<qint64,Entry>::const_iterator it;
+    for( it = mEntries.constBegin(); it != mEntries.constEnd(); ++it ) {
+        if( it.value().receiver == receiver ) {
+            ids.append(it.key());
+        }
+    }
+    for( int i = 0; i < ids.size(); i++ ) {
+        cancel(ids[i]);
+    }
+}
+
+qint64 SyncScheduler::earliest() const
+{
+    // Walk the wheel from the cursor, the first slot holding something for
+    // this turn has the earliest deadline
+    qint64 base = mCursor*_OCS_WHEEL_GRANULARITY;
+    for( int i = 0; i < _OCS_WHEEL_SLOTS; i++ ) {
+        qint64 slotEnd = base + (i+1)*_OCS_WHEEL_GRANULARITY;
+        const QList<qint64> &slot = mWheel[slotOf(base+i*_OCS_WHEEL_GRANULARITY)];
+        qint64 found = -1;
+        for( int j = 0; j < slot.size(); j++ ) {
+            QHash<qint64,Entry>::const_iterator it = mEntries.constFind(slot[j]);
+            if( it != mEntries.constEnd() && it.value().fireAt < slotEnd &&
+                    (found < 0 || it.value().fireAt < found) ) {
+                found = it.value().fireAt;
+            }
+        }
+        if( found >= 0 ) {
+            return found;
+        }
+    }
+    // Nothing within one turn, so look at everything
+    qint64 found = -1;
+    QHash<qint64,Entry>::const_iterator it;
+    for( it = mEntries.constBegin(); it != mEntries.constEnd(); ++it ) {
+        if( found < 0 || it.value().fireAt < found ) {
+            found = it.value().fireAt;
+        }
+    }
+    return found;
+}
+
+bool SyncScheduler::isScheduled(qint64 id) const
+{
+    QMutexLocker locker(&mMutex);
+    return mEntries.contains(id);
+}
+
+qint64 SyncScheduler::wakeups() const
+{
+    QMutexLocker locker(&mMutex);
+    return mWakeups;
+}
+
+void SyncScheduler::arm()
+{
+    // The timer belongs to our thread. From any other one the call is
+    // queued, and since that happens under the lock the last one posted is
+    // also the one that saw the latest entries.
+    mNextWakeup = earliest();
+    if( mNextWakeup < 0 ) {
+        QMetaObject::invokeMethod(mTimer,"stop");
+        return;
+    }
+    QMetaObject::invokeMethod(mTimer,"start",Q_ARG(int,
+                    int(qMax(qint64(0),mNextWakeup-mClock.elapsed()))));
+}
+
+void SyncScheduler::tick()
+{
+    QMutexLocker locker(&mMutex);
+    mWakeups++;
+    qint64 now = mClock.elapsed();
+    qint64 last = now/_OCS_WHEEL_GRANULARITY;
+    qint64 first = qMax(mCursor,last-_OCS_WHEEL_SLOTS+1);
+    mCursor = last;
+
+    // Collect first, the slots may call back into schedule() or cancel()
+    QList<QPair<qint64,Entry> > due;
+    for( qint64 s = first; s <= last; s++ ) {
+        QList<qint64> &slot = mWheel[int(s%_OCS_WHEEL_SLOTS)];
+        QList<qint64> keep;
+        for( int j = 0; j < slot.size(); j++ ) {
+            QHash<qint64,Entry>::iterator it = mEntries.find(slot[j]);
+            if( it == mEntries.end() ) {
+                continue; // Cancelled
+            }
+            if( it.value().fireAt <= now ) {
+                due.append(qMakePair(it.key(),it.value()));
+                mEntries.erase(it);
+            } else {
+                keep.append(slot[j]);
+            }
+        }
+        slot = keep;
+    }
+    mNextWakeup = -1;
+    locker.unlock();
+    for( int i = 0; i < due.size(); i++ ) {
+        const Entry &entry = due[i].second;
+        if( !entry.receiver ) {
+            continue;
+        } else if( entry.passId ) {
+            QMetaObject::invokeMethod(entry.receiver,entry.method.constData(),
+                                      Q_ARG(qint64,due[i].first));
+        } else {
+            QMetaObject::invokeMethod(entry.receiver,entry.method.constData());
+        }
+    }
+    locker.relock();
+    if( mNextWakeup < 0 ) {
+        arm();
+    }
+}
+
+double SyncScheduler::wakeupsPerMinute() const
+{
+    QMutexLocker locker(&mMutex);
+    qint64 elapsed = qMax(qint64(1),mClock.elapsed());
+    return double(mWakeups)*60000.0/double(elapsed);
+}
+
+QStringList SyncScheduler::upcoming(int count) const
+{
+    // Simple insertion into a sorted list, this is only for debugging
+    QMutexLocker locker(&mMutex);
+    QList<const Entry*> sorted;
+    QHash<qint64,Entry>::const_iterator it;
+    for( it = mEntries.constBegin(); it != mEntries.constEnd(); ++it ) {
+        int pos = 0;
+        while( pos < sorted.size() &&
+               sorted[pos]->fireAt <= it.value().fireAt ) {
+            pos++;
+        }
+        sorted.insert(pos,&it.value());
+    }
+    QStringList list;
+    qint64 now = mClock.elapsed();
+    for( int i = 0; i < sorted.size() && i < count; i++ ) {
+        list.append(QString("%1 s  %2")
+                    .arg(double(sorted[i]->fireAt-now)/1000.0,0,'f',1)
+                    .arg(sorted[i]->label));
+    }
+    return list;
+}
@@ -0,0 +1,91 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCSCHEDULER_H
+#define SYNCSCHEDULER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QPointer>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMutex>
+
+class QTimer;
+
+/*! \brief One process wide owner of every deadline.
+  * Deadlines sit in a hashed timer wheel and a single timer is armed for
+  * the earliest one, so nothing wakes the process up in between. Each
+  * deadline may fire up to slack milliseconds late, which is used to snap
+  * it onto one that fires anyway. Jitter spreads out deadlines that would
+  * otherwise all come due at the same moment. Any thread may schedule,
+  * the receiver's slot is invoked on the receiver's own thread. That call
+  * is queued, so a cancel() may still be overtaken by it: a slot taking a
+  * qint64 is handed the id of its deadline, to tell whether it still wants
+  * it.
+  */
+class SyncScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SyncScheduler(QObject *parent = 0);
+
+    qint64 schedule(QObject *receiver, const char *member, qint64 delay,
+                    qint64 slack = 0, qint64 jitter = 0,
+                    QString label = QString());
+    void cancel(qint64 id);
+    void cancelAll(QObject *receiver);
+    bool isScheduled(qint64 id) const;
+    QStringList upcoming(int count = 20) const;
+    qint64 wakeups() const;
+    double wakeupsPerMinute() const;
+
+private:
+    struct Entry {
+        QPointer<QObject> receiver;
+        QByteArray method;
+        QString label;
+        qint64 fireAt;
+        bool passId;
+    };
+    mutable QMutex mMutex;
+    QHash<qint64,Entry> mEntries;
+    QVector<QList<qint64> > mWheel;
+    QElapsedTimer mClock;
+    QTimer *mTimer;
+    qint64 mNextId;
+    qint64 mCursor;     // Last slot that was processed
+    qint64 mNextWakeup; // -1 when nothing is armed
+    qint64 mWakeups;
+    quint32 mRandom;    // Jitter source, shared by every calling thread
+
+    quint32 random();
+    int slotOf(qint64 time) const;
+    qint64 coalesce(qint64 earliest, qint64 latest) const;
+    qint64 earliest() const;
+    void arm();
+
+private slots:
+    void tick();
+};
+
+#endif // SYNCSCHEDULER_H
@@ -0,0 +1,161 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncTrace.h"
+#include "SyncGlobal.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QThread>
+
+// Beyond this the trace stops growing and only counts what it dropped
+#define _OCS_TRACE_LIMIT (64*1024*1024)
+
+QAtomicInt SyncTrace::sEnabled(0);
+
+Q_GLOBAL_STATIC(SyncTrace, getSyncTrace)
+
+SyncTrace *syncTrace()
+{
+    return getSyncTrace();
+}
+
+SyncTrace::SyncTrace()
+    : mDropped(0)
+{
+    mClock.start();
+}
+
+bool SyncTrace::start(QString fileName)
+{
+    QMutexLocker locker(&mLock);
+    if( sEnabled ) {
+        return false;
+    }
+    mFileName = fileName;
+    mEvents.clear();
+    mThreads.clear();
+    mDropped = 0;
+    sEnabled = 1;
+    return true;
+}
+
+QString SyncTrace::fileName()
+{
+    QMutexLocker locker(&mLock);
+    return mFileName;
+}
+
+bool SyncTrace::stop()
+{
+    QMutexLocker locker(&mLock);
+    if( !sEnabled ) {
+        return false;
+    }
+    sEnabled = 0;
+    QFile file(mFileName);
+    if( !file.open(QIODevice::WriteOnly|QIODevice::Truncate) ) {
+        syncDebug() << "Could not write the trace to" << mFileName;
+        mEvents.clear();
+        return false;
+    }
+    file.write("{\"traceEvents\":[\n");
+    file.write(QString("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+                       "\"tid\":0,\"args\":{\"name\":%1}}")
+               .arg(syncJsonString(QCoreApplication::applicationName()))
+               .toUtf8());
+    file.write(mEvents);
+    file.write(QString("\n],\"displayTimeUnit\":\"ms\","
+                       "\"otherData\":{\"dropped_events\":%1}}\n")
+               .arg(mDropped).toUtf8());
+    mEvents.clear();
+    if( mDropped > 0 ) {
+        syncDebug() << "Trace was full," << mDropped << "events were dropped";
+    }
+    return true;
+}
+
+int SyncTrace::threadId()
+{
+    // Small numbers read better in the viewer than native handles. Named
+    // after the thread the first time it shows up.
+    Qt::HANDLE handle = QThread::currentThreadId();
+    QHash<Qt::HANDLE,int>::const_iterator it = mThreads.constFind(handle);
+    if( it != mThreads.constEnd() ) {
+        return it.value();
+    }
+    int id = mThreads.size() + 1;
+    mThreads.insert(handle,id);
+    QString name = QThread::currentThread()->objectName();
+    if( name.isEmpty() ) {
+        name = QString("thread %1").arg(id);
+    }
+    mEvents.append(QString(",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                           "\"pid\":1,\"tid\":%1,\"args\":{\"name\":%2}}")
+                   .arg(id).arg(syncJsonString(name)).toUtf8());
+    return id;
+}
+
+void SyncTrace::append(const char *name, const char *category, char phase,
+                       qint64 start, qint64 duration, quintptr id,
+                       const QString &detail)
+{
+    QMutexLocker locker(&mLock);
+    if( !sEnabled ) {
+        return;
+    }
+    if( mEvents.size() > _OCS_TRACE_LIMIT ) {
+        mDropped++;
+        return;
+    }
+    QByteArray event(",\n{\"name\":\"");
+    event.append(name).append("\",\"cat\":\"").append(category);
+    event.append("\",\"ph\":\"").append(phase).append("\",\"ts\":");
+    event.append(QByteArray::number(start));
+    if( phase == 'X' ) {
+        event.append(",\"dur\":").append(QByteArray::number(duration));
+    } else {
+        event.append(",\"id\":\"0x").append(QByteArray::number(
+                                                 quint64(id),16)).append('"');
+    }
+    event.append(",\"pid\":1,\"tid\":");
+    event.append(QByteArray::number(threadId()));
+    if( !detail.isEmpty() ) {
+        event.append(",\"args\":{\"detail\":");
+        event.append(syncJsonString(detail).toUtf8()).append('}');
+    }
+    event.append('}');
+    mEvents.append(event);
+}
+
+void SyncTrace::complete(const char *name, const char *category, qint64 start,
+                         qint64 duration, const QString &detail)
+{
+    append(name,category,'X',start,duration,0,detail);
+}
+
+void SyncTrace::asyncBegin(const char *name, const char *category, quintptr id,
+                           const QString &detail)
+{
+    append(name,category,'b',now(),0,id,detail);
+}
+
+void SyncTrace::asyncEnd(const char *name, const char *category, quintptr id)
+{
+    append(name,category,'e',now(),0,id,QString());
+}
@@ -0,0 +1,105 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#ifndef SYNCTRACE_H
+#define SYNCTRACE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+/*! \brief Records a timeline in the Chrome trace-event format.
+  * The resulting file loads in chrome://tracing or Perfetto. While it is
+  * not recording, every hook costs a single load of the enabled flag.
+  * Events are kept in memory (up to a limit) and written out on stop().
+  *
+  * Scopes are timed with SYNC_TRACE_SCOPE("name"), which records the time
+  * until the end of the enclosing block. Requests that finish in another
+  * slot than the one that sent them use asyncBegin() and asyncEnd().
+  */
+class SyncTrace
+{
+public:
+    SyncTrace();
+
+    static bool enabled() { return sEnabled; }
+
+    bool start(QString fileName);
+    bool stop();
+    QString fileName();
+
+    qint64 now() const { return mClock.nsecsElapsed()/1000; }
+    void complete(const char *name, const char *category, qint64 start,
+                  qint64 duration, const QString &detail = QString());
+    void asyncBegin(const char *name, const char *category, quintptr id,
+                    const QString &detail = QString());
+    void asyncEnd(const char *name, const char *category, quintptr id);
+
+private:
+    static QAtomicInt sEnabled;
+    QMutex mLock;
+    QElapsedTimer mClock;
+    QString mFileName;
+    QByteArray mEvents;
+    qint64 mDropped;
+    QHash<Qt::HANDLE,int> mThreads;
+
+    void append(const char *name, const char *category, char phase,
+                qint64 start, qint64 duration, quintptr id,
+                const QString &detail);
+    int threadId();
+};
+
+//! The one trace of this process
+SyncTrace *syncTrace();
+
+/*! \brief Times the enclosing block when a trace is being recorded.
+  */
+class SyncTraceScope
+{
+public:
+    explicit SyncTraceScope(const char *name, const char *category = "sync")
+        : mName(0) {
+        if( SyncTrace::enabled() ) {
+            mName = name;
+            mCategory = category;
+            mStart = syncTrace()->now();
+        }
+    }
+    ~SyncTraceScope() {
+        if( mName ) {
+            syncTrace()->complete(mName,mCategory,mStart,
+                                  syncTrace()->now()-mStart);
+        }
+    }
+
+private:
+    const char *mName;
+    const char *mCategory;
+    qint64 mStart;
+};
+
+#define SYNC_TRACE_JOIN2(a,b) a##b
+#define SYNC_TRACE_JOIN(a,b) SYNC_TRACE_JOIN2(a,b)
+#define SYNC_TRACE_SCOPE(name) \
+    SyncTraceScope SYNC_TRACE_JOIN(syncTraceScope,__LINE__)(name)
+
+#endif // SYNCTRACE_H
@@ -23,6 +23,11 @@
 #include "sqlite3_util.h"
 #include "QWebDAV.h"
 #include "SyncQtOwnCloud.h"
+#include "SyncScheduler.h"
+#include "SyncBudget.h"
+#include "SyncProgress.h"
+#include "SyncTrace.h"
+#include "SyncLoopMonitor.h"
 
 #include <QFile>
 #include <QtSql/QSqlDatabase>
@@ -46,17 +51,29 @@
 #include <QCloseEvent>
 #include <QMenu>
 #include <QSettings>
+#include <QThread>
+#include <QMetaObject>
 
 SyncWindow::SyncWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::SyncWindow)
 {
     hide();
+    // Accounts live on their own threads, so these cross in queued signals
+    qRegisterMetaType<SyncQtOwnCloud*>("SyncQtOwnCloud*");
+    qRegisterMetaType<QSystemTrayIcon::MessageIcon>(
+                "QSystemTrayIcon::MessageIcon");
     mProcessedPasswordManager = false;
     mSharedFilters = new QSet<QString>();
+    mScheduler = new SyncScheduler(this);
+    mBudget = new SyncBudget(this);
+    mProgress = new SyncProgress(4,this);
+    mLoopMonitor = new SyncLoopMonitor(this);
+    connect(mProgress,SIGNAL(updated()),this,SLOT(slotProgressUpdated()));
     mIncludedFilters = g_GetIncludedFilterList();
     mQuitAction = false;
     mBusy = false;
+    mSyncingAccounts = 0;
     ui->setupUi(this);
     setWindowTitle("OwnCloud Sync");
     mEditingConfig = -1;
@@ -113,6 +130,13 @@ SyncWindow::SyncWindow(QWidget *parent) :
     configDir.mkpath(mConfigDirectory);
     QDir logsDir(QDir::toNativeSeparators(mConfigDirectory+"/logs"));
     logsDir.mkpath(QDir::toNativeSeparators(mConfigDirectory+"/logs"));
+
+    // OCS_TRACE=<file> records a trace of the whole session into that file
+    QByteArray traceFile = qgetenv("OCS_TRACE");
+    if( !traceFile.isEmpty() ) {
+        syncTrace()->start(QFile::decodeName(traceFile));
+        ui->actionRecord_Trace->setChecked(true);
+    }
     importGlobalFilters(true);
     updateSharedFilterList();
 }
@@ -163,8 +187,8 @@ void SyncWindow::updateStatus()
             mSystemTray->setIcon(mDefaultIcon);
         }
     } else {
-        ui->status->setText(mTransferState+mCurrentFile+" out of "
-                            + QString("%1").arg(mCurrentFileSize));
+        ui->statusBar->showMessage(tr("Version %1: Synchronizing %2 account(s)")
+                                   .arg(_OCS_VERSION).arg(mSyncingAccounts));
         if(mConflictsExist) {
             mSystemTray->setIcon(mSyncConflictIcon);
             ui->labelImage->setPixmap(mSyncConflictIcon.pixmap(129,129));
@@ -181,7 +205,14 @@ SyncWindow::~SyncWindow()
     delete mSystemTray;
     delete mSystemTrayMenu;
     delete mAccountsSignalMapper;
+
+    // Each account goes away with its thread
+    for( int i = 0; i < mAccountThreads.size(); i++ ) {
+        mAccountThreads[i]->quit();
+        mAccountThreads[i]->wait();
+    }
     mAccounts.clear();
+    syncTrace()->stop();
 }
 
 void SyncWindow::saveLogs()
@@ -238,19 +269,34 @@ void SyncWindow::systemTrayActivated(QSystemTrayIcon::ActivationReason reason)
 SyncQtOwnCloud* SyncWindow::addAccount(QString name)
 {
     SyncQtOwnCloud *account = new SyncQtOwnCloud(name,
-                                             mSharedFilters,mConfigDirectory);
+                                             mSharedFilters,mConfigDirectory,
+                                             mScheduler,mBudget,mProgress);
+    QSettings settings("paintblack.com","OwnCloud Sync");
+    mBudget->setWeight(account,settings.value("AccountWeights/"+name,1.0)
+                       .toDouble());
+
+    // The account and all it creates live on a thread of their own, so a
+    // busy pass never holds up the window or the other accounts
+    QThread *thread = new QThread(this);
+    thread->setObjectName(name);
+    account->moveToThread(thread);
+    connect(thread,SIGNAL(finished()),account,SLOT(deleteLater()));
+    thread->start();
     mAccounts.append(account);
     mAccountNames.append(name);
+    mAccountThreads.append(thread);
 
     // Connect the signals
+    connect(account,SIGNAL(loaded(SyncQtOwnCloud*)),
+            this,SLOT(slotAccountLoaded(SyncQtOwnCloud*)));
+    connect(account,SIGNAL(filterListChanged(SyncQtOwnCloud*)),
+            this,SLOT(slotFilterListChanged(SyncQtOwnCloud*)));
     connect(account,SIGNAL(conflictExists(SyncQtOwnCloud*)),
             this,SLOT(slotConflictExists(SyncQtOwnCloud*)));
     connect(account,SIGNAL(conflictResolved(SyncQtOwnCloud*)),
             this,SLOT(slotConflictResolved(SyncQtOwnCloud*)));
-    connect(account,SIGNAL(progressFile(qint64)),
-            this,SLOT(slotProgressFile(qint64)));
-    connect(account,SIGNAL(progressTotal(qint64)),
-            this,SLOT(slotProgressTotal(qint64)));
+    connect(account,SIGNAL(statusChanged(SyncQtOwnCloud*)),
+            this,SLOT(slotAccountStatus(SyncQtOwnCloud*)));
     connect(account,SIGNAL(readyToSync(SyncQtOwnCloud*)),
             this,SLOT(slotReadyToSync(SyncQtOwnCloud*)));
     connect(account,SIGNAL(toLog(QString)),
@@ -263,6 +309,16 @@ SyncQtOwnCloud* SyncWindow::addAccount(QString name)
                                      QSystemTrayIcon::MessageIcon)),
             this,SLOT(slotToMessage(QString,QString,
                                     QSystemTrayIcon::MessageIcon)));
+
+    // Loading reads the whole database, so the window does not wait for it.
+    // These all queue up behind it and the table fills in once it is done.
+    QMetaObject::invokeMethod(account,"load");
+    QMetaObject::invokeMethod(account,"setListingFreshness",
+                              Q_ARG(qint64,mListingFreshness));
+    QMetaObject::invokeMethod(account,"setFullScanInterval",
+                              Q_ARG(qint64,mFullScanDays));
+    QMetaObject::invokeMethod(account,"setPlanMemory",
+                              Q_ARG(qint64,mPlanMemory));
     return account;
 }
 
@@ -289,13 +345,13 @@ void SyncWindow::on_buttonSave_clicked()
             }
         }
         if( okToEdit ) {
-            mAccounts[mEditingConfig]->initialize(
-                        ui->labelHttp->text()+host,
-                        ui->lineUser->text(),
-                        ui->linePassword->text(),
-                        remoteDir,
-                        localDir,
-                        ui->time->value());
+            QMetaObject::invokeMethod(mAccounts[mEditingConfig],"initialize",
+                        Q_ARG(QString,ui->labelHttp->text()+host),
+                        Q_ARG(QString,ui->lineUser->text()),
+                        Q_ARG(QString,ui->linePassword->text()),
+                        Q_ARG(QString,remoteDir),
+                        Q_ARG(QString,localDir),
+                        Q_ARG(qint64,ui->time->value()));
         }
     } else { // New account
         // First, check to see if this name is already taken
@@ -304,12 +360,13 @@ void SyncWindow::on_buttonSave_clicked()
             ui->lineName->setFocus();
         } else { // Good, create a new account
             SyncQtOwnCloud *account = addAccount(ui->lineName->text());
-            account->initialize(ui->labelHttp->text()+host,
-                                ui->lineUser->text(),
-                                ui->linePassword->text(),
-                                remoteDir,
-                                localDir,
-                                ui->time->value());
+            QMetaObject::invokeMethod(account,"initialize",
+                        Q_ARG(QString,ui->labelHttp->text()+host),
+                        Q_ARG(QString,ui->lineUser->text()),
+                        Q_ARG(QString,ui->linePassword->text()),
+                        Q_ARG(QString,remoteDir),
+                        Q_ARG(QString,localDir),
+                        Q_ARG(qint64,ui->time->value()));
         }
     }
     mEditingConfig = -1;
@@ -334,9 +391,13 @@ void SyncWindow::closeEvent(QCloseEvent *event)
                 exportGlobalFilters(true);
 
         // We definitely don't want to quit when we are synchronizing!
+        // Wait for each account's thread to get to these, so nothing is
+        // left half done when we exit.
         for( int i = 0; i < mAccounts.size(); i++ ) {
-            mAccounts[i]->deleteWatcher();    // Delete the file watcher
-            mAccounts[i]->stop(); // Stop the counter
+            QMetaObject::invokeMethod(mAccounts[i],"deleteWatcher",
+                                      Qt::BlockingQueuedConnection);
+            QMetaObject::invokeMethod(mAccounts[i],"stop",
+                                      Qt::BlockingQueuedConnection);
         }
 
 //        for( int i = 0; i < mAccounts.size(); i++ ) {
@@ -350,8 +411,10 @@ void SyncWindow::closeEvent(QCloseEvent *event)
 
         // Before closing, save the database!!!
         for( int i = 0; i < mAccounts.size(); i++ ) {
-            mAccounts[i]->saveConfigToDB();
-            mAccounts[i]->saveDBToFile();
+            QMetaObject::invokeMethod(mAccounts[i],"saveConfigToDB",
+                                      Qt::BlockingQueuedConnection);
+            QMetaObject::invokeMethod(mAccounts[i],"saveDBToFile",
+                                      Qt::BlockingQueuedConnection);
         }
 
         saveLogs();
@@ -428,14 +491,13 @@ void SyncWindow::on_conflict_clicked()
     headers.append(tr("Which wins?"));
     ui->tableConflict->setHorizontalHeaderLabels(headers);
     for( int i = 0; i < mAccounts.size(); i++ ) {
-        QSqlQuery query = mAccounts[i]->getConflicts();
-        query.exec("SELECT * from conflicts;");
-        while( query.next() ) {
+        QList<QStringList> conflicts = mAccounts[i]->getConflicts();
+        for( int j = 0; j < conflicts.size(); j++ ) {
             ui->tableConflict->setRowCount(row+1);
             account = new QTableWidgetItem(mAccounts[i]->getName());
-            name = new QTableWidgetItem(query.value(0).toString());
-            serverTime = new QTableWidgetItem(query.value(2).toString());
-            localTime = new QTableWidgetItem(query.value(3).toString());
+            name = new QTableWidgetItem(conflicts[j][0]);
+            serverTime = new QTableWidgetItem(conflicts[j][2]);
+            localTime = new QTableWidgetItem(conflicts[j][3]);
             combo = new QComboBox(ui->tableConflict);
             combo->addItem(tr("Choose:"));
             combo->addItem("server");
@@ -473,9 +535,11 @@ void SyncWindow::on_buttonBox_accepted()
             allConflictsResolved = false;
             continue; // This conflict has not been resolved
         }
-        getAccount(ui->tableConflict->takeItem(row,0)->text())->
-                processFileConflict(ui->tableConflict->takeItem(row,1)->text(),
-                                    combo->currentText());
+        QMetaObject::invokeMethod(
+                    getAccount(ui->tableConflict->takeItem(row,0)->text()),
+                    "processFileConflict",
+                    Q_ARG(QString,ui->tableConflict->takeItem(row,1)->text()),
+                    Q_ARG(QString,combo->currentText()));
     }
     if( allConflictsResolved) {
         ui->conflict->setEnabled(false);
@@ -504,10 +568,12 @@ void SyncWindow::rebuildAccountsTable()
     QCheckBox *checkbox;
     QPushButton *button;
     QTableWidgetItem *lastSync;
+    QTableWidgetItem *status;
     QStringList headers;
     headers.append(tr("Name"));
     headers.append(tr("Enabled"));
     headers.append(tr("Last Sync"));
+    headers.append(tr("Status"));
     ui->tableAccounts->setHorizontalHeaderLabels(headers);
 
     ui->tableAccounts->setRowCount(mAccounts.size());
@@ -518,9 +584,12 @@ void SyncWindow::rebuildAccountsTable()
                                                            Qt::Unchecked);
         lastSync = new QTableWidgetItem(mAccounts[row]->getLastSync());
         lastSync->setFlags(Qt::ItemIsEnabled);
+        status = new QTableWidgetItem(mAccounts[row]->statusText());
+        status->setFlags(Qt::ItemIsEnabled);
         ui->tableAccounts->setCellWidget(row,0,button);
         ui->tableAccounts->setCellWidget(row,1,checkbox);
         ui->tableAccounts->setItem(row,2,lastSync);
+        ui->tableAccounts->setItem(row,3,status);
         connect(checkbox, SIGNAL(stateChanged(int)),
                 mAccountsSignalMapper, SLOT(map()));
         connect(button,SIGNAL(clicked()),
@@ -535,8 +604,21 @@ void SyncWindow::rebuildAccountsTable()
 
 void SyncWindow::accountEnabledChanged(int row)
 {
-    mAccounts[row]->setEnabled(!mAccounts[row]->isEnabled());
+    QMetaObject::invokeMethod(mAccounts[row],"toggleEnabled");
+}
+void SyncWindow::slotAccountLoaded(SyncQtOwnCloud *oc)
+{
+    // Name, enabled state and last sync are only known after loading
+    rebuildAccountsTable();
 }
+
+void SyncWindow::slotFilterListChanged(SyncQtOwnCloud *oc)
+{
+    if( mEditingConfig >= 0 && mAccounts[mEditingConfig] == oc ) {
+        listFilters(mEditingConfig);
+    }
+}
+
 void SyncWindow::slotConflictExists(SyncQtOwnCloud* oc)
 {
     ui->conflict->setEnabled(true);
@@ -549,14 +631,71 @@ void SyncWindow::slotConflictResolved(SyncQtOwnCloud* oc)
 
 }
 
-void SyncWindow::slotProgressFile(qint64 value)
+void SyncWindow::slotAccountStatus(SyncQtOwnCloud *oc)
 {
-    ui->progressFile->setValue(value);
+    int row = mAccounts.indexOf(oc);
+    QTableWidgetItem *status = ui->tableAccounts->item(row,3);
+    if( row >= 0 && status ) {
+        status->setText(oc->statusText());
+    }
+
+    // The bars show the average over everyone who is syncing
+    int syncing = 0;
+    int file = 0;
+    int total = 0;
+    for( int i = 0; i < mAccounts.size(); i++ ) {
+        if( mAccounts[i]->isBusy() ) {
+            syncing++;
+            file += mAccounts[i]->filePercent();
+            total += mAccounts[i]->totalPercent();
+        }
+    }
+    mBusy = syncing > 0;
+    if( syncing != mSyncingAccounts ) {
+        // Watch the window's own loop for as long as anyone is syncing
+        if( mSyncingAccounts == 0 ) {
+            mLoopMonitor->reset();
+            mLoopMonitor->start();
+        } else if ( syncing == 0 ) {
+            mLoopMonitor->stop();
+            syncDebug() << "Window event loop lag:" << mLoopMonitor->summary();
+        }
+        mSyncingAccounts = syncing;
+        updateStatus();
+    }
+    if( syncing > 0 ) {
+        ui->progressFile->setValue(file/syncing);
+        ui->progressTotal->setValue(total/syncing);
+    }
 }
 
-void SyncWindow::slotProgressTotal(qint64 value)
+void SyncWindow::slotProgressUpdated()
 {
-    ui->progressTotal->setValue(value);
+    // At most a few times a second, however many transfers are running
+    for( int i = 0; i < mAccounts.size(); i++ ) {
+        if( !mProgress->isActive(mAccounts[i]) ) {
+            continue;
+        }
+        QTableWidgetItem *status = ui->tableAccounts->item(i,3);
+        if( status ) {
+            SyncProgress::Snapshot progress = mProgress->account(mAccounts[i]);
+            status->setText(tr("%1, %2, %3 left")
+                            .arg(mAccounts[i]->statusText())
+                            .arg(SyncProgress::formatRate(progress.rate))
+                            .arg(SyncProgress::formatEta(progress.eta)));
+        }
+    }
+    if( mProgress->active() == 0 ) {
+        return;
+    }
+    SyncProgress::Snapshot overall = mProgress->overall();
+    ui->progressFile->setValue(overall.filePercent());
+    ui->progressTotal->setValue(overall.percent());
+    ui->statusBar->showMessage(tr("Version %1: Synchronizing %2 account(s), "
+                                  "%3, %4 left").arg(_OCS_VERSION)
+                               .arg(mSyncingAccounts)
+                               .arg(SyncProgress::formatRate(overall.rate))
+                               .arg(SyncProgress::formatEta(overall.eta)));
 }
 
 void SyncWindow::on_buttonCancel_clicked()
@@ -570,9 +709,7 @@ void SyncWindow::slotReadyToSync(SyncQtOwnCloud* oc)
 {
     mAccountsReadyToSync.enqueue(oc);
     syncDebug() << oc->getName() << " is ready to sync!";
-    if(!mBusy) {
-        processNextStep();
-    }
+    processNextStep();
 }
 
 void SyncWindow::slotToLog(QString text)
@@ -586,20 +723,16 @@ void SyncWindow::slotToStatus(QString text) {
 
 void SyncWindow::processNextStep()
 {
-    if( mAccountsReadyToSync.size() != 0 ) {
-        mBusy = true;
-        mTotalSyncs++;
+    // Accounts sync side by side, the budget shares out the connections
+    while( mAccountsReadyToSync.size() != 0 ) {
         SyncQtOwnCloud *account = mAccountsReadyToSync.dequeue();
-        ui->statusBar->showMessage(tr("Version %1: Synchronizing %2")
-                                   .arg(_OCS_VERSION).arg(account->getName()));
-        account->sync();
-    } else {
-        mBusy = false;
-        updateStatus();
-    }
-    if(mTotalSyncs%mSaveLogCounter == 0 ) {
-        saveLogs();
+        mTotalSyncs++;
+        QMetaObject::invokeMethod(account,"sync");
+        if(mTotalSyncs%mSaveLogCounter == 0 ) {
+            saveLogs();
+        }
     }
+    slotAccountStatus(0);
 }
 
 void SyncWindow::slotFinishedSync(SyncQtOwnCloud *oc)
@@ -712,17 +845,16 @@ void SyncWindow::on_buttonFilterRemove_clicked()
                 ->selection().indexes()[0].row();
     syncDebug() << "Will remove: " << ui->listFilterView->model()->index(index,0)
                 .data(Qt::DisplayRole ).toString();
-    mAccounts[mEditingConfig]->removeFilter(
-                ui->listFilterView->model()->index(index,0)
-                                            .data(Qt::DisplayRole ).toString());
-    listFilters(mEditingConfig);
+    // The list is shown again once the account reports the change
+    QMetaObject::invokeMethod(mAccounts[mEditingConfig],"removeFilter",
+                Q_ARG(QString,ui->listFilterView->model()->index(index,0)
+                                        .data(Qt::DisplayRole ).toString()));
 }
 
 void SyncWindow::on_buttonFilterInsert_clicked()
 {
-    mAccounts[mEditingConfig]->addFilter(
-                ui->lineFilter->text());
-    listFilters(mEditingConfig);
+    QMetaObject::invokeMethod(mAccounts[mEditingConfig],"addFilter",
+                              Q_ARG(QString,ui->lineFilter->text()));
 }
 
 void SyncWindow::on_action_Quit_triggered()
@@ -740,6 +872,11 @@ void SyncWindow::saveApplicationSettings()
     settings.setValue("display_debug",mDisplayDebug);
     settings.setValue("save_log_count",mSaveLogCounter);
     settings.setValue("save_db_time",mSaveDBTime);
+    settings.setValue("listing_freshness",mListingFreshness);
+    settings.setValue("full_scan_days",mFullScanDays);
+    settings.setValue("plan_memory_kb",mPlanMemory);
+    settings.setValue("max_connections",mBudget->limit(SyncBudget::CONNECTION));
+    settings.setValue("max_disk_scans",mBudget->limit(SyncBudget::DISK));
     settings.setValue("last_run_version",_OCS_VERSION);
     settings.endGroup();
     settings.beginGroup("DisabledIncludedFilters");
@@ -762,6 +899,13 @@ void SyncWindow::loadApplicationSettings()
     mDisplayDebug = settings.value("display_debug",false).toBool();
     mSaveLogCounter = settings.value("save_log_count",1000).toLongLong();
     mSaveDBTime = settings.value("save_db_time",370).toLongLong();
+    mListingFreshness = settings.value("listing_freshness",3600).toLongLong();
+    mFullScanDays = settings.value("full_scan_days",7).toLongLong();
+    mPlanMemory = settings.value("plan_memory_kb",4096).toLongLong();
+    mBudget->setLimit(SyncBudget::CONNECTION,
+                      settings.value("max_connections",4).toInt());
+    mBudget->setLimit(SyncBudget::DISK,
+                      settings.value("max_disk_scans",1).toInt());
     QString lastRunVersion = settings.value("last_run_version","").toString();
     if( lastRunVersion != _OCS_VERSION ) { // Need to display what's new
         // message
@@ -786,6 +930,63 @@ void SyncWindow::on_actionEnable_Delete_Account_triggered()
     } // Else we are not editing an account!
 }
 
+void SyncWindow::on_actionVerify_Local_Files_triggered()
+{
+    // Have every account read its whole local tree on its next sync
+    for( int i = 0; i < mAccounts.size(); i++ ) {
+        QMetaObject::invokeMethod(mAccounts[i],"verifyLocalTree");
+    }
+}
+
+void SyncWindow::on_actionShow_Schedule_triggered()
+{
+    // What the scheduler will wake up for next, and how often it did so
+    QStringList list = mScheduler->upcoming();
+    slotToLog(tr("Scheduler: %1 wakeups so far, %2 per minute")
+              .arg(mScheduler->wakeups())
+              .arg(mScheduler->wakeupsPerMinute(),0,'f',2));
+    for( int i = 0; i < list.size(); i++ ) {
+        slotToLog(QString("  ")+list[i]);
+    }
+}
+
+void SyncWindow::on_actionShow_Resources_triggered()
+{
+    // Each account reports from its own thread, into the log and a file
+    for( int i = 0; i < mAccounts.size(); i++ ) {
+        QMetaObject::invokeMethod(mAccounts[i],"dumpResources");
+    }
+}
+
+void SyncWindow::on_actionPlan_Sync_triggered()
+{
+    // Each account lists, scans and compares, then reports and stops there
+    for( int i = 0; i < mAccounts.size(); i++ ) {
+        QMetaObject::invokeMethod(mAccounts[i],"dryRun");
+    }
+}
+
+void SyncWindow::on_actionRecord_Trace_toggled(bool checked)
+{
+    if( checked ) {
+        if( SyncTrace::enabled() ) {
+            return; // Already recording since startup
+        }
+        QString dir = QDir::toNativeSeparators(mConfigDirectory+"/traces");
+        QDir().mkpath(dir);
+        QString name = QDateTime::currentDateTime()
+                .toString("'trace_'yyyyMMdd_hh_mm_ss'.json'");
+        syncTrace()->start(QDir::toNativeSeparators(dir+"/"+name));
+        slotToLog(tr("Recording a trace"));
+    } else {
+        QString fileName = syncTrace()->fileName();
+        if( syncTrace()->stop() ) {
+            slotToLog(tr("Trace written to %1. Open it in chrome://tracing "
+                         "or Perfetto.").arg(fileName));
+        }
+    }
+}
+
 void SyncWindow::on_buttonDeleteAccount_clicked()
 {
     deleteAccount();
@@ -801,8 +1002,14 @@ void SyncWindow::deleteAccount()
     if( box.exec() == QMessageBox::Yes ) { // Delete the account
         ui->textBrowser->append(tr("Deleted account: %1").
                                 arg(mAccounts[mEditingConfig]->getName()));
-        mAccounts[mEditingConfig]->deleteAccount();
+        QMetaObject::invokeMethod(mAccounts[mEditingConfig],"deleteAccount",
+                                  Qt::BlockingQueuedConnection);
+        // Stopping the thread also deletes the account
+        mAccountThreads[mEditingConfig]->quit();
+        mAccountThreads[mEditingConfig]->wait();
+        delete mAccountThreads.takeAt(mEditingConfig);
         mAccounts.removeAt(mEditingConfig);
+        mAccountNames.removeAt(mEditingConfig);
         rebuildAccountsTable();
     }
     ui->stackedWidget->setCurrentIndex(0);
@@ -841,7 +1048,7 @@ void SyncWindow::on_actionDisplay_Debug_Messages_toggled(bool arg1)
 void SyncWindow::on_buttonResume_clicked()
 {
     for( int i = 0; i < mAccounts.size(); i++ ) {
-        mAccounts[i]->resume();
+        QMetaObject::invokeMethod(mAccounts[i],"resume");
 
     }
     ui->buttonPause->setEnabled(true);
@@ -852,7 +1059,7 @@ void SyncWindow::on_buttonResume_clicked()
 void SyncWindow::on_buttonPause_clicked()
 {
     for( int i = 0; i < mAccounts.size(); i++ ) {
-        mAccounts[i]->pause();
+        QMetaObject::invokeMethod(mAccounts[i],"pause");
     }
     ui->buttonPause->setEnabled(false);
     ui->buttonResume->setEnabled(true);
@@ -929,6 +1136,10 @@ void SyncWindow::updateSharedFilterList()
     for(int i =0; i < list.size(); i++ ) {
         mSharedFilters->insert(list[i]);
     }
+    for(int i = 0; i < mAccounts.size(); i++ ) {
+        QMetaObject::invokeMethod(mAccounts[i],"setGlobalFilters",
+                                  Q_ARG(QStringList,mSharedFilters->toList()));
+    }
 }
 
 
@@ -1076,7 +1287,8 @@ void SyncWindow::on_configurationBox_accepted()
     mDisplayDebug = ui->checkShowDebug->isChecked();
     mHideOnStart = ui->checkHideOnStart->isChecked();
     for(int i = 0; i < mAccounts.size(); i++ ) {
-        mAccounts[i]->setSaveDBTime(mSaveDBTime);
+        QMetaObject::invokeMethod(mAccounts[i],"setSaveDBTime",
+                                  Q_ARG(qint64,mSaveDBTime));
     }
 
     // Finally return to the main window
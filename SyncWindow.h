@@ -32,9 +32,14 @@
 class OwnPasswordManager;
 class QTimer;
 class SyncQtOwnCloud;
+class SyncScheduler;
+class SyncBudget;
+class SyncProgress;
+class SyncLoopMonitor;
 class QSignalMapper;
 class QMenu;
 class QListWidgetItem;
+class QThread;
 
 namespace Ui {
     class SyncWindow;
@@ -73,10 +78,12 @@ private:
     QSystemTrayIcon *mSystemTray;
     QMenu *mSystemTrayMenu;
     QList<SyncQtOwnCloud*> mAccounts;
+    QList<QThread*> mAccountThreads;
     SyncQtOwnCloud *mCurrentAccountEdit;
     QStringList mAccountNames;
     qint64 mTotalSyncs;
     bool mBusy;
+    int mSyncingAccounts;
     int mCurrentAccount;
     int mEditingConfig;
     qint64 mTotalToDownload;
@@ -98,6 +105,9 @@ private:
     bool mHideOnClose;
     qint64 mSaveLogCounter;
     qint64 mSaveDBTime;
+    qint64 mListingFreshness;
+    qint64 mFullScanDays;
+    qint64 mPlanMemory;
     bool mProcessedPasswordManager;
 
     QIcon mDefaultIcon;
@@ -106,6 +116,10 @@ private:
     QIcon mSyncConflictIcon;
 
     OwnPasswordManager *mPasswordManager;
+    SyncScheduler *mScheduler;
+    SyncBudget *mBudget;
+    SyncProgress *mProgress;
+    SyncLoopMonitor *mLoopMonitor;
 
     void processNextStep();
     void saveLogs();
@@ -165,8 +179,10 @@ public slots:
     void slotToStatus(QString text);
     void slotConflictExists(SyncQtOwnCloud*);
     void slotConflictResolved(SyncQtOwnCloud*);
-    void slotProgressFile(qint64 value);
-    void slotProgressTotal(qint64 value);
+    void slotAccountStatus(SyncQtOwnCloud *oc);
+    void slotAccountLoaded(SyncQtOwnCloud *oc);
+    void slotFilterListChanged(SyncQtOwnCloud *oc);
+    void slotProgressUpdated();
     void slotReadyToSync(SyncQtOwnCloud*);
     void slotFinishedSync(SyncQtOwnCloud*);
     void slotToMessage(QString caption, QString body,
@@ -175,6 +191,11 @@ public slots:
 private slots:
     void on_action_Quit_triggered();
     void on_actionEnable_Delete_Account_triggered();
+    void on_actionVerify_Local_Files_triggered();
+    void on_actionShow_Schedule_triggered();
+    void on_actionShow_Resources_triggered();
+    void on_actionPlan_Sync_triggered();
+    void on_actionRecord_Trace_toggled(bool checked);
     void on_buttonDeleteAccount_clicked();
     void on_pushButton_clicked();
     void on_pushButton_2_clicked();
@@ -0,0 +1,41 @@
+#-------------------------------------------------
+#
+# Standalone benchmarks for the filter matcher, the local scan and the path
+# helpers. Not part of the application build:
+#
+#   cd bench && qmake && make
+#   ./sync-bench matcher [names]
+#   ./sync-bench scan <directory> [runs]
+#   ./sync-bench paths [paths]
+#
+# Build it a second time with qmake CONFIG+=io_uring to compare the batched
+# statx path of the scan against plain fstatat.
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = sync-bench
+CONFIG   += console
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+SOURCES += main.cpp \
+    ../SyncFilterMatcher.cpp \
+    ../SyncLocalScanner.cpp \
+    ../SyncPath.cpp \
+    ../SyncTrace.cpp
+
+HEADERS += ../SyncGlobal.h \
+    ../SyncFilterMatcher.h \
+    ../SyncLocalScanner.h \
+    ../SyncPath.h \
+    ../SyncTrace.h
+
+linux-*:io_uring {
+    DEFINES += OCS_USE_IO_URING
+    LIBS += -luring
+}
@@ -0,0 +1,268 @@
+/******************************************************************************
+ *    Copyright 2011 Juan Carlos Cornejo jc2@paintblack.com
+ *
+ *    This file is part of owncloud_sync_qt.
+ *
+ *    owncloud_sync is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    owncloud_sync is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with owncloud_sync.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+#include "SyncGlobal.h"
+#include "SyncFilterMatcher.h"
+#include "SyncLocalScanner.h"
+#include "SyncPath.h"
+
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QRegExp>
+#include <QStringList>
+#include <QTextStream>
+
+static QTextStream out(stdout);
+
+// The default filters of a new account, plus a few typical user ones
+static QStringList benchFilters()
+{
+    QStringList filters;
+    filters << ".*.swp" << ".*.swo" << ".~lock.*#" << "*.kate-swp" << "~*"
+            << "*.tacit.fs.part" << "_ocs_serverconflict.*"
+            << "_ocs_uploading.*" << "_ocs_downloading.*"
+            << "*.o" << "*.tmp" << "Thumbs.db" << ".DS_Store" << "*~"
+            << "build*/CMakeFiles";
+    return filters;
+}
+
+// How every file used to be checked: a new expression per glob and per
+// name, a substring search for everything else
+static bool matchesPerFilter(const QStringList &filters, const QString &name)
+{
+    for( int i = 0; i < filters.size(); i++ ) {
+        QString filter = filters[i];
+        if( filter.contains("*") ) {
+            filter.replace("?","\\\?");
+            filter.replace(".","\\\.");
+            filter.replace("*",".*");
+            QRegExp reg(filter);
+            if( name.contains(reg) )
+                return true;
+        } else if( name.contains(filter) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int benchMatcher(int count)
+{
+    QStringList names;
+    const char *suffixes[] = { ".txt", ".cpp", ".o", ".swp", ".jpg", "~",
+                               ".kate-swp", ".pdf" };
+    for( int i = 0; i < count; i++ ) {
+        names.append(QString("dir%1/file%2%3").arg(i%97).arg(i)
+                     .arg(suffixes[i%8]));
+    }
+    QStringList filters = benchFilters();
+    SyncFilterMatcher matcher;
+    matcher.setFilters(filters);
+
+    QElapsedTimer timer;
+    timer.start();
+    int before = 0;
+    for( int i = 0; i < names.size(); i++ ) {
+        if( matchesPerFilter(filters,names[i]) )
+            before++;
+    }
+    qint64 perFilter = qMax(timer.elapsed(),Q_INT64_C(1));
+
+    timer.restart();
+    int after = 0;
+    for( int i = 0; i < names.size(); i++ ) {
+        if( matcher.matches(names[i]) )
+            after++;
+    }
+    qint64 compiled = qMax(timer.elapsed(),Q_INT64_C(1));
+
+    out << "names: " << count << ", filters: " << filters.size() << "\n"
+        << "per filter: " << perFilter << " ms, "
+        << count*1000/perFilter << " names/s, " << before << " matched\n"
+        << "compiled:   " << compiled << " ms, "
+        << count*1000/compiled << " names/s, " << after << " matched\n"
+        << "speedup:    " << double(perFilter)/compiled << "x\n";
+    out.flush();
+    return before == after ? 0 : 1;
+}
+
+// How paths used to lose their base: a new expression for every call
+static QString stringRemoveBasePath(QString path, QString base)
+{
+    if( base != "/" )  {
+        path.replace(QRegExp("^"+base),"");
+    }
+    return path;
+}
+
+static int benchPaths(int count)
+{
+    // A synced folder a few levels deep, like the ones the engine walks
+    QString base = "/home/user/ownCloud";
+    const char *dirs[] = { "Documents", "Photos/2011", "Music/Albums",
+                           "Projects/owncloud_sync/src", "Shared/Team Notes",
+                           "Archive/old/backups" };
+    const char *suffixes[] = { ".txt", ".cpp", ".jpg", ".mp3", ".pdf",
+                               ".odt" };
+    QStringList paths;
+    for( int i = 0; i < count; i++ ) {
+        paths.append(QString("%1/%2/sub%3/file %4%5").arg(base)
+                     .arg(dirs[i%6]).arg(i%53).arg(i).arg(suffixes[i%6]));
+    }
+
+    // The lengths are summed so none of the work can be left out
+    QElapsedTimer timer;
+    timer.start();
+    qint64 before = 0;
+    for( int i = 0; i < paths.size(); i++ ) {
+        before += stringRemoveBasePath(paths[i],base).size();
+    }
+    qint64 regExp = qMax(timer.elapsed(),Q_INT64_C(1));
+
+    timer.restart();
+    qint64 stripped = 0;
+    for( int i = 0; i < paths.size(); i++ ) {
+        stripped += SyncPath::strip(paths[i],base).size();
+    }
+    qint64 strip = qMax(timer.elapsed(),Q_INT64_C(1));
+
+    timer.restart();
+    qint64 copied = 0;
+    for( int i = 0; i < paths.size(); i++ ) {
+        copied += SyncPath::relative(paths[i],base).size();
+    }
+    qint64 relative = qMax(timer.elapsed(),Q_INT64_C(1));
+
+    out << "paths: " << count << ", base: " << base << "\n"
+        << "regexp:   " << regExp << " ms, "
+        << count*1000/regExp << " paths/s\n"
+        << "strip:    " << strip << " ms, "
+        << count*1000/strip << " paths/s, speedup "
+        << double(regExp)/strip << "x\n"
+        << "relative: " << relative << " ms, "
+        << count*1000/relative << " paths/s, speedup "
+        << double(regExp)/relative << "x\n";
+    out.flush();
+    return before == stripped && before == copied ? 0 : 1;
+}
+
+/*! \brief Counts what the scanner hands back, and stops the loop at the end.
+  */
+class ScanCounter : public QObject
+{
+    Q_OBJECT
+public:
+    ScanCounter() : entries(0) {}
+    qint64 entries;
+
+public slots:
+    void entriesReady(QVector<SyncLocalEntry> batch) {
+        entries += batch.size();
+    }
+};
+
+static qint64 walkSingleThreaded(const QString &root)
+{
+    // Roughly what the scan did before it went parallel
+    qint64 entries = 0;
+    QDirIterator it(root,QDir::Files|QDir::Dirs|QDir::NoDotAndDotDot|
+                    QDir::Hidden,QDirIterator::Subdirectories);
+    while( it.hasNext() ) {
+        it.next();
+        QFileInfo info = it.fileInfo();
+        info.size();
+        info.lastModified();
+        entries++;
+    }
+    return entries;
+}
+
+static int benchScan(const QString &root, int runs)
+{
+    SyncFilterMatcher filters;
+    filters.setFilters(benchFilters());
+#ifdef OCS_USE_IO_URING
+    out << "stat path: io_uring statx, falling back to fstatat\n";
+#else
+    out << "stat path: fstatat\n";
+#endif
+    qint64 bestSingle = -1;
+    qint64 bestParallel = -1;
+    qint64 singleEntries = 0;
+    qint64 parallelEntries = 0;
+    for( int run = 0; run < runs; run++ ) {
+        QElapsedTimer timer;
+        timer.start();
+        singleEntries = walkSingleThreaded(root);
+        qint64 single = timer.elapsed();
+
+        SyncLocalScanner scanner;
+        ScanCounter counter;
+        QEventLoop loop;
+        QObject::connect(&scanner,
+                         SIGNAL(entriesReady(QVector<SyncLocalEntry>)),
+                         &counter,
+                         SLOT(entriesReady(QVector<SyncLocalEntry>)));
+        QObject::connect(&scanner,SIGNAL(finished()),&loop,SLOT(quit()));
+        timer.restart();
+        scanner.start(root,filters);
+        loop.exec();
+        qint64 parallel = timer.elapsed();
+        parallelEntries = counter.entries;
+
+        out << "run " << run+1 << ": single " << single << " ms, parallel "
+            << parallel << " ms\n";
+        out.flush();
+        if( bestSingle < 0 || single < bestSingle )
+            bestSingle = single;
+        if( bestParallel < 0 || parallel < bestParallel )
+            bestParallel = parallel;
+    }
+    // The scanner leaves filtered names out, the reference walk does not
+    out << "entries: " << singleEntries << " walked, " << parallelEntries
+        << " scanned\n"
+        << "best: single " << bestSingle << " ms, parallel " << bestParallel
+        << " ms, speedup " << double(qMax(bestSingle,Q_INT64_C(1)))
+           /qMax(bestParallel,Q_INT64_C(1)) << "x\n";
+    out.flush();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc,argv);
+    QStringList args = app.arguments();
+    if( args.size() >= 2 && args[1] == "matcher" ) {
+        return benchMatcher(args.size() > 2 ? args[2].toInt() : 200000);
+    } else if( args.size() >= 3 && args[1] == "scan" ) {
+        QString root = QFileInfo(args[2]).absoluteFilePath();
+        return benchScan(root,args.size() > 3 ? qMax(1,args[3].toInt()) : 3);
+    } else if( args.size() >= 2 && args[1] == "paths" ) {
+        return benchPaths(args.size() > 2 ? args[2].toInt() : 200000);
+    }
+    out << "usage: sync-bench matcher [names]\n"
+        << "       sync-bench scan <directory> [runs]\n"
+        << "       sync-bench paths [paths]\n";
+    out.flush();
+    return 2;
+}
+
+#include "main.moc"
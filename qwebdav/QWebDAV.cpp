@@ -19,6 +19,9 @@
 
 #include "SyncGlobal.h"
 #include "QWebDAV.h"
+#include "SyncPath.h"
+#include "SyncTrace.h"
+#include "SyncResourceReport.h"
 
 // Qt Standard Includes
 #include <QDebug>
@@ -34,16 +37,67 @@
 // Qt's XML Includes
 #include <QDomDocument>
 #include <QDomElement>
+#include <QXmlStreamReader>
 
 // Qt File I/O related
 #include <QFile>
-#include <QFileInfo>
 
 qint64 QWebDAV::mRequestNumber = 0;
 
 QWebDAV::QWebDAV(QObject *parent) :
-    QNetworkAccessManager(parent), mInitialized(false)
+    QNetworkAccessManager(parent), mInitialized(false), mInFlight(0)
 {
+    qRegisterMetaType<QWebDAV::Listing>("QWebDAV::Listing");
+}
+
+void QWebDAV::reportResources(SyncResourceReport *report) const
+{
+    report->add("webdav","replies in flight",mInFlight);
+    qint64 bytes = 0;
+    QHash<qint64,QByteArray*>::const_iterator query;
+    for( query = mRequestQueries.constBegin();
+         query != mRequestQueries.constEnd(); ++query ) {
+        bytes += sizeof(QByteArray) + query.value()->capacity();
+    }
+    report->add("webdav","request bodies",mRequestQueries.size(),bytes);
+    report->add("webdav","open files",mRequestFile.size(),
+                mRequestFile.size()*qint64(sizeof(QFile)));
+    bytes = 0;
+    QHash<QString,TransferLockRequest>::const_iterator lock;
+    for( lock = mTransferLockRequests.constBegin();
+         lock != mTransferLockRequests.constEnd(); ++lock ) {
+        bytes += sizeof(TransferLockRequest)
+                + sizeof(QWebDAVTransferRequestReply)
+                + SyncResourceReport::stringBytes(lock.key())
+                + SyncResourceReport::stringBytes(lock.value().fileName)
+                + SyncResourceReport::stringBytes(lock.value().fileNameTemp)
+                + SyncResourceReport::stringBytes(
+                    lock.value().absoluteFileName);
+    }
+    report->add("webdav","transfer locks",mTransferLockRequests.size(),bytes);
+    bytes = 0;
+    QHash<QString,QString>::const_iterator token;
+    for( token = mLockTokens.constBegin(); token != mLockTokens.constEnd();
+         ++token ) {
+        bytes += SyncResourceReport::stringBytes(token.key())
+                + SyncResourceReport::stringBytes(token.value());
+    }
+    report->add("webdav","lock tokens",mLockTokens.size(),bytes);
+    report->add("webdav","moves",mMoveRequests.size());
+}
+
+QString QWebDAV::FileInfo::typeName() const
+{
+    static const QString collection("collection");
+    static const QString file("file");
+    return type == COLLECTION ? collection : file;
+}
+
+QString QWebDAV::FileInfo::toString() const
+{
+    return QString("\nFile Name:       %1\nLast Modified:   %2"
+                   "\nFile Size:       %3\nType:            %4\n\n\n")
+            .arg(fileName).arg(lastModified).arg(size).arg(typeName());
 }
 
 void QWebDAV::initialize(QString hostname, QString username, QString password,
@@ -61,6 +115,36 @@ void QWebDAV::initialize(QString hostname, QString username, QString password,
     mInitialized = true;
 }
 
+const char *QWebDAV::verbName(int type)
+{
+    switch(type) {
+    case DAVLIST: return "PROPFIND";
+    case DAVGET: return "GET";
+    case DAVPUT: return "PUT";
+    case DAVMKCOL: return "MKCOL";
+    case DAVDELETE: return "DELETE";
+    case DAVMOVE: return "MOVE";
+    case DAVLOCK: return "LOCK";
+    case DAVUNLOCK: return "UNLOCK";
+    default: return "NONE";
+    }
+}
+
+QUrl QWebDAV::urlFor(const QString &path) const
+{
+    // Let QUrl escape nothing on its own, a '#' or '?' in a file name would
+    // end up starting the fragment or the query
+    QUrl url(mHostname);
+    url.setEncodedPath(url.encodedPath()+SyncPath::encode(path));
+    return url;
+}
+
+QString QWebDAV::relativePath(const QUrl &url) const
+{
+    // QUrl::path() comes back decoded already
+    return SyncPath::relative(url.path(),mPathFilter);
+}
+
 QNetworkReply* QWebDAV::sendWebdavRequest(QUrl url, DAVType type,
                                           QByteArray verb, QIODevice *data,
                                           QString extra, QString extra2)
@@ -70,6 +154,14 @@ QNetworkReply* QWebDAV::sendWebdavRequest(QUrl url, DAVType type,
     QNetworkReply *reply;
     request.setUrl(url);
     request.setRawHeader(QByteArray("Host"),url.host().toUtf8());
+    request.setAttribute(QNetworkRequest::Attribute(QNetworkRequest::User+
+                                                    ATTDAVTYPE),int(type));
+    if( type > DAVNONE && type < DAVTYPES ) {
+        mStats.requests[type]++;
+        if( data ) {
+            mStats.bytesSent[type] += data->size();
+        }
+    }
 
     // First, find out what type we want
     if( type == DAVLIST ) {
@@ -131,9 +223,11 @@ QNetworkReply* QWebDAV::sendWebdavRequest(QUrl url, DAVType type,
             // We were given (a) lock token(s).
             request.setRawHeader(QByteArray("If"),
                                  QByteArray(extra2.toAscii()));
+            // Remember which transfer the locks belong to
             request.setAttribute(QNetworkRequest::Attribute(QNetworkRequest::User+
                                                             ATTLOCKTYPE)
-                                 ,QVariant(extra.replace(mHostname,"").toAscii()));
+                                 ,QVariant(relativePath(
+                                               QUrl::fromEncoded(extra.toAscii()))));
         }
         reply = sendCustomRequest(request, verb,0);
     } else if ( type == DAVLOCK) {
@@ -160,6 +254,14 @@ QNetworkReply* QWebDAV::sendWebdavRequest(QUrl url, DAVType type,
         reply = 0;
     }
 
+    if( reply ) {
+        mInFlight++;
+    }
+    if( reply && SyncTrace::enabled() ) {
+        syncTrace()->asyncBegin(verbName(type),"dav",quintptr(reply),
+                                url.path());
+    }
+
     // Connect the finished() signal!
     connectReplyFinished(reply);
     return reply;
@@ -172,7 +274,7 @@ QNetworkReply* QWebDAV::list(QString dir, int depth )
         return 0;
 
     // This is the Url of the webdav server + the directory we want a listing of
-    QUrl url(mHostname+dir);
+    QUrl url = urlFor(dir);
 
     // Prepare the query. We want a listing of all properties the WebDAV
     // server is willing to provide
@@ -181,15 +283,13 @@ QNetworkReply* QWebDAV::list(QString dir, int depth )
     *query += "<?xml version=\"1.0\" encoding=\"utf-8\" ?>";
     *query += "<D:propfind xmlns:D=\"DAV:\">";
     *query += "<D:prop xmlns:D=\"DAV:\">";
-    *query += "<D:getlastmodified/>";
         *query += "<D:getlastmodified/>";
         *query += "<D:getcontentlength/>";
-//        *query += "<D:resourcetype/>";
+        *query += "<D:resourcetype/>";
 //        *query += "<D:quota-used-bytes/>";
 //        *query += "<D:quota-available-bytes/>";
-//            *query += "<D:getetag/>";
-            *query += "<D:getcontenttype/>";
-            *query += "<D:lockdiscovery/>";
+//        *query += "<D:getetag/>";
+        *query += "<D:lockdiscovery/>";
         *query += "</D:prop>";
     *query += "</D:propfind>";
     QBuffer *data = new QBuffer(query);
@@ -209,6 +309,17 @@ void QWebDAV::slotReplyFinished()
 void QWebDAV::slotFinished(QNetworkReply *reply)
 {
     bool keepReply = false;
+    // The whole body is buffered by now, nobody has read any of it yet
+    int type = reply->request().attribute(QNetworkRequest::Attribute(
+                        QNetworkRequest::User+ATTDAVTYPE)).toInt();
+    if( type > DAVNONE && type < DAVTYPES ) {
+        mStats.bytesReceived[type] += reply->bytesAvailable();
+    }
+    mInFlight--;
+    if( SyncTrace::enabled() ) {
+        syncTrace()->asyncEnd(verbName(type),"dav",quintptr(reply));
+    }
+    SYNC_TRACE_SCOPE("QWebDAV::slotFinished");
     if ( reply->error() != 0 ) {
         syncDebug() << "WebDAV request returned error: " << reply->error()
                     << " On URL: " << reply->url().toString();
@@ -220,7 +331,7 @@ void QWebDAV::slotFinished(QNetworkReply *reply)
     if ( reply->request().attribute(
                 QNetworkRequest::User).toString().contains("list") ) {
         //syncDebug() << "Oh a listing! How fun!!";
-        processDirList(reply->readAll(),reply->url().path());
+        processDirList(reply,reply->url().path());
     } else if ( reply->request().attribute(
                     QNetworkRequest::User).toString().contains("get") ) {
         //syncDebug() << "Oh a GET! How fun!!";
@@ -234,8 +345,7 @@ void QWebDAV::slotFinished(QNetworkReply *reply)
         processPutFinished(reply);
     } else if ( reply->request().attribute(
                     QNetworkRequest::User).toString().contains("mkcol")) {
-        emit directoryCreated(reply->request().url().path().replace(
-                                  QRegExp("^"+mPathFilter),""));
+        emit directoryCreated(relativePath(reply->request().url()));
         //
         // Do nothing for now
     } else if( reply->request().attribute(
@@ -245,9 +355,16 @@ void QWebDAV::slotFinished(QNetworkReply *reply)
                     QNetworkRequest::Attribute(
                     QNetworkRequest::User+ATTLOCKTYPE)).toString();
         if(filename != "" &&mTransferLockRequests.contains(filename)) {
-            TransferLockRequest *request = &(mTransferLockRequests[filename]);
-            unlock(request->fileNameTemp,request->tokenTemp);
-            unlock(request->fileName,request->token);
+            // The upload is in place, this is the end of its transfer
+            TransferLockRequest request = mTransferLockRequests.take(filename);
+            unlock(request.fileNameTemp,request.tokenTemp);
+            unlock(request.fileName,request.token);
+            request.reply->deleteLater();
+        }
+        // Or was it a rename we were asked to do?
+        if(mMoveRequests.contains(reply)) {
+            QPair<QString,QString> names = mMoveRequests.take(reply);
+            emit moveFinished(names.first,names.second,reply->error() == 0);
         }
 
     } else if ( reply->request().attribute(
@@ -259,8 +376,8 @@ void QWebDAV::slotFinished(QNetworkReply *reply)
         //syncDebug() << "Unlock reply: " << reply->readAll();
     } else if ( reply->request().attribute(
                     QNetworkRequest::User).toString().contains("lock")) {
-        processLockRequest(reply->readAll(),reply->request().url().path()
-                           .replace(QRegExp("^"+mPathFilter),""),
+        processLockRequest(reply->readAll(),
+                           relativePath(reply->request().url()),
                            reply->request().attribute(
                                QNetworkRequest::Attribute(
                                QNetworkRequest::User+ATTLOCKTYPE)).toString());
@@ -300,24 +417,27 @@ void QWebDAV::processPutFinished(QNetworkReply *reply)
     QString prefix = reply->request().attribute(
                 QNetworkRequest::Attribute(
                     QNetworkRequest::User+ATTPREFIX)).toString();
-    if( prefix != "" ) {
+    QUrl from = reply->request().url();
+    QString name = relativePath(from);
+    if( prefix != "" ) { // The prefix only ever goes on the file name
+        QString file = SyncPath::fileName(name);
+        if( file.startsWith(prefix) ) {
+            name = SyncPath::join(SyncPath::parent(name),file.mid(prefix.size()));
+        }
+        // Both names go out encoded, just like in move()
+        QUrl to = urlFor(name);
         QString tokens = "";
-        QString fileNameTemp = reply->request().url().toString().replace(mHostname,"/files/webdav.php/");
-        QString to = reply->request().url().toString().replace(prefix,"");
-        QString fileName = to;
-        fileName.replace(mHostname,"");
-        if(mTransferLockRequests.contains(fileName)) {
-            TransferLockRequest *request = &(mTransferLockRequests[fileName]);
-            tokens = "<"+fileNameTemp+ "> (<" + request->tokenTemp + ">)"
-                    +"</files/webdav.php/" +fileName +"> (<"+request->token+">)";
+        if(mTransferLockRequests.contains(name)) {
+            TransferLockRequest *request = &(mTransferLockRequests[name]);
+            tokens = "<" + QString(from.encodedPath()) + "> (<"
+                    + request->tokenTemp + ">)"
+                    + "<" + QString(to.encodedPath()) + "> (<"
+                    + request->token + ">)";
         }
         QByteArray verb("MOVE");
-        sendWebdavRequest(reply->request().url(),DAVMOVE,verb,0,
-                          to,tokens);
+        sendWebdavRequest(from,DAVMOVE,verb,0,QString(to.toEncoded()),tokens);
     }
-    emit uploadComplete(
-                reply->request().url().path().replace(
-                    QRegExp("^"+mPathFilter),"").replace(prefix,""));
+    emit uploadComplete(name);
 }
 
 void QWebDAV::slotAuthenticationRequired(QNetworkReply *reply,
@@ -336,108 +456,98 @@ void QWebDAV::dirList(QString dir)
     list(dir,1);
 }
 
-void QWebDAV::processDirList(QByteArray xml, QString url)
+void QWebDAV::processDirList(QIODevice *xml, QString url)
 {
-    syncDebug() << "\n\n\n" << xml;
-    QList<QWebDAV::FileInfo> list;
-    QDomDocument domDocument;
-    QString errorStr;
-    int errorLine;
-    int errorColumn;
-
-    if (!domDocument.setContent(xml, true, &errorStr, &errorLine,
-                                &errorColumn)) {
-        syncDebug() << "Error at line " << errorLine << " column " << errorColumn;
-        syncDebug() << errorStr;
-        emit directoryListingError(url);
-        return;
-    }
-
-    QDomElement root = domDocument.documentElement();
-    if( root.tagName() != "multistatus" ) {
-        syncDebug() << "Badly formatted XML!" << xml;
-        emit directoryListingError(url);
-        return;
-    }
+    SYNC_TRACE_SCOPE("QWebDAV::processDirList");
+    // Read the reply as a stream instead of building a document out of it
+    // first, a large directory would otherwise sit in memory twice. Only
+    // local names are compared, so whatever prefix the server picked for
+    // the DAV: namespace doesn't matter.
+    QVector<QWebDAV::FileInfo> *list = new QVector<QWebDAV::FileInfo>();
+    QXmlStreamReader reader(xml);
 
     QString name;
     QString size;
     QString last;
-    QString type;
-    QString available;
-    bool locked;
-    QDomElement response = root.firstChildElement("response");
-    while (!response.isNull()) {
-        // Parse first response
-        QDomElement child = response.firstChildElement();
-        while (!child.isNull()) {
-            //syncDebug() << "ChildName: " << child.tagName();
-            if ( child.tagName() == "href" ) {
-                name = child.text();
-            } else if ( child.tagName() == "propstat") {
-                QDomElement prop = child.firstChildElement("prop")
-                        .firstChildElement();
-                while(!prop.isNull()) {
-                    //syncDebug() << "PropName: " << prop.tagName();
-                    if( prop.tagName() == "getlastmodified") {
-                        last = prop.text();
-                    } else if ( prop.tagName() == "getcontentlength" ||
-                                prop.tagName() == "quota-used-bytes") {
-                        size = prop.text();
-                    } else if ( prop.tagName() == "quota-available-bytes") {
-                        available = prop.text();
-                    } else if ( prop.tagName() == "resourcetype") {
-                        QDomElement resourseType = prop.firstChildElement("");
-                        type = resourseType.tagName();
-                    } else if ( prop.tagName() == "lockdiscovery") {
-                        if(prop.text() == "" ) { // Not locked
-                            locked = false;
-                        } else { // Locked
-                            QDomElement lock = prop.firstChildElement("activelock");
-                            while(!lock.isNull()) {
-                                if( prop.tagName() == "lockscope" &&
-                                        prop.text() == "exclusive" ) {
-                                    locked = true;
-                                }
-                                lock = lock.nextSiblingElement();
-                            }
-                        }
-                    }
-
-                    prop = prop.nextSiblingElement();
+    bool collection = false;
+    bool locked = false;
+    bool inResponse = false;
+    bool sawRoot = false;
+    while( !reader.atEnd() ) {
+        if( reader.readNext() != QXmlStreamReader::StartElement ) {
+            if( reader.isEndElement() && inResponse
+                    && reader.name() == "response" ) {
+                inResponse = false;
+                // The only place a listed name gets decoded
+                name = SyncPath::decode(name.toAscii());
+                // Filter out the requested directory from this list
+                if( !(collection && name == url) ) {
+                    // Filter out the pathname from the filename
+                    name = SyncPath::relative(name,mPathFilter);
+                    mStats.listingEntries++;
+                    list->append(QWebDAV::FileInfo(name,parseDate(last),
+                            size.toLongLong(),
+                            collection ? FileInfo::COLLECTION : FileInfo::FILE,
+                            locked ? FileInfo::LOCKED : 0));
                 }
             }
-            child = child.nextSiblingElement();
+            continue;
         }
-//        syncDebug() << "Name: " << name << "\nSize: " << size << "\nLastModified: "
-//                 << last << "\nSizeAvailable: " << available << "\nType: "
-//                 << type << "\n";
-        // Filter out the requested directory from this list
-        //syncDebug() << "Type: " << type << "Name: " << name << " URL: " << url;
-        name = QUrl::fromPercentEncoding(name.toAscii());
-        if( !(type == "collection" && name == url) ) {
-            // Filter out the pathname from the filename and decode URL
-            name.replace(mPathFilter,"");
-
-            // Store lastmodified as an EPOCH format
-            last.replace(" +0000","");
-            last.replace(",","");
-            QDateTime date = QDateTime::fromString(last,
-                                                   "ddd dd MMM yyyy HH:mm:ss");
-            date.setTimeSpec(Qt::UTC);
-            last = QString("%1").arg(date.toMSecsSinceEpoch());
-            list.append(QWebDAV::FileInfo(name,last,size.toLongLong(),
-                                          available.toLongLong(),type));
+        QStringRef tag = reader.name();
+        if( !sawRoot ) {
+            sawRoot = true;
+            if( tag != "multistatus" ) {
+                syncDebug() << "Badly formatted XML! Root element is"
+                            << tag.toString();
+                delete list;
+                emit directoryListingError(url);
+                return;
+            }
+        } else if( tag == "response" ) {
+            inResponse = true;
+            name = size = last = "";
+            collection = locked = false;
+        } else if( !inResponse ) {
+            continue;
+        } else if( tag == "href" ) {
+            name = reader.readElementText();
+        } else if( tag == "getlastmodified" ) {
+            QString text = reader.readElementText();
+            // Properties the server doesn't have come back empty
+            if( !text.isEmpty() )
+                last = text;
+        } else if( tag == "getcontentlength" || tag == "quota-used-bytes" ) {
+            QString text = reader.readElementText();
+            if( !text.isEmpty() )
+                size = text;
+        } else if( tag == "collection" ) {
+            collection = true;
+        } else if( tag == "exclusive" ) { // Only appears in a lockscope
+            locked = true;
         }
-        name = size = last = type = available = "";
-        response = response.nextSiblingElement();
     }
-    //for(int i = 0; i < list.size(); i++ ) {
-    //    list[i].print();
-    //}
+    if( reader.hasError() ) {
+        syncDebug() << "Error at line " << reader.lineNumber() << " column "
+                    << reader.columnNumber();
+        syncDebug() << reader.errorString();
+        delete list;
+        emit directoryListingError(url);
+        return;
+    }
 
     // Let whoever is listening know that we have their stuff ready!
-    emit directoryListingReady(list);
+    emit directoryListingReady(QWebDAV::Listing(list));
+}
+
+qint64 QWebDAV::parseDate(QString date)
+{
+    // Store lastmodified as an EPOCH format
+    date.replace(" +0000","");
+    date.replace(" GMT","");
+    date.replace(",","");
+    QDateTime parsed = QDateTime::fromString(date,"ddd dd MMM yyyy HH:mm:ss");
+    parsed.setTimeSpec(Qt::UTC);
+    return parsed.toMSecsSinceEpoch();
 }
 
 QNetworkReply* QWebDAV::get(QString fileName)
@@ -447,7 +557,7 @@ QNetworkReply* QWebDAV::get(QString fileName)
         return 0;
 
     // This is the Url of the webdav server + the file we want to get
-    QUrl url(mHostname+fileName);
+    QUrl url = urlFor(fileName);
 
     // Finally send this to the WebDAV server
     QNetworkReply *reply = sendWebdavRequest(url,DAVGET);
@@ -473,7 +583,7 @@ QNetworkReply* QWebDAV::put_locked(QString fileName, QByteArray data,
 {
 
     // This is the Url of the webdav server + the file we want to get
-    QUrl url(mHostname+fileName);
+    QUrl url = urlFor(fileName);
 
     // First lock the resource
 
@@ -503,18 +613,15 @@ QNetworkReply* QWebDAV::put(QString fileName, QString absoluteFileName,
     // 3) Unlock resource
     QString tempFileName = "";
     if ( put_prefix != "" ) {
-        QFileInfo info(fileName);
-        tempFileName = info.absolutePath()+"/"+put_prefix+
-                   info.fileName();
+        tempFileName = SyncPath::join(SyncPath::parent(fileName),
+                                      put_prefix+SyncPath::fileName(fileName));
     }
     mTransferLockRequests[fileName] = TransferLockRequest(
                 true,fileName,tempFileName,absoluteFileName,put_prefix,
                 new QWebDAVTransferRequestReply());
     lock(fileName,fileName);
     if ( put_prefix != "" ) {
-        QFileInfo info(fileName);
-        lock(info.absolutePath()+"/"+put_prefix+
-                   info.fileName(),fileName);
+        lock(tempFileName,fileName);
     }
     return mTransferLockRequests[fileName].reply;
 }
@@ -525,11 +632,10 @@ QNetworkReply* QWebDAV::put_locked(QString fileName, QString absoluteFileName,
     // This is the Url of the webdav server + the file we want to put
     QUrl url;
     if ( put_prefix == "" ) {
-        url.setUrl(mHostname+fileName);
+        url = urlFor(fileName);
     } else {
-        QFileInfo info(fileName);
-        url.setUrl(mHostname+info.absolutePath()+"/"+put_prefix+
-                   info.fileName());
+        url = urlFor(SyncPath::join(SyncPath::parent(fileName),
+                                    put_prefix+SyncPath::fileName(fileName)));
     }
 
     // Encapsulate data in an QIODevice
@@ -538,6 +644,7 @@ QNetworkReply* QWebDAV::put_locked(QString fileName, QString absoluteFileName,
     if (!file->open(QIODevice::ReadOnly)) {
         syncDebug() << "File read error " + absoluteFileName +" Code: "
                     << file->error();
+        delete file;
         return 0;
     }
     mRequestFile[mRequestNumber] = file;
@@ -560,7 +667,7 @@ QNetworkReply* QWebDAV::mkdir(QString dirName)
         return 0;
 
     // This is the URL of the webdav server + the file we want to get
-    QUrl url(mHostname+dirName);
+    QUrl url = urlFor(dirName);
 
     // Finally send this to the WebDAV server
     QByteArray verb("MKCOL");
@@ -569,6 +676,23 @@ QNetworkReply* QWebDAV::mkdir(QString dirName)
     return reply;
 }
 
+QNetworkReply* QWebDAV::move(QString from, QString to)
+{
+    // Make sure the user has already initialized this instance!
+    if (!mInitialized)
+        return 0;
+
+    // The destination has to be the full URL
+    QUrl url = urlFor(from);
+    QUrl destination = urlFor(to);
+
+    QByteArray verb("MOVE");
+    QNetworkReply *reply = sendWebdavRequest(url,DAVMOVE,verb,0,
+                                             QString(destination.toEncoded()));
+    mMoveRequests.insert(reply,QPair<QString,QString>(from,to));
+    return reply;
+}
+
 void QWebDAV::slotReadyRead()
 {
     //syncDebug() << "Data ready to be read!";
@@ -586,8 +710,7 @@ void QWebDAV::slotError(QNetworkReply::NetworkError error)
 void QWebDAV::processFile(QNetworkReply* reply)
 {
     // Remove all the WebDAV paths and just leave the base names
-    QString fileName = reply->request().url().path().replace(mPathFilter,"")
-            .replace("\%20"," ");
+    QString fileName = relativePath(reply->request().url());
 
     //syncDebug() << "File Ready: " << fileName;
     emit fileReady(reply,fileName);
@@ -606,7 +729,7 @@ QNetworkReply* QWebDAV::deleteFile( QString name )
         return 0;
 
     // This is the URL of the webdav server + the file we want to get
-    QUrl url(mHostname+name);
+    QUrl url = urlFor(name);
 
     // Finally send this to the WebDAV server
     QByteArray verb("DELETE");
@@ -635,7 +758,7 @@ QNetworkReply *QWebDAV::lock( QString url, QString type )
     mRequestData[mRequestNumber] = data;
     QByteArray verb("LOCK");
     // Now send this to the WebDAV server
-    QNetworkReply *reply = sendWebdavRequest(QUrl(mHostname+url),
+    QNetworkReply *reply = sendWebdavRequest(urlFor(url),
                                              DAVLOCK,verb,data,type);
     return reply;
 }
@@ -665,8 +788,19 @@ void QWebDAV::processLockRequest(QByteArray xml, QString url, QString extra)
             if(!exception.isNull()&&exception.text()
                     =="Sabre_DAV_Exception_ConflictingLock") {
                 syncDebug() << "Resource already locked!";
-                if(extra != "") {
-                    emit errorFileLocked(mTransferLockRequests[extra].fileName);
+                if(extra != "" && mTransferLockRequests.contains(extra)) {
+                    // Give up on the transfer, and on the lock we may
+                    // already hold on its other name
+                    TransferLockRequest request =
+                            mTransferLockRequests.take(extra);
+                    if(request.token != "") {
+                        unlock(request.fileName,request.token);
+                    }
+                    if(request.tokenTemp != "") {
+                        unlock(request.fileNameTemp,request.tokenTemp);
+                    }
+                    request.reply->deleteLater();
+                    emit errorFileLocked(request.fileName);
                 }
             }
         }
@@ -680,7 +814,10 @@ void QWebDAV::processLockRequest(QByteArray xml, QString url, QString extra)
             if(!locktoken.isNull()) {
                 QDomElement href = locktoken.firstChildElement("href");
                 if(!href.isNull()) {
-                    if(extra != "") {
+                    if(extra != "" && !mTransferLockRequests.contains(extra)) {
+                        // Its transfer was already given up
+                        unlock(url,href.text());
+                    } else if(extra != "") {
                         TransferLockRequest *request = &(mTransferLockRequests[extra]);
                         if(url == request->fileName  ) { // This is the lock on
                             // the permanent file
@@ -692,9 +829,20 @@ void QWebDAV::processLockRequest(QByteArray xml, QString url, QString extra)
                                 request->token != ""
                                 && (request->tokenTemp != ""
                                     || request->fileNameTemp == "")) {
-                            request->reply->setReply(put_locked(request->fileName,
+                            QNetworkReply *put = put_locked(request->fileName,
                                                     request->absoluteFileName,
-                                                    request->put_prefix));
+                                                    request->put_prefix);
+                            if(put) {
+                                request->reply->setReply(put,false);
+                            } else { // Nothing to put after all
+                                TransferLockRequest failed =
+                                        mTransferLockRequests.take(extra);
+                                unlock(failed.fileName,failed.token);
+                                if(failed.fileNameTemp != "") {
+                                    unlock(failed.fileNameTemp,failed.tokenTemp);
+                                }
+                                failed.reply->deleteLater();
+                            }
                         } else { // Get request
 
                         }
@@ -713,8 +861,10 @@ QNetworkReply *QWebDAV::unlock( QString url )
 {
     if( !mInitialized )
         return 0;
-    syncDebug() << "Will unlock: " << url << "\tToken: " << mLockTokens[url];
-    return unlock(url,mLockTokens[url]);
+    // The token is no good once the lock is released
+    QString token = mLockTokens.take(url);
+    syncDebug() << "Will unlock: " << url << "\tToken: " << token;
+    return unlock(url,token);
 }
 
 QNetworkReply *QWebDAV::unlock( QString url, QString token )
@@ -724,7 +874,7 @@ QNetworkReply *QWebDAV::unlock( QString url, QString token )
 
     QByteArray verb("UNLOCK");
     // Now send this to the WebDAV server
-    QNetworkReply *reply = sendWebdavRequest(QUrl(mHostname+url)
+    QNetworkReply *reply = sendWebdavRequest(urlFor(url)
                                              ,DAVUNLOCK,verb,0,token);
     return reply;
 }
@@ -23,11 +23,16 @@
 #include <QSslError>
 #include <QDebug>
 #include <QNetworkReply>
+#include <QSharedPointer>
+#include <QVector>
+#include <QMetaType>
+#include <QPointer>
 
 class QBuffer;
 class QUrl;
 class QFile;
 class QWebDAVTransferRequestReply;
+class SyncResourceReport;
 
 
 class QWebDAV : public QNetworkAccessManager
@@ -47,14 +52,31 @@ public:
         DAVDELETE,
         DAVMOVE,
         DAVLOCK,
-        DAVUNLOCK
+        DAVUNLOCK,
+        DAVTYPES
     };
 
     enum ATTRIBUTETYPE {
         ATTDATA = 1,
         ATTFILE,
         ATTPREFIX,
-        ATTLOCKTYPE
+        ATTLOCKTYPE,
+        ATTDAVTYPE
+    };
+
+    /*! \brief What went over the wire since this instance was created.
+      * Indexed by DAVType. Only ever growing, so callers take differences.
+      */
+    struct Stats {
+        qint64 requests[DAVTYPES];
+        qint64 bytesSent[DAVTYPES];
+        qint64 bytesReceived[DAVTYPES];
+        qint64 listingEntries;
+        Stats() : listingEntries(0) {
+            for( int i = 0; i < DAVTYPES; i++ ) {
+                requests[i] = bytesSent[i] = bytesReceived[i] = 0;
+            }
+        }
     };
 
     struct TransferLockRequest {
@@ -81,53 +103,38 @@ public:
         }
     };
 
+    /*! \brief One entry of a directory listing.
+      * Kept small, since a listing can hold a great many of these: the
+      * times and sizes are plain integers and the type is an enum.
+      */
     struct FileInfo {
-        QString fileName;
-        QString lastModified;
-        qlonglong size;
-        qlonglong sizeAvailable;
-        QString type;
-        bool locked;
-        FileInfo(QString name, QString last, qlonglong fileSize,
-                 qlonglong available, QString fileType, bool lock = false ) {
-            fileName = name;
-            lastModified = last;
-            size = fileSize;
-            sizeAvailable = available;
-            if( fileType == "" ) {
-                type = "file";
-            } else {
-                type = fileType;
-            }
-            locked = lock;
+        enum Type {
+            FILE,
+            COLLECTION
         };
-        QString toString()
-        {
-            QString available;
-            if( type == "collection") {
-                available = QString("\nAvailable Space: %1").arg(sizeAvailable);
-            }
-            QString output = QString("\nFile Name:       %1\nLast Modified:   %2"
-                                     "\nFile Size:       %3\nType:            %4"
-                                     )
-                                     .arg(fileName)
-                                     .arg(lastModified).arg(size).arg(type);
-                    output += available;
-            output.append("\n\n\n");
-            return output;
-
-        }
-        void print() {
-            qDebug() << toString().toAscii();
-        }
-
-        QString formatSize()
-        {
-            //if ( size > 1099511627776 ) // 1TB
-            return QString();
-        }
+        enum Flag {
+            LOCKED = 0x1
+        };
+        QString fileName;
+        qint64 size;
+        qint64 lastModified; // UTC, milliseconds since epoch
+        quint8 type;
+        quint8 flags;
+        FileInfo() : size(0), lastModified(0), type(FILE), flags(0) {}
+        FileInfo(QString name, qint64 last, qint64 fileSize, Type fileType,
+                 quint8 fileFlags = 0)
+            : fileName(name), size(fileSize), lastModified(last),
+              type(fileType), flags(fileFlags) {}
+        bool isCollection() const { return type == COLLECTION; }
+        bool isLocked() const { return flags & LOCKED; }
+        // As the type is stored in the database
+        QString typeName() const;
+        QString toString() const;
     };
 
+    //! A whole listing, handed on without copying its entries
+    typedef QSharedPointer<const QVector<FileInfo> > Listing;
+
     // DAV Public Functions
     QNetworkReply* deleteFile(QString name);
     void dirList(QString dir = "/");
@@ -138,12 +145,17 @@ public:
     QNetworkReply* put(QString fileName , QString absoluteFileName,
                        QString put_prefix="");
     QNetworkReply* mkdir(QString dirName );
+    QNetworkReply* move(QString from, QString to);
     QNetworkReply* sendWebdavRequest( QUrl url, DAVType type,
                                       QByteArray verb = 0,QIODevice *data = 0,
                                       QString extra = "1", QString extra2 = "");
     QNetworkReply* lock(QString name, QString type = "");
     QNetworkReply* unlock(QString name);
     QNetworkReply* unlock(QString name, QString token);
+    const Stats &stats() const { return mStats; }
+    int inFlight() const { return mInFlight; }
+    void reportResources(SyncResourceReport *report) const;
+    static const char *verbName(int type);
 
 private:
     QString mHostname;
@@ -158,8 +170,14 @@ private:
     QHash<qint64,QFile*> mRequestFile;
     QHash<QString,QString> mLockTokens;
     QHash<QString,TransferLockRequest> mTransferLockRequests;
-
-    void processDirList(QByteArray xml, QString url);
+    QHash<QNetworkReply*,QPair<QString,QString> > mMoveRequests;
+    Stats mStats;
+    int mInFlight;
+
+    QUrl urlFor(const QString &path) const;
+    QString relativePath(const QUrl &url) const;
+    void processDirList(QIODevice *xml, QString url);
+    qint64 parseDate(QString date);
     void processFile(QNetworkReply* reply);
     void processLocalDirectory(QString dirPath);
     void processPutFinished(QNetworkReply *reply);
@@ -171,10 +189,11 @@ private:
                        QString put_prefix="");
 
 signals:
-    void directoryListingReady(QList<QWebDAV::FileInfo>);
+    void directoryListingReady(QWebDAV::Listing listing);
     void fileReady(QNetworkReply *reply, QString fileName);
     void uploadComplete(QString name);
     void directoryCreated(QString name);
+    void moveFinished(QString from, QString to, bool success);
     void directoryListingError(QString url);
     void errorFileLocked(QString fileName);
 
@@ -187,13 +206,17 @@ public slots:
     void slotError(QNetworkReply::NetworkError error);
 };
 
+Q_DECLARE_TYPEINFO(QWebDAV::FileInfo, Q_MOVABLE_TYPE);
+Q_DECLARE_METATYPE(QWebDAV::Listing)
+
 class QWebDAVTransferRequestReply : public QNetworkReply
 {
     Q_OBJECT
 public:
-    QWebDAVTransferRequestReply() { mReply = 0; }
+    QWebDAVTransferRequestReply() {}
     ~QWebDAVTransferRequestReply()
     {
+        // The request may well have been cleaned up already
         if(mReply)
             mReply->deleteLater();
     }
@@ -213,7 +236,7 @@ public:
     qint64 readData(char*,qint64) {}
     void abort() {}
 private:
-    QNetworkReply *mReply;
+    QPointer<QNetworkReply> mReply;
 
 public slots:
     void downloadProgress(qint64 current,qint64 total)
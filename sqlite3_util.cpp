@@ -88,3 +88,51 @@ bool sqlite3_util::sqliteDBMemFile( QSqlDatabase memdb, QString filename, bool s
     }
     return state;
 }
+
+#if SQLITE_VERSION_NUMBER >= 3014000
+static int countStatement( unsigned mask, void *counter, void *, void * )
+{
+    if( mask == SQLITE_TRACE_STMT )
+        (*static_cast<qint64 *>(counter))++;
+    return 0;
+}
+#endif
+
+bool sqlite3_util::countStatements( QSqlDatabase db, qint64 *counter )
+{
+#if SQLITE_VERSION_NUMBER >= 3014000
+    QVariant v = db.driver()->handle();
+    if( v.isValid() && qstrcmp(v.typeName(),"sqlite3*") == 0 )
+    {
+        sqlite3 * handle = *static_cast<sqlite3 **>(v.data());
+        if( handle != 0 )
+        {
+            int rc = sqlite3_trace_v2( handle, counter ? SQLITE_TRACE_STMT : 0,
+                                       counter ? countStatement : 0, counter );
+            return rc == SQLITE_OK;
+        }
+    }
+#else
+    Q_UNUSED(db);
+    Q_UNUSED(counter);
+#endif
+    return false;
+}
+
+qint64 sqlite3_util::cacheBytes( QSqlDatabase db )
+{
+    QVariant v = db.driver()->handle();
+    if( v.isValid() && qstrcmp(v.typeName(),"sqlite3*") == 0 )
+    {
+        sqlite3 * handle = *static_cast<sqlite3 **>(v.data());
+        if( handle != 0 )
+        {
+            int current = 0;
+            int highwater = 0;
+            if( sqlite3_db_status( handle, SQLITE_DBSTATUS_CACHE_USED,
+                                   &current, &highwater, 0 ) == SQLITE_OK )
+                return current;
+        }
+    }
+    return -1;
+}
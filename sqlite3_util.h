@@ -9,5 +9,9 @@
 
 namespace sqlite3_util {
     bool sqliteDBMemFile( QSqlDatabase memdb, QString filename, bool save );
+    // Counts every statement run on db into *counter, 0 stops counting
+    bool countStatements( QSqlDatabase db, qint64 *counter );
+    // Heap bytes held by the page cache of db, -1 when unknown
+    qint64 cacheBytes( QSqlDatabase db );
 }
 #endif
@@ -25,15 +25,54 @@ SOURCES += main.cpp\
         sqlite3_util.cpp \
         SyncWindow.cpp \
     qwebdav/QWebDAV.cpp \
-    SyncQtOwnCloud.cpp
+    SyncQtOwnCloud.cpp \
+    SyncPathTable.cpp \
+    SyncPathTree.cpp \
+    SyncFilterMatcher.cpp \
+    SyncLocalScanner.cpp \
+    SyncDirWatcher.cpp \
+    SyncEventCoalescer.cpp \
+    SyncScheduler.cpp \
+    SyncBudget.cpp \
+    SyncLoopMonitor.cpp \
+    SyncIOService.cpp \
+    SyncPath.cpp \
+    SyncPlanReport.cpp \
+    SyncMetrics.cpp \
+    SyncTrace.cpp \
+    SyncResourceReport.cpp \
+    SyncProgress.cpp
 
 HEADERS  += sqlite3_util.h \
             SyncWindow.h \
             qwebdav/QWebDAV.h \
     SyncQtOwnCloud.h \
-    SyncGlobal.h
+    SyncGlobal.h \
+    SyncPathTable.h \
+    SyncPathTree.h \
+    SyncFilterMatcher.h \
+    SyncLocalScanner.h \
+    SyncDirWatcher.h \
+    SyncEventCoalescer.h \
+    SyncScheduler.h \
+    SyncBudget.h \
+    SyncLoopMonitor.h \
+    SyncIOService.h \
+    SyncPath.h \
+    SyncPlanReport.h \
+    SyncMetrics.h \
+    SyncTrace.h \
+    SyncResourceReport.h \
+    SyncProgress.h
 
 FORMS    += SyncWindow.ui
+
+# Batch the stat calls of the local scan through io_uring (Linux 5.6+ and
+# liburing). Build with: qmake CONFIG+=io_uring
+linux-*:io_uring {
+    DEFINES += OCS_USE_IO_URING
+    LIBS += -luring
+}
 INCLUDEPATH += qwebdav/
 
 #INCLUDEPATH += $$[QT_INSTALL_PREFIX]/src/3rdparty/sqlite